@@ -0,0 +1,15 @@
+/** @file      Boot.h
+ * @brief      Resident boot code in the first flash page. Starts the application image, or the DFU bootloader if it is not complete
+ * @details    See Boot.c
+ */
+
+#ifndef BOOT_H_
+#define BOOT_H_
+
+/* Boot code is placed in the BOOT region by the linker script. It runs before the startup code has set up RAM, so it
+   can't use variables, and must not call anything outside its section: no library calls, switch tables or constant tables */
+#define BOOT_CODE __attribute__((section(".boot"), noinline, optimize("no-tree-loop-distribute-patterns")))
+
+void Boot_Reset(void);
+
+#endif
@@ -0,0 +1,30 @@
+/** @file      Buffer_Pool.h
+ * @brief      Fixed block buffer pool shared by the USB, packet framing and capture buffers
+ * @details    See Buffer_Pool.c
+ */
+
+#ifndef BUFFER_POOL_H_
+#define BUFFER_POOL_H_
+
+#include <stdint.h>
+
+#define POOL_BLOCK_SIZE 64      // Bytes per block. One full speed USB packet. Must be a multiple of 4 so every block is word aligned
+#define POOL_NUM_BLOCKS 8       // Number of blocks in the pool. Sets the RAM used by the pool. Must be 32 or less, and hold the CDC receive
+                                // buffer plus COMMS_POOL_BLOCKS (checked in usbd_cdc_if.c)
+
+/**
+  * @brief  Snapshot of the pool usage, in blocks
+  */
+typedef struct
+{
+    uint8_t Total;          // Number of blocks in the pool
+    uint8_t Used;           // Blocks currently allocated
+    uint8_t Peak;           // Most blocks allocated at once since power on
+    uint16_t Fails;         // Number of allocations that could not be satisfied since power on
+}Buffer_Pool_Usage_Type;
+
+void *Buffer_Pool_Alloc(uint16_t Size);
+void Buffer_Pool_Free(void *Buf);
+void Buffer_Pool_Get_Usage(Buffer_Pool_Usage_Type *Usage);
+
+#endif
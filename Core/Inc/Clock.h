@@ -1,12 +0,0 @@
-/** @file      Clock.h
- * @brief      Brief for Clock.h
- * @details    Details for Clock.h
- */
-
-#ifndef CLOCK_H_
-#define CLOCK_H_
-
-float Clock_Get_Timer_ms(void);
-void Clock_Calc_Timer_ms(void);
-
-#endif
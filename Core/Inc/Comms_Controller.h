@@ -8,8 +8,14 @@
 #include <stdint.h>
 
 void Comms_Controller_Bytes_Received(uint8_t *Buf, uint32_t Num_Bytes);
+void Comms_Controller_Connect_USB(void);
+void Comms_Controller_Deferred(void);
+uint32_t Comms_Controller_Get_Command_Bitmap(void);
+uint16_t Comms_Controller_Get_Frame(uint32_t *SOF_us);
 void Comms_Controller_Initialise(void);
 void Comms_Controller_Reset_USB(void);
+void Comms_Controller_SOF_Interrupt(void);
 void Comms_Controller_Timer_Interrupt(void);
+void Comms_Controller_Tx_Done(void);
 
 #endif
@@ -11,8 +11,13 @@
 
 #define SOP_BYTE '{'            // Start of packet identifier
 #define EOP_BYTE '}'            // End of packet identifier
-#define PAYLOAD_BUF_SIZE 30     // How many bytes of storage do we allocate for transmit and receive payloads. This is dependent on the amount of data we will pass.  
-#define BYTE_TIMEOUT_MS 500     // How many ms do we wait between bytes before assuming the other end of the comms has died
+#define PAYLOAD_BUF_SIZE 58     // How many bytes of storage do we allocate for transmit and receive payloads. This is dependent on the amount of data we will pass. 58 + 5 framing bytes fits one 64 byte USB packet  
+#define FRAME_BUF_SIZE (PAYLOAD_BUF_SIZE + 5)   // Longest frame sent: the payload plus the SOP, CMD, EOP and CRLF bytes
+#define COMMS_PROTOCOL_VERSION 1    // Reported by the 'Q' command. Increase it when a change to the framing or an existing command would break a host
+#define BYTE_TIMEOUT_MS 500     // How many ms do we wait between bytes before assuming the other end of the comms has died. If this is too low then manually typing into a terminal will time out
+#define COMMAND_QUEUE_LEN 4     // Received packets that can wait to be executed. Each takes a buffer pool block while waiting
+#define COMMS_POOL_BLOCKS (COMMAND_QUEUE_LEN + 1)   // Most buffer pool blocks the comms hold at once: a full queue and the reply being sent
+#define USB_DISCONNECT_MS 10    // How long D+ is held low at start up so the host sees the device unplugged. Hubs latch a disconnect after 2.5us, this leaves margin
 
 /**
   * @brief  Enum for available commands that we can process.  
@@ -25,7 +30,20 @@ typedef enum __attribute__((__packed__))
     COMMAND_FW_VER = 'F',         /// Read the current firmware version
     COMMAND_STATUS = 'S',         /// Read the current status of motors
     COMMAND_SET_OUTPUTS = 'O',    /// set PWM outputs
-    COMMAND_REBOOT = 'R'          /// Reboot the device (turns outputs off) 
+    COMMAND_REBOOT = 'R',         /// Reboot the device (turns outputs off) 
+    COMMAND_CURRENT_STATS = 'I',  /// Read the sliding window current statistics, optionally setting the window length
+    COMMAND_TIMESTAMP = 'T',      /// Read the microsecond timebase, for the host to estimate clock offset and drift
+    COMMAND_MEMORY = 'M',         /// Read the buffer pool usage
+    COMMAND_DIAGNOSTICS = 'D',    /// Read, and optionally reset, the USB and protocol health counters
+    COMMAND_POWER = 'P',          /// Read the USB suspend state and how long resuming from STOP mode takes
+    COMMAND_BOOT = 'B',           /// Read the reset cause and how long after reset the USB connection steps were reached
+    COMMAND_IDENTITY = 'U',       /// Read the unit identity (unique ID, name, capabilities), optionally setting the name
+    COMMAND_FAILSAFE = 'W',       /// Read, and optionally clear or configure, the host heartbeat failsafe
+    COMMAND_CONFIG = 'C',         /// Read or change a setting, or store the settings in flash
+    COMMAND_UPDATE = 'G',         /// Read how the firmware was loaded, or start a firmware update. See Update.c
+    COMMAND_CAPABILITIES = 'Q',   /// Read the protocol version, supported commands, buffer sizes and build info
+    COMMAND_PROFILE = 'X',        /// Read, and optionally reset, the cycle profiler statistics. Only with PROFILE_ENABLE
+    COMMAND_TRACE = 'L'           /// Read, freeze and restart the event trace. Only with TRACE_ENABLE
 }Comms_Commands;
 
 /**
@@ -85,7 +103,7 @@ typedef struct
     uint16_t Running_Len;        // Temporary counter to count the received payload bytes
     void (*Packet_Ready)(Comms_Packet *Pkt);  // Callback gets called when a successfully received packet is ready for processing
     Comms_Packet Packet;         // Packet data being received
-    uint8_t Byte_Timer;          // Timer to measure time between received bytes so we can drop incompletely received packets
+    uint32_t Byte_Deadline_ms;   // When to drop an incompletely received packet, BYTE_TIMEOUT_MS after the last byte. See Timebase_Deadline_ms()
 }Comms_RX_Typedef;
 
 #endif
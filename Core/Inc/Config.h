@@ -0,0 +1,60 @@
+/** @file      Config.h
+ * @brief      Settings kept in flash over reboots. A log of CRC checked records in the last two flash pages
+ * @details    See Config.c
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CONFIG_FLASH_ADDR 0x08007800    // The last two 1K flash pages, kept out of the FLASH region in the linker script for the settings
+#define CONFIG_PAGE_SIZE 1024           // Bytes per flash page
+#define CONFIG_NUM_PAGES 2              // Pages used in turn. Each is only erased when the other is full
+#define CONFIG_MAX_LEN 16               // Longest setting value in bytes, the unit name
+
+/**
+  * @brief  The settings. The value is stored in flash with each record, so only add to the end.
+  */
+typedef enum
+{
+    CONFIG_NAME,                // The unit name, see Identity_Set_Name(). Text
+    CONFIG_FAILSAFE_TIMEOUT,    // Failsafe timeout in ms, see Failsafe_Set_Timeout()
+    CONFIG_FAILSAFE_MODE,       // Failsafe safe state, FAILSAFE_MODE_TYPE
+    CONFIG_STATS_WINDOW,        // Current statistics window length in samples, see Current_Stats_Set_Window()
+    NUM_CONFIG_KEYS
+}CONFIG_KEY;
+
+/**
+  * @brief  Result of the latest commit
+  */
+typedef enum
+{
+    CONFIG_RESULT_NONE,     // Nothing has been committed since power on
+    CONFIG_RESULT_OK,       // The settings were written
+    CONFIG_RESULT_FAILED,   // Erasing or programming the flash failed. The settings are still in use until the next reboot
+}CONFIG_RESULT;
+
+/**
+  * @brief  Snapshot of the store, see Config_Get_Status()
+  */
+typedef struct
+{
+    uint32_t Sequence;      // Times the log has been moved to a fresh page. 0 if nothing has been stored yet
+    uint16_t Used;          // Bytes of the current page used by the log
+    uint16_t Load_us;       // Time taken to read the settings at power on
+    bool Pending;           // A commit has been asked for and not finished yet
+    CONFIG_RESULT Result;   // Result of the latest commit
+}Config_Status_Type;
+
+void Config_Commit(void);
+uint8_t Config_Get(CONFIG_KEY Key, uint8_t Value[CONFIG_MAX_LEN]);
+void Config_Get_Status(Config_Status_Type *Status);
+bool Config_Is_Text(CONFIG_KEY Key);
+bool Config_Is_Writing(void);
+void Config_Initialise(void);
+void Config_Main(void);
+bool Config_Set(CONFIG_KEY Key, const uint8_t *Value, uint8_t Len);
+
+#endif
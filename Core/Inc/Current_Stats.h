@@ -0,0 +1,34 @@
+/** @file      Current_Stats.h
+ * @brief      Sliding window statistics of the motor current sense channels
+ * @details    See Current_Stats.c
+ */
+
+#ifndef CURRENT_STATS_H_
+#define CURRENT_STATS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "IO.h"
+
+#define STATS_MAX_WINDOW 64         // Maximum number of samples in the sliding window. Sets the RAM used per channel. Must be 255 or less
+#define STATS_DEFAULT_WINDOW 64     // Window length used at power on
+
+/**
+  * @brief  Snapshot of the statistics for one channel over the current window. All values are raw ADC counts.
+  */
+typedef struct
+{
+    uint16_t Mean;
+    uint16_t RMS;
+    uint16_t Peak;
+    uint16_t Min;
+}Current_Stats_Type;
+
+void Current_Stats_Add_Sample(ADC_PIN Pin, uint16_t Sample);
+void Current_Stats_Get(ADC_PIN Pin, Current_Stats_Type *Stats);
+uint8_t Current_Stats_Get_Window(void);
+void Current_Stats_Initialise(void);
+bool Current_Stats_Set_Window(uint8_t Len);
+
+#endif
@@ -0,0 +1,33 @@
+/** @file      Deferred.h
+ * @brief      Deferred work run from PendSV, the lowest priority interrupt. Interrupts hand their slow work on to it
+ * @details    See Deferred.c
+ */
+
+#ifndef DEFERRED_H_
+#define DEFERRED_H_
+
+#include <stdint.h>
+
+/**
+  * @brief  Work that can be posted. Each is a bit so several can be pending at once
+  */
+typedef enum
+{
+    DEFER_COMMAND = 0x01,       // A command packet has been queued for execution
+    DEFER_SPEED_WINDOW = 0x02,  // A full window of current samples is ready for the speed estimate FFT
+    DEFER_UPDATE = 0x04,        // A firmware update is due to start, see Update.c
+}DEFER_WORK;
+
+/**
+  * @brief  A deferred task. Runs to completion each time any of its work bits is posted
+  */
+typedef struct
+{
+    void (*Run)(void);      // The task function
+    uint32_t Work;          // Run when any of these DEFER_WORK bits is posted
+}Deferred_Task;
+
+void Deferred_Post(DEFER_WORK Work);
+void Deferred_Run(const Deferred_Task *Tasks, uint8_t Num_Tasks);
+
+#endif
@@ -0,0 +1,60 @@
+/** @file      Diagnostics.h
+ * @brief      USB and protocol health counters, and the boot record
+ * @details    See Diagnostics.c
+ */
+
+#ifndef DIAGNOSTICS_H_
+#define DIAGNOSTICS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+  * @brief  The health counters. The order is the order they are reported to the host, so only add new counters to the end.
+  */
+typedef enum
+{
+    DIAG_RX_BYTES,          // Bytes received from the host
+    DIAG_RX_FRAMES,         // Complete {...} frames received
+    DIAG_RX_TIMEOUTS,       // Frames dropped because the next byte took longer than BYTE_TIMEOUT_MS
+    DIAG_INV_PAYLOAD,       // Frames answered with RESP_INV_PAYLOAD
+    DIAG_INV_COMMAND,       // Frames answered with RESP_INV_COMMAND
+    DIAG_TX_DROPS,          // Replies not sent because the IN endpoint was busy or no buffer was free
+    DIAG_USB_SUSPEND,       // USB suspend events
+    DIAG_USB_RESUME,        // USB resume events
+    DIAG_USB_RESET,         // USB bus resets
+    DIAG_RX_OVERRUNS,       // Frames dropped because the command queue was full or no buffer was free
+    NUM_DIAG_COUNTERS
+}DIAG_COUNTER;
+
+/**
+  * @brief  Points in the boot and USB enumeration sequence. The order is the order they are reported to the host, so only add to the end.
+  */
+typedef enum
+{
+    BOOT_USB_DISCONNECT,    // D+ driven low so the host sees the device unplugged
+    BOOT_USB_CONNECT,       // D+ released and the USB device started, the host sees the device plugged in
+    BOOT_USB_RESET,         // First bus reset from the host, it has started enumerating
+    BOOT_USB_CONFIGURED,    // The host has set the configuration, enumeration is complete
+    NUM_BOOT_MILESTONES
+}BOOT_MILESTONE;
+
+extern volatile uint32_t Diag_Counters[NUM_DIAG_COUNTERS];
+
+/**
+  * @brief  Count one event. A single increment so it is cheap enough for any interrupt.
+  *         Each counter is only counted from one interrupt level so the increment can't be torn.
+  */
+#define DIAGNOSTICS_INC(Counter) (Diag_Counters[(Counter)]++)
+
+/**
+  * @brief  Count a number of events, like bytes received. A single add.
+  */
+#define DIAGNOSTICS_ADD(Counter, Num) (Diag_Counters[(Counter)] += (Num))
+
+void Diagnostics_Boot_Milestone(BOOT_MILESTONE Milestone);
+void Diagnostics_Clear(const uint32_t Counters[NUM_DIAG_COUNTERS], uint8_t First, uint8_t Num);
+void Diagnostics_Get_Boot(uint32_t Milestone_ms[NUM_BOOT_MILESTONES]);
+void Diagnostics_Snapshot(uint32_t Counters[NUM_DIAG_COUNTERS]);
+
+#endif
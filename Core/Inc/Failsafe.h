@@ -0,0 +1,64 @@
+/** @file      Failsafe.h
+ * @brief      Host heartbeat watchdog. Ramps the outputs to a safe state if the host stops sending commands
+ * @details    See Failsafe.c
+ */
+
+#ifndef FAILSAFE_H_
+#define FAILSAFE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The timeout and mode at power on, the host can change them with the 'W' command. Override with eg -DFAILSAFE_TIMEOUT_MS=0
+   to start with the failsafe disabled */
+#ifndef FAILSAFE_TIMEOUT_MS
+#define FAILSAFE_TIMEOUT_MS 2000        // Time without a valid command before the outputs are ramped to the safe state. 0 = disabled
+#endif
+#ifndef FAILSAFE_MODE
+#define FAILSAFE_MODE FAILSAFE_COAST    // Safe state at power on, FAILSAFE_COAST or FAILSAFE_BRAKE
+#endif
+
+#define FAILSAFE_MAX_TIMEOUT_MS 60000   // Longest timeout the host can set
+#define FAILSAFE_RAMP_STEP_PERCENT 2    // PWM percent PWM_L and PWM_R are reduced by each tick once tripped. 2 takes 100% to off in 50 ticks
+
+/**
+  * @brief  What the outputs are left as once they have ramped down
+  */
+typedef enum
+{
+    FAILSAFE_COAST,     // Both half bridges disabled (ENA_L and ENA_R off), the motor freewheels
+    FAILSAFE_BRAKE,     // Both half bridges enabled with both low sides on (PWM_L and PWM_R off), the motor is shorted and brakes
+    NUM_FAILSAFE_MODES
+}FAILSAFE_MODE_TYPE;
+
+/**
+  * @brief  Failsafe states
+  */
+typedef enum
+{
+    FAILSAFE_IDLE,      // Disabled, or no valid command received yet since power on
+    FAILSAFE_ARMED,     // Commands are arriving, the outputs are tripped if they stop
+    FAILSAFE_RAMP_DOWN, // Tripped, PWM_L and PWM_R are ramping down to off
+    FAILSAFE_SAFE,      // Tripped, the outputs are in the safe state until the next valid command
+}FAILSAFE_STATE;
+
+/**
+  * @brief  Snapshot of the failsafe, see Failsafe_Get_Status()
+  */
+typedef struct
+{
+    uint16_t Timeout_ms;        // Time without a valid command before tripping. 0 = disabled
+    FAILSAFE_MODE_TYPE Mode;    // Safe state the outputs are ramped to
+    FAILSAFE_STATE State;       // Current state
+    uint32_t Trips;             // Number of times the failsafe has tripped since power on
+    bool Latched;               // true if the failsafe has tripped since the host last cleared it
+}Failsafe_Status_Type;
+
+void Failsafe_Command_Received(void);
+void Failsafe_Get_Status(Failsafe_Status_Type *Status, bool Clear);
+void Failsafe_Initialise(void);
+bool Failsafe_Set_Mode(FAILSAFE_MODE_TYPE Mode);
+bool Failsafe_Set_Timeout(uint32_t Timeout_ms);
+void Failsafe_Timer_Interrupt(void);
+
+#endif
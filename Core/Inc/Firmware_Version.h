@@ -2,5 +2,6 @@
 #define FIRMWARE_VERSION_H_
 
 const char *Firmware_Version_Get(void);
+const char *Firmware_Version_Get_Build_Hash(void);
 
 #endif
\ No newline at end of file
@@ -3,6 +3,11 @@
 
 #include <stdint.h>
 
+#define ADC_SAMPLE_RATE_HZ 4000    // Rate that TIM1 triggers each ADC sequence (all ADC pins). Must match the TIM1 prescaler/period set in STM32CubeMX
+#define PWM_FREQ_HZ 1000           // PWM frequency of the outputs. Must match the TIM3 prescaler/period set in STM32CubeMX
+#define ISENSE_R_OHMS 1000         // Resistance (ohms) from each BTS7960 IS pin to ground, that converts the sense current to a voltage
+#define ISENSE_KILIS 8500          // BTS7960 load current to sense current ratio (kILIS). Typical value from the datasheet
+
 typedef enum 
 {
     ENA_L,
@@ -12,6 +17,16 @@ typedef enum
     NUM_PWM_PINS
 }PWM_PIN;
 
+/**
+  * @brief  Ways the host can drive the outputs, reported as a bitmap by the 'Q' command
+  */
+typedef enum
+{
+    PWM_MODE_PERCENT = 0x01,   // Each pin set to a whole percent duty, 0 to 100 ('O' command)
+}PWM_MODE;
+
+#define PWM_MODES PWM_MODE_PERCENT  // The PWM_MODE bits this build supports
+
 typedef enum
 {
     LED,
@@ -25,11 +40,18 @@ typedef enum
     NUM_ADC_PINS
 }ADC_PIN;
 
+uint32_t IO_ADC_To_mA(uint16_t Raw);
 uint16_t IO_Get_ADC(ADC_PIN pin);
+uint32_t IO_Get_ADC_Timestamp_us(void);
+uint16_t IO_Get_Current_mA(ADC_PIN pin);
+uint16_t IO_Get_VDDA_mV(void);
 void IO_Initialise(void);
+void IO_Main(void);
 uint8_t IO_Get_PWM_Percent(PWM_PIN pin);
+uint8_t IO_Get_PWM_Requested(PWM_PIN pin);
 void IO_Set_OP_High(OUTPUT_PIN pin);
 void IO_Set_OP_Low(OUTPUT_PIN pin);
+void IO_Set_PWM_Limit(uint8_t Limit_Percent);
 void IO_Set_PWM_Percent(uint8_t Value_Percent, PWM_PIN pin);
 
 
@@ -0,0 +1,37 @@
+/** @file      Identity.h
+ * @brief      Per unit identity. The 96 bit unique ID, a user set name kept in flash and the capabilities of this build
+ * @details    See Identity.c
+ */
+
+#ifndef IDENTITY_H_
+#define IDENTITY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IDENTITY_NAME_LEN 16            // Longest name the host can set, in chars
+#define IDENTITY_UID_HEX_LEN 24         // Chars in the unique ID as text, two hex chars per byte
+
+/**
+  * @brief  Capability bits, set when this build has the feature. Lets the host tell boards and firmware builds apart without
+  *         trying each command
+  */
+typedef enum
+{
+    IDENTITY_CAP_HID = 0x01,            // The host interface is the raw HID interface, not the CDC virtual com port
+    IDENTITY_CAP_TICK_FROM_SOF = 0x02,  // The application tick follows the USB start of frame
+    IDENTITY_CAP_CURRENT_STATS = 0x04,  // Sliding window current statistics ('I' command)
+    IDENTITY_CAP_SPEED_ESTIMATE = 0x08, // Motor speed from the current ripple (in the 'S' reply)
+    IDENTITY_CAP_THERMAL = 0x10,        // I2t thermal limit on the outputs
+    IDENTITY_CAP_SUSPEND_STOP = 0x20,   // Outputs ramp off and the MCU enters STOP while the host is suspended
+    IDENTITY_CAP_PROFILE = 0x40,        // Cycle profiler built in ('X' command)
+    IDENTITY_CAP_TRACE = 0x80,          // Event trace built in ('L' command)
+}IDENTITY_CAP;
+
+uint32_t Identity_Get_Capabilities(void);
+const char *Identity_Get_Name(void);
+void Identity_Get_UID_Hex(char Str[IDENTITY_UID_HEX_LEN+1]);
+void Identity_Initialise(void);
+bool Identity_Set_Name(const uint8_t *Name, uint8_t Len);
+
+#endif
@@ -3,8 +3,16 @@
 
 #include <stdbool.h>
 
+#ifndef TICK_FROM_SOF
+#define TICK_FROM_SOF 0         // 1 = run the application tick from the USB start of frame (1ms) while the host is sending frames, so it is aligned to the host. 0 = always use the timer
+#endif
+#define SOF_LOST_TICKS 3        // With TICK_FROM_SOF, the timer takes the tick back after this many timer intervals without a start of frame (eg suspended or unplugged)
+
+void MCU_7960_USB_ADC_Interrupt(void);
+void MCU_7960_USB_Deferred_Interrupt(void);
 void MCU_7960_USB_Initialise(void);
 void MCU_7960_USB_Main(void);
+void MCU_7960_USB_SOF_Interrupt(void);
 void MCU_7960_USB_Timer_Interrupt(void);
 
 #endif
\ No newline at end of file
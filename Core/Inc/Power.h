@@ -0,0 +1,40 @@
+/** @file      Power.h
+ * @brief      USB suspend and resume policy. Safe outputs and STOP mode while the host is suspended
+ * @details    See Power.c
+ */
+
+#ifndef POWER_H_
+#define POWER_H_
+
+#include <stdint.h>
+
+#define POWER_RAMP_STEP_PERCENT 2       // PWM percent the outputs are reduced by each tick after a suspend. 2 takes 100% to off in 50 ticks
+#define POWER_RESTORE_OUTPUTS 1         // 1 = put the outputs back to the values the host last set when the host resumes. 0 = leave them off until the host sets them again
+
+/**
+  * @brief  Power states
+  */
+typedef enum
+{
+    POWER_RUN,          // Normal running
+    POWER_RAMP_DOWN,    // The host has suspended, the outputs are ramping down to off
+    POWER_STOP,         // Outputs off, the MCU enters STOP mode until the host resumes
+}POWER_STATE;
+
+/**
+  * @brief  Snapshot of the suspend/resume history
+  */
+typedef struct
+{
+    POWER_STATE State;      // Current power state
+    uint32_t Stops;         // Number of times STOP mode has been entered since power on
+    uint32_t Last_Resume_us;// Time taken to resume from the most recent STOP, from the wakeup interrupt to the clocks, tick and outputs being restored
+    uint32_t Max_Resume_us; // Longest resume from STOP since power on
+}Power_Status_Type;
+
+void Power_Get_Status(Power_Status_Type *Status);
+void Power_Timer_Interrupt(void);
+void Power_USB_Resume(void);
+void Power_USB_Suspend(void);
+
+#endif
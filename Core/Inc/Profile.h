@@ -0,0 +1,69 @@
+/** @file      Profile.h
+ * @brief      Cycle profiler. Times sections of code between begin and end markers and keeps statistics per probe
+ * @details    See Profile.c
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Set PROFILE_ENABLE to 1 (eg -DPROFILE_ENABLE=1) to build the profiler in. With 0 the markers compile to nothing and the
+   'X' command is not available */
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE 0
+#endif
+
+/**
+  * @brief  The probes. The order is the order they are reported to the host, so only add to the end.
+  */
+typedef enum
+{
+    PROBE_COMMAND_EXECUTE,  // Command_Execute(), one command. Run at PendSV level, the only probe that times command execution
+    PROBE_RX_BYTE,          // Comms_RX_Receive_Byte(), one byte. Includes queuing the packet when the byte completes it, not executing the command
+    PROBE_TICK,             // The application tick
+    PROBE_ADC_ISR,          // The ADC sequence complete processing
+    PROBE_USB_ISR,          // The whole USB interrupt. Includes the receive processing and packet queuing it calls. Commands are executed
+                            // later at PendSV level, see PROBE_COMMAND_EXECUTE
+    PROBE_SPEED_FFT,        // The speed estimate FFT and peak search
+    NUM_PROBES
+}PROBE;
+
+/**
+  * @brief  Statistics for one probe, all in CPU cycles
+  */
+typedef struct
+{
+    uint32_t Count;         // Times the probe has been run
+    uint32_t Min;           // Shortest run. UINT32_MAX if never run
+    uint32_t Max;           // Longest run
+    uint64_t Total;         // Sum of all the runs, for the average
+}Profile_Stats_Type;
+
+#if (PROFILE_ENABLE == 1)
+
+/**
+  * @brief  Start timing a probe. Declares a local, so use once per probe per function, at a point a declaration is allowed.
+  */
+#define PROFILE_BEGIN(Probe) uint32_t Profile_Start_##Probe = Profile_Cycles()
+
+/**
+  * @brief  Stop timing a probe and add the time to its statistics. Use in the same function as PROFILE_BEGIN().
+  */
+#define PROFILE_END(Probe) Profile_Record((Probe), Profile_Start_##Probe)
+
+uint32_t Profile_Cycles(void);
+void Profile_Get(PROBE Probe, Profile_Stats_Type *Stats);
+void Profile_Initialise(void);
+void Profile_Record(PROBE Probe, uint32_t Start);
+void Profile_Reset(void);
+
+#else
+
+#define PROFILE_BEGIN(Probe)
+#define PROFILE_END(Probe)
+
+#endif
+
+#endif
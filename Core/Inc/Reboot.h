@@ -1,6 +1,15 @@
 #ifndef REBOOT_H_
 #define REBOOT_H_
 
+#include <stdint.h>
+
+#ifndef REBOOT_DELAY_MS
+#define REBOOT_DELAY_MS 20          // Time from an immediate or DFU request to the reset, so the reply to the command reaches the host first
+#endif
+#define REBOOT_MAX_DELAY_MS 200     // Longest the reset waits for a pending settings commit to start being written. One being written is always finished, see Config_Is_Writing()
+
+#define REBOOT_SYSTEM_MEMORY_ADDR 0x1FFFC400UL  // STM32F070x6 system memory, holds ST's USB DFU bootloader (AN2606)
+
 /**
  * @brief Type of reboot being requested
  * 
@@ -8,11 +17,16 @@
 typedef enum 
 {
     REBOOT_REQUEST_NONE = 0,    // Has no effect on system. No reboot will occur
-    REBOOT_REQUEST_NORMAL,      // A normal reboot will occur. Application will restart as though a power-on reset occurred.
-    REBOOT_REQUEST_DFU          // (Not yet implemented) A reboot into the DFU bootloader will occur. This is equivalent to booting with the BOOT0 ppin held high.
+    REBOOT_REQUEST_NORMAL,      // A normal reboot will occur. Application will restart as though a power-on reset occurred. Reset by the window watchdog from the main loop.
+    REBOOT_REQUEST_DFU,         // A reboot into the DFU bootloader will occur. This is equivalent to booting with the BOOT0 pin held high.
+    REBOOT_REQUEST_IMMEDIATE    // A software reset REBOOT_DELAY_MS after the request, from the application tick so it does not wait for the main loop.
 }Reboot_Request_Type;
 
+uint8_t Reboot_Get_Reset_Flags(void);
+void Reboot_Initialise(void);
 void Reboot_Request(Reboot_Request_Type R);
 void Reboot_Main(void);
+void Reboot_Start_Bootloader(void);
+void Reboot_Timer_Interrupt(void);
 
 #endif
@@ -0,0 +1,34 @@
+/** @file      Scheduler.h
+ * @brief      Cooperative main loop scheduler. Tasks run on events set from interrupts or at their own period, the CPU sleeps in between
+ * @details    See Scheduler.c
+ */
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <stdint.h>
+
+/**
+  * @brief  Events that wake the main loop. Each is a bit so several can be pending at once
+  */
+typedef enum
+{
+    SCHED_EVENT_CONFIG = 0x01,          // The settings need writing to flash
+    SCHED_EVENT_REBOOT = 0x02,          // The host has asked for a reboot
+}SCHED_EVENT;
+
+/**
+  * @brief  A main loop task. A task with both Events and Period_ms set runs on whichever comes first
+  */
+typedef struct
+{
+    void (*Run)(void);      // The task function. It must return quickly, long work is split up across runs
+    uint32_t Events;        // Run when any of these SCHED_EVENT bits is set. 0 = not run on events
+    uint16_t Period_ms;     // Run this often. 0 = not run periodically
+    uint32_t Last_Run_ms;   // HAL_GetTick() when the task was last run periodically
+}Scheduler_Task;
+
+void Scheduler_Run(Scheduler_Task *Tasks, uint8_t Num_Tasks);
+void Scheduler_Set_Event(SCHED_EVENT Event);
+
+#endif
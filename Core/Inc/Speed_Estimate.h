@@ -0,0 +1,20 @@
+/** @file      Speed_Estimate.h
+ * @brief      Sensorless motor speed estimate from the current commutation ripple
+ * @details    See Speed_Estimate.c
+ */
+
+#ifndef SPEED_ESTIMATE_H_
+#define SPEED_ESTIMATE_H_
+
+#include <stdint.h>
+
+#define SPEED_FFT_LEN 128              // Number of current samples in each FFT window. Must be a power of 2 and match the sine table in Speed_Estimate.c
+#define SPEED_RIPPLES_PER_REV 6        // Current ripples per motor revolution. 2x commutator segments for odd segment counts, 1x for even.
+#define SPEED_EXCLUDE_HZ 1000          // Frequency (Hz) of the PWM ripple that is ignored when searching for the motor ripple. Must match the TIM3 PWM frequency
+#define SPEED_MIN_PEAK_MAG 64          // Minimum ripple peak magnitude (after scaling) before a speed is reported. Below this the motor is assumed to be stopped
+
+void Speed_Estimate_Add_Sample(uint16_t Sample);
+uint16_t Speed_Estimate_Get_RPM(void);
+void Speed_Estimate_Deferred(void);
+
+#endif
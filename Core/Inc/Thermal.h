@@ -0,0 +1,23 @@
+/** @file      Thermal.h
+ * @brief      I2t thermal protection model for the motor and driver
+ * @details    See Thermal.c
+ */
+
+#ifndef THERMAL_H_
+#define THERMAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define THERMAL_I_CONT_MA 5000          // Motor current (mA) that can flow continuously without heating the model
+#define THERMAL_I2T_LIMIT_A2S 500       // Accumulated (I^2 - I_cont^2).t (A^2.s) at which the outputs trip, eg 1.3s at 20A. Max 4000 with a 1ms timer interrupt
+#define THERMAL_DERATE_PERMILLE 700     // Accumulated heat (per mille of the trip limit) above which the allowed PWM duty is derated
+#define THERMAL_RESET_PERMILLE 500      // After a trip, the heat must cool to this level (per mille of the trip limit) before the outputs can be used again
+
+void Thermal_Initialise(void);
+uint8_t Thermal_Get_PWM_Limit(void);
+uint16_t Thermal_Get_Permille(void);
+bool Thermal_Is_Tripped(void);
+void Thermal_Timer_Interrupt(void);
+
+#endif
@@ -0,0 +1,35 @@
+/** @file      Timebase.h
+ * @brief      Free running microsecond timebase, millisecond count and the application tick
+ * @details    See Timebase.c
+ */
+
+#ifndef TIMEBASE_H_
+#define TIMEBASE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMEBASE_TICK_US 1000                               // Application tick period in us, a whole number of ms. With TICK_FROM_SOF this must be 1000, to match the USB frames
+#define TIMEBASE_TICKS_PER_SEC (1000000 / TIMEBASE_TICK_US) // Application ticks per second
+
+/**
+  * @brief  How late the tick interrupt runs after the tick was due, in us. Max - Min is the worst case jitter of the application tick
+  */
+typedef struct
+{
+    uint16_t Last_us;   // The latest tick
+    uint16_t Min_us;    // Earliest since the last reset. UINT16_MAX if there has been no tick
+    uint16_t Max_us;    // Latest since the last reset
+}Timebase_Latency_Type;
+
+uint32_t Timebase_Deadline_ms(uint32_t Delay_ms);
+uint32_t Timebase_Deadline_us(uint32_t Delay_us);
+bool Timebase_Expired_ms(uint32_t Deadline_ms);
+bool Timebase_Expired_us(uint32_t Deadline_us);
+uint32_t Timebase_Get_ms(void);
+void Timebase_Get_Tick_Latency(Timebase_Latency_Type *Latency, bool Reset);
+uint32_t Timebase_Get_us(void);
+void Timebase_Initialise(void);
+bool Timebase_Interrupt(void);
+
+#endif
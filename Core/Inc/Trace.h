@@ -0,0 +1,132 @@
+/** @file      Trace.h
+ * @brief      RAM trace of timestamped protocol, output and interrupt events, read out by the host
+ * @details    See Trace.c
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Set TRACE_ENABLE to 0 (eg -DTRACE_ENABLE=0) to leave the trace out. The TRACE() calls then compile to nothing and the 'L'
+   command is not available */
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE 1
+#endif
+
+#define TRACE_LEN 64                // Events kept, must be a power of 2. Each takes 4 bytes of RAM
+#define TRACE_RECORDS_PER_REPLY 6   // Events sent in each 'L' reply, 8 hex chars each
+
+/**
+  * @brief  The events. The value is recorded, so only add to the end. Each can be turned on and off with the trace mask, bit n
+  *         for event n.
+  */
+typedef enum
+{
+    TRACE_TIMEBASE_WRAP,    // The 16 bit microsecond count wrapped. Lets the host rebuild full timestamps
+    TRACE_RX_BYTES,         // Bytes received from the host. Data = number of bytes, up to 255
+    TRACE_PACKET,           // A whole packet has been received. Data = the command
+    TRACE_COMMAND_DONE,     // The command has been executed. Data = the response code
+    TRACE_TX_QUEUED,        // A reply has been passed to USB to send. Data = length
+    TRACE_TX_DROPPED,       // A reply could not be sent, no buffer or USB busy. Data = the command
+    TRACE_TX_DONE,          // A reply has been sent to the host. Data = length, up to 255
+    TRACE_PWM_ENA_L,        // An output was set. Data = percent applied
+    TRACE_PWM_ENA_R,
+    TRACE_PWM_L,
+    TRACE_PWM_R,
+    TRACE_USB_ISR_ENTRY,    // USB interrupt
+    TRACE_USB_ISR_EXIT,
+    TRACE_ADC_ISR_ENTRY,    // ADC sequence complete processing. Off by default, at 4kHz it fills the trace in 8ms
+    TRACE_ADC_ISR_EXIT,
+    TRACE_TICK_ENTRY,       // Application tick. Off by default, at 1kHz it fills the trace in 32ms
+    TRACE_TICK_EXIT,
+    TRACE_USB_SUSPEND,      // The host suspended the bus
+    TRACE_USB_RESUME,       // The host resumed the bus
+    TRACE_FREEZE,           // The trace was frozen. Data = TRACE_FREEZE_REASON
+    TRACE_FAILSAFE,         // No valid command within the failsafe timeout, the outputs are ramping down. Data = FAILSAFE_MODE_TYPE
+    NUM_TRACE_EVENTS
+}TRACE_EVENT;
+
+#define TRACE_DEFAULT_MASK (((1UL << NUM_TRACE_EVENTS) - 1) & ~((1UL << TRACE_ADC_ISR_ENTRY) | (1UL << TRACE_ADC_ISR_EXIT) | (1UL << TRACE_TICK_ENTRY) | (1UL << TRACE_TICK_EXIT)))
+
+/**
+  * @brief  Why the trace was frozen
+  */
+typedef enum
+{
+    TRACE_FREEZE_HOST,          // The host asked for it with the 'L' command
+    TRACE_FREEZE_HARD_FAULT,    // The CPU took a hard fault
+    TRACE_FREEZE_ERROR,         // Error_Handler() was called
+}TRACE_FREEZE_REASON;
+
+/**
+  * @brief  One event. Written as a single 32 bit word so a record is never seen half written
+  */
+typedef union
+{
+    struct
+    {
+        uint16_t Time_us;   // Low 16 bits of the microsecond timebase
+        uint8_t Event;      // TRACE_EVENT
+        uint8_t Data;       // Depends on the event
+    };
+    uint32_t Word;
+}Trace_Record;
+
+/**
+  * @brief  Trace status, see Trace_Get_Status()
+  */
+typedef struct
+{
+    bool Frozen;            // true when no more events are being recorded
+    uint16_t Entries;       // Events held, up to TRACE_LEN
+    uint32_t Total;         // Events recorded since the trace was last cleared, including those overwritten
+    uint32_t Mask;          // Events being recorded, bit n for TRACE_EVENT n
+}Trace_Status_Type;
+
+#if (TRACE_ENABLE == 1)
+
+#include "main.h"
+
+extern volatile Trace_Record Trace_Ring[TRACE_LEN];
+extern volatile uint32_t Trace_Idx;
+extern volatile uint32_t Trace_Mask;
+
+/**
+  * @brief  Record an event. Inline and a handful of instructions, so it can be used in any interrupt.
+  *         Nothing is recorded while frozen, as freezing clears the mask.
+  *         The index is not wrapped when stored, it is the count of all events recorded and is wrapped when used.
+  * @param  Event: The TRACE_EVENT
+  * @param  Data: Depends on the event
+  */
+static inline void Trace_Event(TRACE_EVENT Event, uint8_t Data)
+{
+    if(Trace_Mask & (1UL << Event))
+    {
+        Trace_Record Rec;
+        Rec.Time_us = (uint16_t)TIM17->CNT;     // the timebase timer, see Timebase.c
+        Rec.Event = Event;
+        Rec.Data = Data;
+        uint32_t Primask = __get_PRIMASK();
+        __disable_irq();
+        Trace_Ring[Trace_Idx++ & (TRACE_LEN - 1)].Word = Rec.Word;
+        __set_PRIMASK(Primask);
+    }
+}
+
+#define TRACE(Event, Data) Trace_Event((Event), (uint8_t)(Data))
+
+void Trace_Freeze(TRACE_FREEZE_REASON Reason);
+bool Trace_Get_Record(uint16_t Entry, Trace_Record *Rec);
+void Trace_Get_Status(Trace_Status_Type *Status);
+void Trace_Initialise(void);
+void Trace_Start(uint32_t Mask);
+
+#else
+
+#define TRACE(Event, Data)
+
+#endif
+
+#endif
@@ -0,0 +1,67 @@
+/** @file      Update.h
+ * @brief      Firmware update over the command link. The new image is streamed with 'G' commands, flashed and CRC checked
+ * @details    See Update.c. The resident boot code that checks the image at power on is in Boot.c
+ */
+
+#ifndef UPDATE_H_
+#define UPDATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Flash layout, must match the MEMORY regions in STM32F070F6Px_FLASH.ld:
+   0x08000000 BOOT      1K   Resident boot code, Boot.c. Never changed by an update
+   0x08000400 FLASH   29K    The application image, replaced by an update. Its last 16 bytes are the Update_Info_Type
+   0x08007800 CONFIG    2K   Settings, see Config.h */
+#define UPDATE_APP_ADDR 0x08000400UL            // Start of the application image, its vector table
+#define UPDATE_INFO_ADDR 0x080077F0UL           // Update_Info_Type, at the end of the application region
+#define UPDATE_MAX_LEN (UPDATE_INFO_ADDR - UPDATE_APP_ADDR) // Longest image
+#define UPDATE_PAGE_SIZE 1024                   // Bytes per flash page, the erase size
+#define UPDATE_NUM_VECTORS 48                   // Cortex-M0 exceptions and STM32F070x6 interrupts, copied to the start of RAM by the boot code
+
+#define UPDATE_ERASED 0xFFFFFFFFUL              // Erased flash
+#define UPDATE_STARTED_MAGIC 0x54525453UL       // "STRT", programmed once an update has erased the image
+#define UPDATE_DONE_MAGIC 0x454E4F44UL          // "DONE", programmed once the new image has been written and its CRC checked
+
+#ifndef UPDATE_START_DELAY_MS
+#define UPDATE_START_DELAY_MS 20                // Time from the start command to the updater taking over the USB, so the reply reaches the host first
+#endif
+#define UPDATE_MAX_DELAY_MS 200                 // Longest the start waits for a pending settings commit to start being written. One being written is always finished, see Config_Is_Writing()
+
+#define UPDATE_DATA_MAX 26                      // Most image bytes in one write command, hex encoded this fills the payload
+
+/* Functions that run while the application image is being erased. They are copied to RAM by the startup code with .data,
+   and must not call anything in flash: no library calls, switch tables or constant tables, and no division (Cortex-M0
+   has none, so it is a library call). Calls between flash and RAM go through long branch veneers added by the linker */
+#define UPDATE_RAM_FUNC __attribute__((section(".RamFunc"), noinline, optimize("no-tree-loop-distribute-patterns")))
+
+/**
+  * @brief  Record at UPDATE_INFO_ADDR of the last update. Each word is programmed once, in order, after the page is erased.
+  *         All erased means the image was loaded with a programmer (ST-Link or the DFU bootloader)
+  */
+typedef struct
+{
+    uint32_t Started;       // UPDATE_STARTED_MAGIC once an update has begun erasing the image
+    uint32_t Len;           // Image length in bytes
+    uint32_t Crc;           // CRC-32 of the image, see Update_CRC()
+    uint32_t Done;          // UPDATE_DONE_MAGIC once the image is complete and checked
+}Update_Info_Type;
+
+/**
+  * @brief  How the running image was loaded
+  */
+typedef enum
+{
+    UPDATE_STATE_PROGRAMMED,    // With a programmer, there is no update record
+    UPDATE_STATE_UPDATED,       // With the 'G' commands, and checked by the boot code
+}UPDATE_STATE;
+
+uint8_t Update_Append_Hex(uint8_t *Buf, uint8_t Len, uint32_t Num);
+uint32_t Update_CRC(const uint32_t *Data, uint32_t Len);
+void Update_Deferred(void);
+UPDATE_STATE Update_Get_State(void);
+bool Update_Parse_Hex(const uint8_t *Buf, uint8_t Len, uint8_t *Pos, uint32_t *Num);
+bool Update_Request(uint32_t Len, uint32_t Crc);
+void Update_Timer_Interrupt(void);
+
+#endif
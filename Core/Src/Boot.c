@@ -0,0 +1,115 @@
+/**
+  @file Boot.c
+  @brief Resident boot code, in the first flash page. Runs at every reset and starts the application image if it is complete,
+         otherwise ST's USB DFU bootloader, so an interrupted update can always be finished over USB.
+  @details The application image starts one page in (UPDATE_APP_ADDR) and is replaced by an update, this page never is.
+           The image is checked with its update record (Update_Info_Type, see Update.c):
+           - All erased: the image was loaded with a programmer. It is started if its stack pointer is in RAM, so an
+             erased part goes to the DFU bootloader.
+           - Started and Done: loaded by an update. It is started if its CRC matches the record, a few ms at the reset clock.
+           - Anything else: an update was cut short. The DFU bootloader is started. The image is written from its start, so
+             a cut short one can have a good vector table, and the vectors can't tell it from a complete one. Recovery must
+             load the full image (boot page, application and the erased .update_info), which clears the record.
+
+           Cortex-M0 can't move its vector table, so the application's is copied to the start of RAM and RAM is mapped at
+           address 0. The linker script keeps the first UPDATE_NUM_VECTORS words of RAM out of the application's RAM.
+
+           A jump from ST's bootloader leaves the PLL running, which the application's clock set up can't change, so the
+           boot code resets first if it finds the clocks are not as a reset leaves them.
+ */
+
+#include <stdbool.h>
+
+#include "Boot.h"
+#include "main.h"
+#include "Reboot.h"
+#include "Update.h"
+
+extern uint32_t _estack;    /// Top of RAM, from the linker script
+
+BOOT_CODE static void Boot_Fault(void);
+
+/* Only the reset vector is needed in the boot page, the boot code enables no interrupts. Faults stop in Boot_Fault() */
+void (* const Boot_Vectors[4])(void) __attribute__((section(".boot_vector"), used)) = {(void (*)(void))&_estack, Boot_Reset, Boot_Fault, Boot_Fault};
+
+/**
+  * @brief  NMI and hard fault while booting
+  * @retval Does not return
+  */
+BOOT_CODE static void Boot_Fault(void)
+{
+    while(1)
+    {
+    }
+}
+
+/**
+  * @brief  CRC-32 of the image, from the CRC unit as Update_CRC() does
+  * @param  Data: The image
+  * @param  Len: Length in bytes, a multiple of 4
+  * @retval The CRC
+  */
+BOOT_CODE static uint32_t Boot_CRC(const volatile uint32_t *Data, uint32_t Len)
+{
+    RCC->AHBENR |= RCC_AHBENR_CRCEN;
+    CRC->CR = CRC_CR_RESET;
+    for(uint32_t w = 0; w < (Len >> 2); w++)
+    {
+        CRC->DR = Data[w];
+    }
+    return CRC->DR;
+}
+
+/**
+  * @brief  Start the code with a vector table
+  * @param  Vectors: The vector table, the initial stack pointer and the reset handler
+  * @retval Does not return
+  */
+BOOT_CODE static void Boot_Start(const volatile uint32_t *Vectors)
+{
+    void (*Reset_Handler)(void) = (void (*)(void))Vectors[1];
+    __set_MSP(Vectors[0]);
+    Reset_Handler();
+}
+
+/**
+  * @brief  The reset handler. Checks the application image and starts it, or the DFU bootloader
+  * @retval Does not return
+  */
+BOOT_CODE void Boot_Reset(void)
+{
+    if((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_HSI)
+    {
+        SCB->AIRCR = (0x5FAUL << SCB_AIRCR_VECTKEY_Pos) | SCB_AIRCR_SYSRESETREQ_Msk;
+        while(1)
+        {
+        }
+    }
+
+    const volatile Update_Info_Type *Info = (const volatile Update_Info_Type *)UPDATE_INFO_ADDR;
+    const volatile uint32_t *App = (const volatile uint32_t *)UPDATE_APP_ADDR;
+    bool Valid;
+    if(Info->Started == UPDATE_ERASED)
+    {
+        Valid = ((App[0] & 0xFFFF0000UL) == SRAM_BASE);
+    }
+    else
+    {
+        Valid = (Info->Done == UPDATE_DONE_MAGIC) && (Info->Len <= UPDATE_MAX_LEN) && (Boot_CRC(App, Info->Len) == Info->Crc);
+    }
+
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+    if(!Valid)
+    {
+        __HAL_SYSCFG_REMAPMEMORY_SYSTEMFLASH();
+        Boot_Start((const volatile uint32_t *)REBOOT_SYSTEM_MEMORY_ADDR);
+    }
+
+    volatile uint32_t *Ram = (volatile uint32_t *)SRAM_BASE;
+    for(uint8_t v = 0; v < UPDATE_NUM_VECTORS; v++)
+    {
+        Ram[v] = App[v];
+    }
+    __HAL_SYSCFG_REMAPMEMORY_SRAM();
+    Boot_Start(App);
+}
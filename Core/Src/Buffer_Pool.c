@@ -0,0 +1,121 @@
+/**
+  @file Buffer_Pool.c
+  @brief A fixed block buffer pool shared by the USB receive/transmit buffers, packet framing and capture features.
+  @details The pool is POOL_NUM_BLOCKS blocks of POOL_BLOCK_SIZE bytes, sized at build time. A buffer larger than one block
+           is given a run of neighbouring blocks so it is always contiguous. Free blocks are tracked with one bit per block,
+           so allocating and freeing is a short bit search with no heap, no fragmentation of other RAM, and a fixed worst case time.
+
+           Allocating and freeing disable interrupts for the few instructions that change the pool, so both can be called
+           from the USB interrupt and the main loop.
+
+           How to use:
+           1. Call Buffer_Pool_Alloc() to claim a buffer. It returns NULL if there is no run of free blocks big enough.
+           2. Call Buffer_Pool_Free() with the same pointer once the buffer is no longer used. Pointers that did not come from
+              the pool (including NULL) are ignored, so a buffer that might be static or pooled can always be passed back.
+           3. Call Buffer_Pool_Get_Usage() to see how much of the pool is used, so POOL_NUM_BLOCKS can be trimmed to reclaim RAM.
+
+           No initialise function is needed, the pool starts empty from the C start up zeroing, so the USB stack can allocate
+           its buffers as soon as the host configures the device.
+ */
+
+#include <stddef.h>
+
+#include "Buffer_Pool.h"
+#include "main.h"
+
+#if (POOL_NUM_BLOCKS > 32) || (POOL_NUM_BLOCKS == 0)
+#error "POOL_NUM_BLOCKS must be between 1 and 32, the free blocks are tracked in a 32 bit mask"
+#endif
+
+#if (POOL_BLOCK_SIZE % 4) != 0
+#error "POOL_BLOCK_SIZE must be a multiple of 4 to keep every block word aligned"
+#endif
+
+uint32_t Pool_Mem[POOL_NUM_BLOCKS * POOL_BLOCK_SIZE / 4];   /// Block storage. uint32_t so every block is word aligned for the USB PMA copies
+uint32_t Pool_Used_Mask = 0;                                 /// Bit n set when block n is allocated
+uint8_t Pool_Run_Len[POOL_NUM_BLOCKS];                       /// Number of blocks in the allocation starting at each block, so Free knows how many to release
+uint8_t Pool_Used = 0;                                       /// Number of blocks currently allocated
+uint8_t Pool_Peak = 0;                                       /// Most blocks allocated at once
+uint16_t Pool_Fails = 0;                                     /// Number of allocations that failed
+
+/**
+  * @brief  Claim a contiguous buffer from the pool
+  * @param  Size: Number of bytes needed. Rounded up to a whole number of blocks
+  * @retval Word aligned pointer to the buffer, or NULL if Size is 0 or there is no run of free blocks big enough
+  */
+void *Buffer_Pool_Alloc(uint16_t Size)
+{
+    uint16_t Blocks = (Size + POOL_BLOCK_SIZE - 1) / POOL_BLOCK_SIZE;
+    uint32_t Run_Mask = (Blocks >= 32) ? 0xFFFFFFFFUL : ((1UL << Blocks) - 1);
+    void *Buf = NULL;
+
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    for(uint8_t b = 0; (Blocks > 0) && (b + Blocks <= POOL_NUM_BLOCKS); b++)
+    {
+        if((Pool_Used_Mask & (Run_Mask << b)) == 0)
+        {   // first fit
+            Pool_Used_Mask |= (Run_Mask << b);
+            Pool_Run_Len[b] = (uint8_t)Blocks;
+            Pool_Used += Blocks;
+            if(Pool_Used > Pool_Peak)
+            {
+                Pool_Peak = Pool_Used;
+            }
+            Buf = &Pool_Mem[b * (POOL_BLOCK_SIZE / 4)];
+            break;
+        }
+    }
+    if(Buf == NULL)
+    {
+        Pool_Fails++;
+    }
+    __set_PRIMASK(Primask);
+
+    return Buf;
+}
+
+/**
+  * @brief  Return a buffer to the pool
+  * @param  Buf: A pointer returned by Buffer_Pool_Alloc(). NULL, and pointers that are not the start of a pool allocation, are ignored
+  * @retval None
+  */
+void Buffer_Pool_Free(void *Buf)
+{
+    uint8_t *Start = (uint8_t*)Pool_Mem;
+    uint8_t *P = (uint8_t*)Buf;
+    if((P < Start) || (P >= Start + sizeof(Pool_Mem)) || (((P - Start) % POOL_BLOCK_SIZE) != 0))
+    {
+        return;     // not from the pool
+    }
+
+    uint8_t b = (P - Start) / POOL_BLOCK_SIZE;
+
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    uint8_t Blocks = Pool_Run_Len[b];
+    if((Blocks > 0) && (Pool_Used_Mask & (1UL << b)))
+    {
+        uint32_t Run_Mask = (Blocks >= 32) ? 0xFFFFFFFFUL : ((1UL << Blocks) - 1);
+        Pool_Used_Mask &= ~(Run_Mask << b);
+        Pool_Run_Len[b] = 0;
+        Pool_Used -= Blocks;
+    }
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Read the pool usage
+  * @param  Usage: Filled with a consistent snapshot of the pool usage
+  * @retval None
+  */
+void Buffer_Pool_Get_Usage(Buffer_Pool_Usage_Type *Usage)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    Usage->Total = POOL_NUM_BLOCKS;
+    Usage->Used = Pool_Used;
+    Usage->Peak = Pool_Peak;
+    Usage->Fails = Pool_Fails;
+    __set_PRIMASK(Primask);
+}
@@ -12,10 +12,24 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "Buffer_Pool.h"
 #include "Command.h"
+#include "Comms_Controller.h"
+#include "Config.h"
+#include "Current_Stats.h"
+#include "Diagnostics.h"
+#include "Failsafe.h"
 #include "Firmware_Version.h"
+#include "Identity.h"
 #include "IO.h"
+#include "Power.h"
+#include "Profile.h"
 #include "Reboot.h"
+#include "Speed_Estimate.h"
+#include "Thermal.h"
+#include "Timebase.h"
+#include "Trace.h"
+#include "Update.h"
 
 /**
   * @brief  Try extract 4 PWM values from the payload. Expected format is aaa,bbb,ccc,ddd. where aaa/bbb/ccc/ddd is text between 0 and 100 (between 1 and 3 chars).
@@ -75,18 +89,343 @@ bool Get_PWMs_From_Payload(uint8_t PWMs[4], Comms_Payload Payload)
 
 } 
 
+/**
+  * @brief  Try extract a single unsigned decimal number from the payload, starting at Payload.Buf[Start].
+  *         All chars from Start to the end of the payload must be numeric.
+  *
+  * @param  Num: Where to store the number
+  * @param  Payload: The payload to be searched
+  * @param  Start: Index of the first digit in the payload
+  * @param  Max: The largest value allowed
+  * @retval true if a valid number no greater than Max was found, false otherwise.
+  */
+bool Get_Number_From_Payload(uint32_t *Num, Comms_Payload Payload, uint8_t Start, uint32_t Max)
+{
+    if((Payload.Len <= Start) || (Payload.Len - Start > 10))
+    {   // no digits, or more digits than can fit in 32 bits
+        return false;
+    }
+
+    uint32_t Val = 0;
+    for(uint8_t c = Start; c < Payload.Len; c++)
+    {
+        if(Payload.Buf[c] < '0' || Payload.Buf[c] > '9')
+        {
+            return false;
+        }
+        uint32_t Digit = Payload.Buf[c] - '0';
+        if((Digit > Max) || (Val > (Max - Digit) / 10))
+        {
+            return false;   // this digit would take us beyond Max
+        }
+        Val = (Val * 10) + Digit;
+    }
+
+    *Num = Val;
+    return true;
+}
+
+/**
+  * @brief  Append a number followed by a comma to the payload. The number is not added if there isn't room for it.
+  *
+  * @param  P: The payload to add to. P->Len is updated.
+  * @param  Num: The number to add
+  * @retval none
+  */
+void Append_Number(Comms_Payload *P, uint32_t Num)
+{
+    char Str[12];
+    uint8_t Len = sprintf(Str, "%lu,", (unsigned long)Num);
+    if(P->Len + Len <= PAYLOAD_BUF_SIZE)
+    {
+        memcpy(&P->Buf[P->Len], Str, Len);
+        P->Len += Len;
+    }
+}
+
+/**
+    @brief  Read the sliding window current statistics and fill them into the payload for returning to the comms channel.
+   
+    @param  P: The payload/parameters to be loaded.
+        Response to Host Controller is:
+         P->Buf[0] = RESP_ACK;
+         p->Buf[1]... = www,lmean,lrms,lpeak,lmin,rmean,rrms,rpeak,rmin,
+        where 
+         www is the number of samples in the window
+         lmean,lrms,lpeak,lmin are the mean, RMS, peak and minimum of ISENSE_L load current in mA
+         rmean,rrms,rpeak,rmin are the same for ISENSE_R
+    @retval none 
+  */
+void Load_Buf_With_Current_Stats(Comms_Payload *P)
+{
+    P->Buf[0] = RESP_ACK;
+    P->Len = 1;
+    Append_Number(P, Current_Stats_Get_Window());
+    for(ADC_PIN Pin = ISENSE_L; Pin < NUM_ADC_PINS; Pin++)
+    {
+        Current_Stats_Type Stats;
+        Current_Stats_Get(Pin, &Stats);
+        Append_Number(P, IO_ADC_To_mA(Stats.Mean));
+        Append_Number(P, IO_ADC_To_mA(Stats.RMS));
+        Append_Number(P, IO_ADC_To_mA(Stats.Peak));
+        Append_Number(P, IO_ADC_To_mA(Stats.Min));
+    }
+}
+
+/**
+    @brief  Read the health counters and fill as many as fit into the payload for returning to the comms channel.
+   
+    @param  P: The payload/parameters to be loaded.
+    @param  First: The first counter to report. Counters before this are left out so the rest can be read when they don't all fit
+    @param  Reset: true to clear the counters that were reported. Counters that didn't fit are left for the next read
+        Response to Host Controller is:
+         P->Buf[0] = RESP_ACK;
+         p->Buf[1]... = fff,c1,c2,...
+        where 
+         fff is the DIAG_COUNTER number of c1
+         c1,c2,... are the counters from fff onwards, as many as fit in the payload
+    @retval none 
+  */
+void Load_Buf_With_Diagnostics(Comms_Payload *P, uint8_t First, bool Reset)
+{
+    uint32_t Counters[NUM_DIAG_COUNTERS];
+    Diagnostics_Snapshot(Counters);
+
+    P->Buf[0] = RESP_ACK;
+    P->Len = 1;
+    Append_Number(P, First);
+    uint8_t c = First;
+    for(; c < NUM_DIAG_COUNTERS; c++)
+    {
+        uint8_t Len = P->Len;
+        Append_Number(P, Counters[c]);
+        if(P->Len == Len)
+        {
+            break;  // payload full, the host asks again starting from this counter
+        }
+    }
+    if(Reset)
+    {
+        Diagnostics_Clear(Counters, First, c - First);
+    }
+}
+
+#if (PROFILE_ENABLE == 1)
+/**
+    @brief  Read the profiler statistics and fill as many probes as fit into the payload for returning to the comms channel.
+   
+    @param  P: The payload/parameters to be loaded.
+    @param  First: The first probe to report. Probes before this are left out so the rest can be read when they don't all fit
+    @param  Reset: true to clear the statistics once they have been read
+        Response to Host Controller is:
+         P->Buf[0] = RESP_ACK;
+         p->Buf[1]... = fff,n1,min1,avg1,max1,n2,min2,avg2,max2,...
+        where 
+         fff is the PROBE number of the first probe reported
+         n,min,avg,max are the number of runs and the min, average and max CPU cycles of each probe from fff onwards, as many
+         whole probes as fit in the payload. min, avg and max are 0 for a probe that hasn't run
+    @retval none 
+  */
+void Load_Buf_With_Profile(Comms_Payload *P, uint8_t First, bool Reset)
+{
+    P->Buf[0] = RESP_ACK;
+    P->Len = 1;
+    Append_Number(P, First);
+    for(PROBE Probe = First; Probe < NUM_PROBES; Probe++)
+    {
+        Profile_Stats_Type Stats;
+        Profile_Get(Probe, &Stats);
+        if(Stats.Count == 0)
+        {
+            Stats.Min = 0;
+        }
+
+        Comms_Payload Group;    // one probe, only added if all of it fits
+        Group.Len = 0;
+        Append_Number(&Group, Stats.Count);
+        Append_Number(&Group, Stats.Min);
+        Append_Number(&Group, (Stats.Count != 0) ? (uint32_t)(Stats.Total / Stats.Count) : 0);
+        Append_Number(&Group, Stats.Max);
+        if(P->Len + Group.Len > PAYLOAD_BUF_SIZE)
+        {
+            break;  // payload full, the host asks again starting from this probe
+        }
+        memcpy(&P->Buf[P->Len], Group.Buf, Group.Len);
+        P->Len += Group.Len;
+    }
+    if(Reset)
+    {
+        Profile_Reset();
+    }
+}
+#endif
+
+/**
+    @brief  Read the failsafe status and fill it into the payload for returning to the comms channel.
+   
+    @param  P: The payload/parameters to be loaded.
+        Response to Host Controller is:
+         P->Buf[0] = RESP_ACK;
+         p->Buf[1]... = tttt,m,s,nnn,l,
+        where 
+         tttt is the time (ms) without a valid command before the failsafe trips, 0 if disabled
+         m is the FAILSAFE_MODE_TYPE, 0 coast or 1 brake
+         s is the FAILSAFE_STATE
+         nnn is the number of times the failsafe has tripped since power on
+         l is 1 if the failsafe has tripped since the host last cleared it, 0 otherwise
+    @param  Clear: true to clear the latched trip once it has been read
+    @retval none 
+  */
+void Load_Buf_With_Failsafe(Comms_Payload *P, bool Clear)
+{
+    Failsafe_Status_Type Status;
+    Failsafe_Get_Status(&Status, Clear);
+    P->Buf[0] = RESP_ACK;
+    P->Len = 1;
+    Append_Number(P, Status.Timeout_ms);
+    Append_Number(P, Status.Mode);
+    Append_Number(P, Status.State);
+    Append_Number(P, Status.Trips);
+    Append_Number(P, Status.Latched);
+}
+
+/**
+    @brief  Read the settings store status and fill it into the payload for returning to the comms channel.
+   
+    @param  P: The payload/parameters to be loaded.
+        Response to Host Controller is:
+         P->Buf[0] = RESP_ACK;
+         p->Buf[1]... = sss,uuu,lll,p,r,
+        where 
+         sss is the number of times the store has moved to a fresh flash page, 0 if nothing has been stored
+         uuu is the bytes of the current flash page used
+         lll is the time (us) taken to read the settings at power on
+         p is 1 if a commit is waiting to be written, 0 otherwise
+         r is the CONFIG_RESULT of the latest commit
+    @retval none 
+  */
+void Load_Buf_With_Config_Status(Comms_Payload *P)
+{
+    Config_Status_Type Status;
+    Config_Get_Status(&Status);
+    P->Buf[0] = RESP_ACK;
+    P->Len = 1;
+    Append_Number(P, Status.Sequence);
+    Append_Number(P, Status.Used);
+    Append_Number(P, Status.Load_us);
+    Append_Number(P, Status.Pending);
+    Append_Number(P, Status.Result);
+}
+
+/**
+    @brief  Read a setting and fill it into the payload for returning to the comms channel.
+   
+    @param  P: The payload/parameters to be loaded.
+        Response to Host Controller is:
+         P->Buf[0] = RESP_ACK;
+         p->Buf[1]... = k,vvv,
+        where 
+         k is the CONFIG_KEY
+         vvv is the value, text or a number depending on the setting
+    @param  Key: The setting
+    @retval none 
+  */
+void Load_Buf_With_Config(Comms_Payload *P, CONFIG_KEY Key)
+{
+    uint8_t Value[CONFIG_MAX_LEN];
+    uint8_t Len = Config_Get(Key, Value);
+    P->Buf[0] = RESP_ACK;
+    P->Len = 1;
+    Append_Number(P, Key);
+    if(Config_Is_Text(Key))
+    {
+        memcpy(&P->Buf[P->Len], Value, Len);
+        P->Len += Len;
+        P->Buf[P->Len++] = ',';
+    }
+    else
+    {
+        uint32_t Num;
+        memcpy(&Num, Value, sizeof(Num));
+        Append_Number(P, Num);
+    }
+}
+
+#if (TRACE_ENABLE == 1)
+/**
+    @brief  Read the trace status and fill it into the payload for returning to the comms channel.
+   
+    @param  P: The payload/parameters to be loaded.
+        Response to Host Controller is:
+         P->Buf[0] = RESP_ACK;
+         p->Buf[1]... = f,eee,tttt,mmmm,
+        where 
+         f is 1 if the trace is frozen, 0 if it is recording
+         eee is the number of events held
+         tttt is the number of events recorded since the trace was started, including those overwritten
+         mmmm is the mask of events being recorded, bit n for TRACE_EVENT n
+    @retval none 
+  */
+void Load_Buf_With_Trace_Status(Comms_Payload *P)
+{
+    Trace_Status_Type Status;
+    Trace_Get_Status(&Status);
+    P->Buf[0] = RESP_ACK;
+    P->Len = 1;
+    Append_Number(P, Status.Frozen);
+    Append_Number(P, Status.Entries);
+    Append_Number(P, Status.Total);
+    Append_Number(P, Status.Mask);
+}
+
+/**
+    @brief  Read events from the trace and fill them into the payload for returning to the comms channel.
+   
+    @param  P: The payload/parameters to be loaded.
+    @param  First: The first event to read, 0 is the oldest held
+        Response to Host Controller is:
+         P->Buf[0] = RESP_ACK;
+         p->Buf[1]... = fff,ttttEEDDttttEEDD...
+        where 
+         fff is the number of the first event in the reply
+         ttttEEDD is each event as hex, up to TRACE_RECORDS_PER_REPLY of them. tttt is the low 16 bits of the microsecond timebase,
+         EE is the TRACE_EVENT and DD is the event data. No events are sent once fff is past the newest event
+    @retval none 
+  */
+void Load_Buf_With_Trace(Comms_Payload *P, uint16_t First)
+{
+    P->Buf[0] = RESP_ACK;
+    P->Len = 1;
+    Append_Number(P, First);
+    Trace_Record Rec;
+    for(uint16_t e = First; (e < First + TRACE_RECORDS_PER_REPLY) && Trace_Get_Record(e, &Rec); e++)
+    {
+        char Str[9];
+        sprintf(Str, "%04X%02X%02X", Rec.Time_us, Rec.Event, Rec.Data);
+        memcpy(&P->Buf[P->Len], Str, 8);
+        P->Len += 8;
+    }
+}
+#endif
+
 /**
     @brief  Read currently applied PWM values and fill them into the payload for returning to the comms channel.
    
     @param  P: The payload/parameters to be loaded. Each PWM will be a uint8_t between 0 and 100
         Response to Host Controller is:
          P->Buf[0] = RESP_ACK;
-         p->Buf[1]... = aaa,bbb,ccc,ddd,eeee,ffff
+         p->Buf[1]... = aaa,bbb,ccc,ddd,eeeee,lll,rrr,hhhh,ttt,uuuuuuuuuu,
         where 
          aaa is the PWM percentage for ENA_L
          bbb is the PWM percentage for ENA_R
          ccc is the PWM percentage for PWM_L
          ddd is the PWM percentage for PWM_R
+         eeeee is the estimated motor speed in RPM (0 if stopped or no ripple detected)
+         lll is the ISENSE_L load current in mA
+         rrr is the ISENSE_R load current in mA
+         hhhh is the I2t thermal model heat, per mille of the trip limit (1000 = trip limit reached)
+         ttt is the maximum PWM_L/PWM_R percent currently allowed by the thermal model. 0 while tripped
+         uuuuuuuuuu is the timestamp (us) of the ADC sequence that lll and rrr were measured from
     @retval none 
   */
 void Load_Buf_With_Status(Comms_Payload *P)
@@ -99,10 +438,51 @@ void Load_Buf_With_Status(Comms_Payload *P)
     sprintf((char*)&P->Buf[1+strlen((char*)&P->Buf[1])], "%i,", val);
     val =  IO_Get_PWM_Percent(PWM_R);
     sprintf((char*)&P->Buf[1+strlen((char*)&P->Buf[1])], "%i,", val); 
+    sprintf((char*)&P->Buf[1+strlen((char*)&P->Buf[1])], "%u,", Speed_Estimate_Get_RPM()); 
+    sprintf((char*)&P->Buf[1+strlen((char*)&P->Buf[1])], "%u,", IO_Get_Current_mA(ISENSE_L)); 
+    sprintf((char*)&P->Buf[1+strlen((char*)&P->Buf[1])], "%u,", IO_Get_Current_mA(ISENSE_R)); 
+    sprintf((char*)&P->Buf[1+strlen((char*)&P->Buf[1])], "%u,", Thermal_Get_Permille()); 
+    sprintf((char*)&P->Buf[1+strlen((char*)&P->Buf[1])], "%u,", Thermal_Get_PWM_Limit()); 
+    sprintf((char*)&P->Buf[1+strlen((char*)&P->Buf[1])], "%lu,", (unsigned long)IO_Get_ADC_Timestamp_us()); 
     
     P->Len = 1 + strlen((char*)&P->Buf[1]);
 }
 
+/**
+    @brief  Read what this firmware supports and fill it into the payload for returning to the comms channel.
+            Lets the host pick the commands and settings to use without trying each one.
+   
+    @param  P: The payload/parameters to be loaded.
+        Response to Host Controller is:
+         P->Buf[0] = RESP_ACK;
+         p->Buf[1]... = v,cccccccc,pp,ff,q,m,hhhh,bbb,gggggggg,
+        where 
+         v is the COMMS_PROTOCOL_VERSION
+         cccccccc is the bitmap of accepted commands, see Comms_Controller_Get_Command_Bitmap()
+         pp is the longest payload in bytes, each way
+         ff is the longest frame in bytes, the payload plus framing
+         q is how many received commands can wait to be executed. More sent without waiting for the replies may be dropped
+         m is the bitmap of PWM_MODE supported
+         hhhh is the PWM frequency in Hz
+         bbb is the bitmap of IDENTITY_CAP features built in, from the build flags
+         gggggggg is the git commit hash the firmware was built from
+    @retval none 
+  */
+void Load_Buf_With_Capabilities(Comms_Payload *P)
+{
+    P->Buf[0] = RESP_ACK;
+    P->Len = 1;
+    Append_Number(P, COMMS_PROTOCOL_VERSION);
+    Append_Number(P, Comms_Controller_Get_Command_Bitmap());
+    Append_Number(P, PAYLOAD_BUF_SIZE);
+    Append_Number(P, FRAME_BUF_SIZE);
+    Append_Number(P, COMMAND_QUEUE_LEN);
+    Append_Number(P, PWM_MODES);
+    Append_Number(P, PWM_FREQ_HZ);
+    Append_Number(P, Identity_Get_Capabilities());
+    P->Len += sprintf((char*)&P->Buf[P->Len], "%.16s,", Firmware_Version_Get_Build_Hash());   // the hash is 8 chars, 14 ending -dirty. Longer only if 8 chars are ambiguous in the repo
+}
+
 /**
     @brief  Process the command and any included payload.     
     @param  Cmd: Command to be executed
@@ -112,6 +492,7 @@ void Load_Buf_With_Status(Comms_Payload *P)
 Comms_Payload *Command_Execute(Comms_Commands Cmd, Comms_Payload Payload)
 {
     static Comms_Payload p;
+    PROFILE_BEGIN(PROBE_COMMAND_EXECUTE);
 
     switch(Cmd)
     {
@@ -142,23 +523,330 @@ Comms_Payload *Command_Execute(Comms_Commands Cmd, Comms_Payload Payload)
             Load_Buf_With_Status(&p);
             break;
         case COMMAND_REBOOT:
-            if(Payload.Buf[0] == 'N')
+            // N reboots from the main loop through the watchdog, I resets REBOOT_DELAY_MS after the reply, D does the same
+            // then starts the USB DFU bootloader to update the firmware
+            if((Payload.Len == 1) && (Payload.Buf[0] == 'N'))
             {
                 p.Buf[0] = RESP_ACK;
                 Reboot_Request(REBOOT_REQUEST_NORMAL);
             }
+            else if((Payload.Len == 1) && (Payload.Buf[0] == 'I'))
+            {
+                p.Buf[0] = RESP_ACK;
+                Reboot_Request(REBOOT_REQUEST_IMMEDIATE);
+            }
+            else if((Payload.Len == 1) && (Payload.Buf[0] == 'D'))
+            {
+                p.Buf[0] = RESP_ACK;
+                Reboot_Request(REBOOT_REQUEST_DFU);
+            }
             else
             {
                 p.Buf[0] = RESP_INV_PAYLOAD;
             }
             p.Len = 1;
             break;
+        case COMMAND_CURRENT_STATS:
+            // an optional payload of digits sets a new window length before reading
+            uint32_t Window;
+            if(Payload.Len == 0)
+            {
+                Load_Buf_With_Current_Stats(&p);
+            }
+            else if(Get_Number_From_Payload(&Window, Payload, 0, STATS_MAX_WINDOW) && Current_Stats_Set_Window(Window))
+            {
+                Load_Buf_With_Current_Stats(&p);
+            }
+            else
+            {
+                p.Buf[0] = RESP_INV_PAYLOAD;
+                p.Len = 1;
+            }
+            break;
+        case COMMAND_TIMESTAMP:
+            // reply is now,adc,frame,sof,late,min,max, where now is the timebase when the command was executed, adc is the latest ADC
+            // sequence time, frame is the latest USB frame number and sof is the timebase at the start of that frame.
+            // late,min,max are how late (us) the latest, earliest and latest ever tick interrupt ran, max-min is the tick jitter.
+            // R restarts min and max once they have been read
+            if((Payload.Len > 0) && ((Payload.Len != 1) || (Payload.Buf[0] != 'R')))
+            {
+                p.Buf[0] = RESP_INV_PAYLOAD;
+                p.Len = 1;
+                break;
+            }
+            p.Buf[0] = RESP_ACK;
+            p.Len = 1;
+            Append_Number(&p, Timebase_Get_us());
+            Append_Number(&p, IO_Get_ADC_Timestamp_us());
+            uint32_t SOF_us;
+            Append_Number(&p, Comms_Controller_Get_Frame(&SOF_us));
+            Append_Number(&p, SOF_us);
+            Timebase_Latency_Type Latency;
+            Timebase_Get_Tick_Latency(&Latency, Payload.Len > 0);
+            Append_Number(&p, Latency.Last_us);
+            Append_Number(&p, Latency.Min_us);
+            Append_Number(&p, Latency.Max_us);
+            break;
+        case COMMAND_MEMORY:
+            // reply is size,total,used,peak,fails, where size is the bytes per pool block and the rest are counts of blocks,
+            // except fails which is the number of allocations the pool could not satisfy
+            Buffer_Pool_Usage_Type Usage;
+            Buffer_Pool_Get_Usage(&Usage);
+            p.Buf[0] = RESP_ACK;
+            p.Len = 1;
+            Append_Number(&p, POOL_BLOCK_SIZE);
+            Append_Number(&p, Usage.Total);
+            Append_Number(&p, Usage.Used);
+            Append_Number(&p, Usage.Peak);
+            Append_Number(&p, Usage.Fails);
+            break;
+        case COMMAND_DIAGNOSTICS:
+            // no payload reads from the first counter, digits read from that counter number. R reads from the first counter, or
+            // R followed by digits from that counter number, then resets the counters that were in the reply
+            uint32_t First;
+            if(Payload.Len == 0)
+            {
+                Load_Buf_With_Diagnostics(&p, 0, false);
+            }
+            else if((Payload.Len == 1) && (Payload.Buf[0] == 'R'))
+            {
+                Load_Buf_With_Diagnostics(&p, 0, true);
+            }
+            else if((Payload.Buf[0] == 'R') && Get_Number_From_Payload(&First, Payload, 1, NUM_DIAG_COUNTERS-1))
+            {
+                Load_Buf_With_Diagnostics(&p, First, true);
+            }
+            else if(Get_Number_From_Payload(&First, Payload, 0, NUM_DIAG_COUNTERS-1))
+            {
+                Load_Buf_With_Diagnostics(&p, First, false);
+            }
+            else
+            {
+                p.Buf[0] = RESP_INV_PAYLOAD;
+                p.Len = 1;
+            }
+            break;
+        case COMMAND_POWER:
+            // reply is state,stops,last,max, where state is the POWER_STATE, stops is the number of times STOP mode was entered,
+            // and last/max are the most recent and longest time (us) to resume from STOP
+            Power_Status_Type Power;
+            Power_Get_Status(&Power);
+            p.Buf[0] = RESP_ACK;
+            p.Len = 1;
+            Append_Number(&p, Power.State);
+            Append_Number(&p, Power.Stops);
+            Append_Number(&p, Power.Last_Resume_us);
+            Append_Number(&p, Power.Max_Resume_us);
+            break;
+        case COMMAND_BOOT:
+            // reply is flags,disconnect,connect,reset,configured, where flags is the reset cause (see Reboot_Get_Reset_Flags())
+            // and the rest are the ms after reset that each BOOT_MILESTONE was reached, 0 if not reached yet
+            uint32_t Milestone_ms[NUM_BOOT_MILESTONES];
+            Diagnostics_Get_Boot(Milestone_ms);
+            p.Buf[0] = RESP_ACK;
+            p.Len = 1;
+            Append_Number(&p, Reboot_Get_Reset_Flags());
+            for(uint8_t m = 0; m < NUM_BOOT_MILESTONES; m++)
+            {
+                Append_Number(&p, Milestone_ms[m]);
+            }
+            break;
+        case COMMAND_IDENTITY:
+            // reply is uid,name,caps, where uid is the 96 bit unique ID as 24 hex chars (also the USB serial number), name is the
+            // name the host set (may be empty) and caps is the IDENTITY_CAP bitmap. N followed by a name sets the name first, and
+            // stores the settings so the name is kept
+            if((Payload.Len > 0) && ((Payload.Buf[0] != 'N') || !Identity_Set_Name(&Payload.Buf[1], Payload.Len - 1)))
+            {
+                p.Buf[0] = RESP_INV_PAYLOAD;
+                p.Len = 1;
+                break;
+            }
+            if(Payload.Len > 0)
+            {
+                Config_Commit();
+            }
+            p.Buf[0] = RESP_ACK;
+            Identity_Get_UID_Hex((char*)&p.Buf[1]);
+            p.Len = 1 + IDENTITY_UID_HEX_LEN;
+            p.Len += sprintf((char*)&p.Buf[p.Len], ",%s,", Identity_Get_Name());
+            Append_Number(&p, Identity_Get_Capabilities());
+            break;
+        case COMMAND_FAILSAFE:
+            // no payload reads the failsafe, C reads it then clears the latched trip, T followed by digits sets the timeout (ms, 0
+            // disables it) and M followed by 0 (coast) or 1 (brake) sets the safe state. T and M reply with the failsafe as set
+            uint32_t Failsafe_Arg;
+            if(Payload.Len == 0)
+            {
+                Load_Buf_With_Failsafe(&p, false);
+            }
+            else if((Payload.Len == 1) && (Payload.Buf[0] == 'C'))
+            {
+                Load_Buf_With_Failsafe(&p, true);
+            }
+            else if((Payload.Buf[0] == 'T') && Get_Number_From_Payload(&Failsafe_Arg, Payload, 1, FAILSAFE_MAX_TIMEOUT_MS)
+                    && Failsafe_Set_Timeout(Failsafe_Arg))
+            {
+                Load_Buf_With_Failsafe(&p, false);
+            }
+            else if((Payload.Buf[0] == 'M') && Get_Number_From_Payload(&Failsafe_Arg, Payload, 1, NUM_FAILSAFE_MODES-1)
+                    && Failsafe_Set_Mode((FAILSAFE_MODE_TYPE)Failsafe_Arg))
+            {
+                Load_Buf_With_Failsafe(&p, false);
+            }
+            else
+            {
+                p.Buf[0] = RESP_INV_PAYLOAD;
+                p.Len = 1;
+            }
+            break;
+        case COMMAND_CONFIG:
+            // no payload reads the store status, W stores the settings in flash then replies with the status, digits read that
+            // CONFIG_KEY and digits=value set it then read it. The value is text or digits depending on the setting.
+            // Settings are used as soon as they are set, W keeps them over a reboot
+            uint32_t Config_Key;
+            uint8_t *Equals = memchr(Payload.Buf, '=', Payload.Len);
+            Comms_Payload Key_Part = Payload;
+            Key_Part.Len = (Equals != NULL) ? (Equals - Payload.Buf) : Payload.Len;
+            if(Payload.Len == 0)
+            {
+                Load_Buf_With_Config_Status(&p);
+            }
+            else if((Payload.Len == 1) && (Payload.Buf[0] == 'W'))
+            {
+                Config_Commit();
+                Load_Buf_With_Config_Status(&p);
+            }
+            else if(!Get_Number_From_Payload(&Config_Key, Key_Part, 0, NUM_CONFIG_KEYS-1))
+            {
+                p.Buf[0] = RESP_INV_PAYLOAD;
+                p.Len = 1;
+            }
+            else if(Equals == NULL)
+            {
+                Load_Buf_With_Config(&p, Config_Key);
+            }
+            else
+            {
+                uint8_t Value_Start = Key_Part.Len + 1;
+                uint32_t Num;
+                bool Set;
+                if(Config_Is_Text(Config_Key))
+                {
+                    Set = Config_Set(Config_Key, &Payload.Buf[Value_Start], Payload.Len - Value_Start);
+                }
+                else
+                {
+                    Set = Get_Number_From_Payload(&Num, Payload, Value_Start, UINT32_MAX) && Config_Set(Config_Key, (uint8_t *)&Num, sizeof(Num));
+                }
+                if(Set)
+                {
+                    Load_Buf_With_Config(&p, Config_Key);
+                }
+                else
+                {
+                    p.Buf[0] = RESP_INV_PAYLOAD;
+                    p.Len = 1;
+                }
+            }
+            break;
+        case COMMAND_UPDATE:
+            // no payload replies max,state,len,crc, in hex: the longest image, the UPDATE_STATE of the running image and, if
+            // it was updated, its length and CRC. S<len>,<crc> (hex) starts an update, see Update.c
+            uint8_t Update_Pos = 1;
+            uint32_t Update_Len, Update_Crc;
+            if(Payload.Len == 0)
+            {
+                const volatile Update_Info_Type *Info = (const volatile Update_Info_Type *)UPDATE_INFO_ADDR;
+                bool Updated = (Update_Get_State() == UPDATE_STATE_UPDATED);
+                p.Buf[0] = RESP_ACK;
+                p.Len = Update_Append_Hex(p.Buf, 1, UPDATE_MAX_LEN);
+                p.Len = Update_Append_Hex(p.Buf, p.Len, Update_Get_State());
+                p.Len = Update_Append_Hex(p.Buf, p.Len, Updated ? Info->Len : 0);
+                p.Len = Update_Append_Hex(p.Buf, p.Len, Updated ? Info->Crc : 0);
+            }
+            else if((Payload.Buf[0] == 'S')
+                 && Update_Parse_Hex(Payload.Buf, Payload.Len, &Update_Pos, &Update_Len)
+                 && Update_Parse_Hex(Payload.Buf, Payload.Len, &Update_Pos, &Update_Crc)
+                 && (Update_Pos == Payload.Len)
+                 && Update_Request(Update_Len, Update_Crc))
+            {
+                p.Buf[0] = RESP_ACK;
+                p.Len = 1;
+            }
+            else
+            {
+                p.Buf[0] = RESP_INV_PAYLOAD;
+                p.Len = 1;
+            }
+            break;
+        case COMMAND_CAPABILITIES:
+            Load_Buf_With_Capabilities(&p);
+            break;
+#if (TRACE_ENABLE == 1)
+        case COMMAND_TRACE:
+            // no payload reads the status, digits read the events from that event number, F freezes the trace and S clears it and
+            // starts recording again, with the default mask or the mask that follows the S. F and S reply with the status
+            uint32_t Trace_Arg;
+            if(Payload.Len == 0)
+            {
+                Load_Buf_With_Trace_Status(&p);
+            }
+            else if((Payload.Len == 1) && (Payload.Buf[0] == 'F'))
+            {
+                Trace_Freeze(TRACE_FREEZE_HOST);
+                Load_Buf_With_Trace_Status(&p);
+            }
+            else if((Payload.Len == 1) && (Payload.Buf[0] == 'S'))
+            {
+                Trace_Start(TRACE_DEFAULT_MASK);
+                Load_Buf_With_Trace_Status(&p);
+            }
+            else if((Payload.Buf[0] == 'S') && Get_Number_From_Payload(&Trace_Arg, Payload, 1, UINT32_MAX))
+            {
+                Trace_Start(Trace_Arg);
+                Load_Buf_With_Trace_Status(&p);
+            }
+            else if(Get_Number_From_Payload(&Trace_Arg, Payload, 0, TRACE_LEN))
+            {
+                Load_Buf_With_Trace(&p, Trace_Arg);
+            }
+            else
+            {
+                p.Buf[0] = RESP_INV_PAYLOAD;
+                p.Len = 1;
+            }
+            break;
+#endif
+#if (PROFILE_ENABLE == 1)
+        case COMMAND_PROFILE:
+            // no payload reads from the first probe, digits read from that probe number, R reads from the first probe then resets them all
+            uint32_t First_Probe;
+            if(Payload.Len == 0)
+            {
+                Load_Buf_With_Profile(&p, 0, false);
+            }
+            else if((Payload.Len == 1) && (Payload.Buf[0] == 'R'))
+            {
+                Load_Buf_With_Profile(&p, 0, true);
+            }
+            else if(Get_Number_From_Payload(&First_Probe, Payload, 0, NUM_PROBES-1))
+            {
+                Load_Buf_With_Profile(&p, First_Probe, false);
+            }
+            else
+            {
+                p.Buf[0] = RESP_INV_PAYLOAD;
+                p.Len = 1;
+            }
+            break;
+#endif
         default:
             p.Buf[0] = RESP_INV_COMMAND; 
             p.Len = 1;
             break;
     }
 
+    PROFILE_END(PROBE_COMMAND_EXECUTE);
     return &p;
 }
 
@@ -2,13 +2,19 @@
   @file Comms_Controller.c
   @brief A manager and interface for the communication channel to the USB host. 
   @details How to use:
-        1. Call Comms_Controller_Reset_USB() after MX_GPIO_Init() and before MX_USB_DEVICE_Init() USB. This will pulse the USB DP+ pin low to simulate 
-           a device being plugged into the USB host which will trigger device enumeration.
+        1. Call Comms_Controller_Reset_USB() after MX_GPIO_Init(), and Comms_Controller_Connect_USB() at the start of MX_USB_DEVICE_Init().
+           This will pulse the USB DP+ pin low for USB_DISCONNECT_MS to simulate a device being plugged into the USB host which will trigger
+           device enumeration. The rest of the peripherals are initialised during the pulse.
         2. Call Comms_Controller_Initialise(void) during system initialisation.
         3. Call Comms_Controller_Bytes_Received(uint8_t *Buf, uint32_t Num_Bytes) when data is received from the host. This will process each byte received.
         4. During processing of bytes, once a valid command packet is detected Packet_Received(Comms_Packet *Pkt) will be called containing the packet.  
-           The packet will then be processed, any commands executed, and a reply sent back to the host.
-        5. Ensure Comms_Controller_Timer_Interrupt() is called periodically via a timer interrupt. This will be used to detect coms timeouts.
+           The packet is copied into a buffer pool block and queued, and DEFER_COMMAND is posted.
+        5. Call Comms_Controller_Deferred() when DEFER_COMMAND is posted. The queued commands are executed and a reply sent back to the host.
+           Commands are executed at PendSV level, so a slow command never holds up the USB or the control loop interrupts.
+           Only one reply is in flight at a time. The next command waits until the last reply has been sent, so its reply is never
+           dropped because the IN endpoint is busy.
+        6. Call Comms_Controller_Tx_Done() from the interface's transmit complete callback, to execute the commands that waited.
+        7. Ensure Comms_Controller_Timer_Interrupt() is called periodically via a timer interrupt. This will be used to detect coms timeouts.
  
         Ensure that packets are sent with time between bytes less than BYTE_TIMEOUT_MS otherwise the packet will be dropped. 
 
@@ -40,15 +46,43 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "Buffer_Pool.h"
 #include "Command.h"
 #include "Comms_Controller.h"
 #include "Comms_Defs.h"
 #include "Comms_RX.h"
+#include "Deferred.h"
+#include "Diagnostics.h"
+#include "Failsafe.h"
+#include "Profile.h"
+#include "Timebase.h"
+#include "Trace.h"
 
 #include "usbd_cdc_if.h"
+#include "usbd_raw_hid.h"
+
+#if (FRAME_BUF_SIZE > POOL_BLOCK_SIZE)
+#error "A reply frame, and so a queued packet, must fit in one buffer pool block"
+#endif
+#if (COMMS_POOL_BLOCKS > POOL_NUM_BLOCKS)
+#error "The buffer pool must hold every queued command plus one reply frame, increase POOL_NUM_BLOCKS or reduce COMMAND_QUEUE_LEN"
+#endif
 
 Comms_RX_Typedef RX = {.Expect=EXPECT_UNDEFINED};       /// Local object to save the data reception. Initialised with unexted until this module is properly initialised.  
-const Comms_Commands Active_Commands[] = {COMMAND_FW_VER, COMMAND_STATUS, COMMAND_SET_OUTPUTS, COMMAND_REBOOT};   /// An array of all commands, used to easily check if a received command is valid   
+volatile uint16_t SOF_Frame = 0;        /// USB frame number of the latest start of frame
+volatile uint32_t SOF_Timestamp_us = 0; /// Timebase_Get_us() at the latest start of frame
+uint32_t USB_Disconnect_Tick = 0;       /// HAL tick when D+ was driven low
+Comms_Packet *Command_Queue[COMMAND_QUEUE_LEN];    /// Received packets waiting to be executed, each in a buffer pool block
+volatile uint8_t Command_Queue_Head = 0;           /// Index of the oldest packet in Command_Queue
+volatile uint8_t Command_Queue_Count = 0;          /// Packets in Command_Queue
+const Comms_Commands Active_Commands[] = {COMMAND_FW_VER, COMMAND_STATUS, COMMAND_SET_OUTPUTS, COMMAND_REBOOT, COMMAND_CURRENT_STATS, COMMAND_TIMESTAMP, COMMAND_MEMORY, COMMAND_DIAGNOSTICS, COMMAND_POWER, COMMAND_BOOT, COMMAND_IDENTITY, COMMAND_FAILSAFE, COMMAND_CONFIG, COMMAND_UPDATE, COMMAND_CAPABILITIES,
+#if (PROFILE_ENABLE == 1)
+    COMMAND_PROFILE,
+#endif
+#if (TRACE_ENABLE == 1)
+    COMMAND_TRACE,
+#endif
+};   /// An array of all commands, used to easily check if a received command is valid   
 
 
 /**
@@ -61,7 +95,7 @@ const Comms_Commands Active_Commands[] = {COMMAND_FW_VER, COMMAND_STATUS, COMMAN
   */
 bool Is_Command_Valid(Comms_Commands Cmd)
 {
-    for(uint8_t c = 0; c < sizeof(Active_Commands)-1; c++)
+    for(uint8_t c = 0; c < sizeof(Active_Commands)/sizeof(Active_Commands[0]); c++)
     {   
         if(Active_Commands[c] == Cmd)
         {
@@ -72,8 +106,30 @@ bool Is_Command_Valid(Comms_Commands Cmd)
     return false;   // we searched the active commands but didn't find a match 
 }
 
+/**
+  * @brief  The commands this build accepts, so the host can check for a command before using it
+  *
+  * @param  None
+  * @retval Bitmap of the active commands. Bit 0 is 'A', bit 1 is 'B' and so on to bit 25, 'Z'
+  */
+uint32_t Comms_Controller_Get_Command_Bitmap(void)
+{
+    uint32_t Bitmap = 0;
+    for(uint8_t c = 0; c < sizeof(Active_Commands)/sizeof(Active_Commands[0]); c++)
+    {
+        if((Active_Commands[c] >= 'A') && (Active_Commands[c] <= 'Z'))
+        {
+            Bitmap |= 1UL << (Active_Commands[c] - 'A');
+        }
+    }
+    return Bitmap;
+}
+
 /**
   * @brief  Form a packet from the provided command and data, then sent it out the comms channel  
+  *         The frame is built in a buffer from the buffer pool. The CDC class returns it to the pool when the transfer completes.
+  *         If the pool is empty or the IN endpoint is still busy the reply is dropped.
+  *         The USB interrupt is masked while the transfer is started, as it shares the endpoint registers and the class state.
   *
   * @param  Cmd: command number being sent
   * @param  Dat: Payload to be sent
@@ -81,7 +137,13 @@ bool Is_Command_Valid(Comms_Commands Cmd)
   */ 
 void Send_Packet(Comms_Commands Cmd, Comms_Payload *Dat)
 {
-	static uint8_t Buf[PAYLOAD_BUF_SIZE+5];     // add 3 for the SOP, CMD, EOP and CRLF bytes 
+	uint8_t *Buf = Buffer_Pool_Alloc(FRAME_BUF_SIZE);     // the payload plus the SOP, CMD, EOP and CRLF bytes
+	if(Buf == NULL)
+	{
+		DIAGNOSTICS_INC(DIAG_TX_DROPS);
+		TRACE(TRACE_TX_DROPPED, Cmd);
+		return;
+	}
 	Buf[0] = SOP_BYTE;
 	Buf[1] = Cmd;
   if(Dat->Len > PAYLOAD_BUF_SIZE)
@@ -93,27 +155,160 @@ void Send_Packet(Comms_Commands Cmd, Comms_Payload *Dat)
 	Buf[3+Dat->Len] = '\n';   /// CRLF is not neccessary but is more human-readable. Helps when testing using a terminal.  
 	Buf[4+Dat->Len] = '\r';
 
-	CDC_Transmit_FS(Buf, (uint16_t)Dat->Len+5);   // +5 for SOP, CMD, EOP, CR, LF;
+#if (USB_INTERFACE_HID == 1)
+	HAL_NVIC_DisableIRQ(USB_IRQn);
+	uint8_t Result = Raw_HID_Transmit(Buf, (uint16_t)Dat->Len+5);   // +5 for SOP, CMD, EOP, CR, LF;
+	HAL_NVIC_EnableIRQ(USB_IRQn);
+	if(Result != USBD_OK)
+	{
+		DIAGNOSTICS_INC(DIAG_TX_DROPS);
+		TRACE(TRACE_TX_DROPPED, Cmd);
+	}
+	else
+	{
+		TRACE(TRACE_TX_QUEUED, Dat->Len+5);
+	}
+	Buffer_Pool_Free(Buf);     // the report has been copied
+#else
+	HAL_NVIC_DisableIRQ(USB_IRQn);
+	uint8_t Result = CDC_Transmit_FS(Buf, (uint16_t)Dat->Len+5);    // +5 for SOP, CMD, EOP, CR, LF;
+	HAL_NVIC_EnableIRQ(USB_IRQn);
+	if(Result != USBD_OK)
+	{
+		Buffer_Pool_Free(Buf);     // not sent, so there will be no transmit complete to free it
+		DIAGNOSTICS_INC(DIAG_TX_DROPS);
+		TRACE(TRACE_TX_DROPPED, Cmd);
+	}
+	else
+	{
+		TRACE(TRACE_TX_QUEUED, Dat->Len+5);
+	}
+#endif
 }
 
 /**
-   @brief  Process a received packet, execute any commands, and return a reply back to the host. 
+   @brief  Queue a received packet to be executed at PendSV level. Called by Comms_RX from the USB interrupt.
            SOP and EOP should have already been checked before calling this function. 
+           The packet is dropped if the queue is full or there is no buffer free, eg the host is sending faster than we can reply.
   
-   @param  Pkt: Packet to be processed
+   @param  Pkt: Packet to be queued. It is copied, so Comms_RX can start receiving the next one straight away
    @retval None
   */
 void Packet_Received(Comms_Packet *Pkt)
+{
+    DIAGNOSTICS_INC(DIAG_RX_FRAMES);
+    TRACE(TRACE_PACKET, Pkt->Command);
+
+    bool Is_Queued = false;
+    Comms_Packet *Queued = Buffer_Pool_Alloc(sizeof(Comms_Packet));
+    if(Queued != NULL)
+    {
+        *Queued = *Pkt;
+        uint32_t Primask = __get_PRIMASK();
+        __disable_irq();
+        if(Command_Queue_Count < COMMAND_QUEUE_LEN)
+        {
+            Command_Queue[(Command_Queue_Head + Command_Queue_Count) % COMMAND_QUEUE_LEN] = Queued;
+            Command_Queue_Count++;
+            Is_Queued = true;
+        }
+        __set_PRIMASK(Primask);
+    }
+
+    if(Is_Queued)
+    {
+        Deferred_Post(DEFER_COMMAND);
+    }
+    else
+    {
+        Buffer_Pool_Free(Queued);   // NULL is ignored
+        DIAGNOSTICS_INC(DIAG_RX_OVERRUNS);
+    }
+}
+
+/**
+   @brief  Check if the last reply is still being sent to the host
+  
+   @param  None
+   @retval true while the IN endpoint is busy, false if a reply can be sent
+  */
+static bool Is_Tx_Busy(void)
+{
+#if (USB_INTERFACE_HID == 1)
+    return Raw_HID_Transmit_Busy();
+#else
+    return CDC_Transmit_Busy_FS();
+#endif
+}
+
+/**
+   @brief  Execute the command in a queued packet and send its reply to the host. Called by Comms_Controller_Deferred() at
+           PendSV level, only when the IN endpoint is free.
+           Invalid commands and payloads are counted in the diagnostics. Any other reply tells the failsafe the host is alive.
+  
+   @param  Pkt: Packet to be executed. It stays owned by the queue, the caller frees it
+   @retval None
+  */
+static void Execute_Packet(Comms_Packet *Pkt)
 {
     Comms_Payload Reply;
 
     Reply = *Command_Execute(Pkt->Command, Pkt->Payload);
+    TRACE(TRACE_COMMAND_DONE, Reply.Buf[0]);
+    if(Reply.Buf[0] == RESP_INV_PAYLOAD)
+    {
+        DIAGNOSTICS_INC(DIAG_INV_PAYLOAD);
+    }
+    else if(Reply.Buf[0] == RESP_INV_COMMAND)
+    {
+        DIAGNOSTICS_INC(DIAG_INV_COMMAND);
+    }
+    else
+    {   // the host is alive and making sense
+        Failsafe_Command_Received();
+    }
     if(Reply.Len > 0)
     {
         Send_Packet(Pkt->Command, &Reply);
     }
 }
 
+/**
+  * @brief  Execute the queued commands, oldest first. Call this when DEFER_COMMAND is posted.
+  *         Stops while a reply is being sent. Comms_Controller_Tx_Done() posts DEFER_COMMAND again when it has gone.
+  *
+  * @retval None
+  */
+void Comms_Controller_Deferred(void)
+{
+    while((Command_Queue_Count > 0) && !Is_Tx_Busy())
+    {
+        Comms_Packet *Pkt = Command_Queue[Command_Queue_Head];
+        Execute_Packet(Pkt);
+        Buffer_Pool_Free(Pkt);
+
+        uint32_t Primask = __get_PRIMASK();
+        __disable_irq();
+        Command_Queue_Head = (Command_Queue_Head + 1) % COMMAND_QUEUE_LEN;
+        Command_Queue_Count--;
+        __set_PRIMASK(Primask);
+    }
+}
+
+/**
+  * @brief  A reply has been sent, or dropped as the host went away. Call this from the interface's transmit complete callback.
+  *         Commands that waited for it are executed at PendSV level.
+  *
+  * @retval None
+  */
+void Comms_Controller_Tx_Done(void)
+{
+    if(Command_Queue_Count > 0)
+    {
+        Deferred_Post(DEFER_COMMAND);
+    }
+}
+
 /**
   * @brief  Initialise the comms controller module and dependencies. Call this once during power-on init. 
   *
@@ -126,9 +321,10 @@ void Comms_Controller_Initialise(void)
 
 
 /**
-  * @brief  Pulse the USB D+ low to trigger the host to reenumerate the USB device. 
+  * @brief  Drive the USB D+ low so the host sees the device unplugged, which makes it reenumerate the device once D+ is released.
   *         This helps a lot especially during debugging/restarting  
-	*         Call this after MX_GPIO_Init() and before MX_USB_DEVICE_Init() ()
+	*         Call this after MX_GPIO_Init(). It returns straight away so the other peripherals can be initialised while D+ is held low,
+	*         then Comms_Controller_Connect_USB() releases D+ before the USB device is started.
   *
   * @param  None
   * @retval None
@@ -144,8 +340,26 @@ void Comms_Controller_Reset_USB(void)
 	HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 
 	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, RESET);
-	HAL_Delay(500);
+	USB_Disconnect_Tick = HAL_GetTick();
+	Diagnostics_Boot_Milestone(BOOT_USB_DISCONNECT);
+}
+
+/**
+  * @brief  Release D+ once it has been low for USB_DISCONNECT_MS, so the host sees the device plugged in.
+  *         Call this at the start of MX_USB_DEVICE_Init(). It only waits for whatever is left of USB_DISCONNECT_MS after the
+  *         initialisation done since Comms_Controller_Reset_USB().
+  *
+  * @param  None
+  * @retval None
+  */
+void Comms_Controller_Connect_USB(void)
+{
+	while((HAL_GetTick() - USB_Disconnect_Tick) <= USB_DISCONNECT_MS)
+	{
+		// the tick is only 1ms resolution, so wait one tick more to be sure of the minimum
+	}
 	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, SET);
+	Diagnostics_Boot_Milestone(BOOT_USB_CONNECT);
 }
 
 /**
@@ -157,6 +371,8 @@ void Comms_Controller_Reset_USB(void)
   */
 void Comms_Controller_Bytes_Received(uint8_t *Buf, uint32_t Num_Bytes)
 {
+    DIAGNOSTICS_ADD(DIAG_RX_BYTES, Num_Bytes);
+    TRACE(TRACE_RX_BYTES, (Num_Bytes < 255) ? Num_Bytes : 255);
     // can we add the received bytes to the existing buffer being processed 
     for(int i=0; i<Num_Bytes; i++)
     {
@@ -174,3 +390,32 @@ void Comms_Controller_Timer_Interrupt(void)
 {
   Comms_RX_Timer(&RX);
 }
+
+/**
+  * @brief  USB start of frame processing. Call this from the SOF interrupt (every 1ms while the host is sending frames).
+  *         Records the frame number and when it started, so replies can be related to the host's USB frames.
+  *
+  * @param  None
+  * @retval None
+  */
+void Comms_Controller_SOF_Interrupt(void)
+{
+  SOF_Frame = USB->FNR & USB_FNR_FN;
+  SOF_Timestamp_us = Timebase_Get_us();
+}
+
+/**
+  * @brief  Get the latest USB frame number and when it started
+  *
+  * @param  SOF_us: Filled with the Timebase_Get_us() time of the start of the frame
+  * @retval USB frame number, 0 to 2047
+  */
+uint16_t Comms_Controller_Get_Frame(uint32_t *SOF_us)
+{
+  uint32_t Primask = __get_PRIMASK();
+  __disable_irq();
+  uint16_t Frame = SOF_Frame;
+  *SOF_us = SOF_Timestamp_us;
+  __set_PRIMASK(Primask);
+  return Frame;
+}
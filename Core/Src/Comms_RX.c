@@ -25,12 +25,11 @@
 
 #include <stdbool.h>
 
-#include "Clock.h" 
 #include "Comms_Defs.h"
+#include "Diagnostics.h"
 #include "main.h"
-
-
-uint16_t Byte_Timeout_Ints;  // How many timer interrupts do we wait between receiving bytes of a packet before we time out. 
+#include "Profile.h"
+#include "Timebase.h"
 
 
 /**
@@ -44,7 +43,6 @@ void Comms_RX_Initialise(Comms_RX_Typedef *RX, void *Packet_Ready_CB)
 {
     RX->Expect = EXPECT_SOP;            // Initialise RX state machine to receive the SOP byte
     RX->Packet_Ready = Packet_Ready_CB;    // INitialise our callback. This is called when we have received an error free, valid packet.
-    Byte_Timeout_Ints = ((float)BYTE_TIMEOUT_MS / Clock_Get_Timer_ms());  // If this is too low then manually typing into a terminal will time out
 }
 
 /**
@@ -58,12 +56,13 @@ void Comms_RX_Initialise(Comms_RX_Typedef *RX, void *Packet_Ready_CB)
   */
 void Comms_RX_Receive_Byte(Comms_RX_Typedef *RX, uint8_t This_Byte)
 {
+    PROFILE_BEGIN(PROBE_RX_BYTE);
     if(RX->Expect == EXPECT_SOP)
     {   // we are expecting the statt of packet
         if(This_Byte == SOP_BYTE)   
         {   // yes, we have received the start of packet 
+            RX->Byte_Deadline_ms = Timebase_Deadline_ms(BYTE_TIMEOUT_MS);    // a packet reception is in progress, allow us to time out if it's not fully received. Set first, the timer interrupt can preempt us
             RX->Expect = EXPECT_COMMAND;    // next expected byte is the command
-            RX->Byte_Timer = 0;             // a packet reception is in progress, allow us to time out if it's not fully received
             RX->Packet.SOP = This_Byte;     // save the SOP byte
         }
     }
@@ -72,7 +71,7 @@ void Comms_RX_Receive_Byte(Comms_RX_Typedef *RX, uint8_t This_Byte)
         RX->Packet.Command = This_Byte;     // save the command byte we received. We'll check it later.  
         RX->Expect = EXPECT_PAYLOAD;        // next we expect the payload
         RX->Running_Len = 0;                // ready to count the number of payload bytes 
-        RX->Byte_Timer = 0;                 // a packet reception is in progress, allow us to time out if it's not fully received
+        RX->Byte_Deadline_ms = Timebase_Deadline_ms(BYTE_TIMEOUT_MS);    // a packet reception is in progress, allow us to time out if it's not fully received
     }
     else if(RX->Expect == EXPECT_PAYLOAD)
     {   //  we are expecting a payload byte 
@@ -95,8 +94,9 @@ void Comms_RX_Receive_Byte(Comms_RX_Typedef *RX, uint8_t This_Byte)
             // buffer is full and we havent received the EOP byte yet - don't save anything. 
             // extra data included beyond the PAYLOAD_BUF_SIZE will be ignored
         }
-        RX->Byte_Timer = 0;          // a packet reception is in progress, allow us to time out if it's not fully received
+        RX->Byte_Deadline_ms = Timebase_Deadline_ms(BYTE_TIMEOUT_MS);    // a packet reception is in progress, allow us to time out if it's not fully received
     }
+    PROFILE_END(PROBE_RX_BYTE);
 }
 
 /**
@@ -109,9 +109,10 @@ void Comms_RX_Timer(Comms_RX_Typedef *RX)
 {
     if((RX->Expect != EXPECT_SOP) && (RX->Expect != EXPECT_UNDEFINED))
     {   // are we in the middle of receiving a packet
-        if(++RX->Byte_Timer >= Byte_Timeout_Ints)  // and has it been a long time since we received our last byte?
+        if(Timebase_Expired_ms(RX->Byte_Deadline_ms))  // and has it been a long time since we received our last byte?
         {
             RX->Expect = EXPECT_SOP;   // drop any current reception and wait for the next start of packet
+            DIAGNOSTICS_INC(DIAG_RX_TIMEOUTS);
         }
     }
 }
@@ -0,0 +1,458 @@
+/**
+  @file Config.c
+  @brief Keeps the settings the host has made (unit name, failsafe, statistics window) in flash, so they are restored at power on
+         instead of the host sending them again on every connect.
+  @details The settings live in the modules that use them. This module reads them from the modules when they are committed, and
+           hands them back through the modules' own set functions at power on, so every value is checked the same way however it
+           is set.
+
+           Flash layout: the last CONFIG_NUM_PAGES pages, kept out of the FLASH region in the linker script. Each page is a log:
+           - A page header with CONFIG_MAGIC and a sequence number. The page with the highest sequence is the current one.
+           - Records appended one after another, each a key, a length, the value padded to a word and a CRC-32 of the key, length
+             and value. The newest record of each key holds its value. The end of the log is the first erased record.
+
+           Commit: the current value of every setting is compared with its newest record, and only the changed ones are appended.
+           When the page is full, the other page is erased and every setting written to it, then its header is written with the
+           next sequence. Until the header is written the old page is still the current one, so a power loss part way through a
+           commit loses only that commit. Appending rather than rewriting, and taking the pages in turn, spreads the erases across
+           the pages and keeps them rare. A single setting change uses 12 bytes (the name 24), so a page takes about 80 commits
+           between erases.
+
+           Records are checked with the CRC unit, which takes a few cycles per byte, so reading a full page at power on takes
+           well under a millisecond. The time taken is measured and reported in the status.
+
+           Writing flash stalls the CPU for the page erase (up to 40ms), interrupts included. So a commit is only asked for from
+           the command, and written later from the main loop.
+
+           The name used to be kept on its own in the last page by Identity.c. If that record is found where there is no store
+           yet, the name is taken from it and committed to the new store.
+
+           How to use:
+           1. Call Config_Initialise() during system initialisation, after the modules with settings have been initialised.
+           2. Call Config_Main() from the main loop when SCHED_EVENT_CONFIG is set.
+           3. Call Config_Get() and Config_Set() to read and change a setting, and Config_Commit() to store them all.
+           4. Check Config_Is_Writing() before anything that takes the CPU away from the main loop for good (a reset or the
+              updater), so a commit part way through being written is finished first.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "Config.h"
+#include "Current_Stats.h"
+#include "Failsafe.h"
+#include "Identity.h"
+#include "main.h"
+#include "Scheduler.h"
+#include "stm32f0xx_ll_bus.h"
+#include "stm32f0xx_ll_crc.h"
+#include "Timebase.h"
+
+#define CONFIG_MAGIC 0x31474643UL                                   // "CFG1", marks a page holding a log
+#define CONFIG_END_KEY 0xFF                                         // Key of an erased record, the end of the log
+#define LEGACY_NAME_MAGIC 0x454D414EUL                              // "NAME", the record older firmware kept the name in
+#define LEGACY_NAME_ADDR (CONFIG_FLASH_ADDR + CONFIG_PAGE_SIZE)     // Where older firmware kept the name, the last flash page
+
+/**
+  * @brief  The start of each page
+  */
+typedef struct
+{
+    uint32_t Magic;         // CONFIG_MAGIC once the page has been filled. Written last
+    uint32_t Sequence;      // One more than the page it replaced
+}Config_Page_Header;
+
+/**
+  * @brief  The start of each record, followed by the value padded to a multiple of 4 bytes
+  */
+typedef struct
+{
+    uint8_t Key;            // CONFIG_KEY. CONFIG_END_KEY marks the end of the log
+    uint8_t Len;            // Bytes in the value
+    uint16_t Unused;        // Written as 0, keeps the CRC word aligned
+    uint32_t Crc;           // CRC-32 of the key, length and value. Written last, so only a complete record is valid
+}Config_Record_Header;
+
+/**
+  * @brief  Old style name record, see LEGACY_NAME_ADDR
+  */
+typedef struct
+{
+    uint32_t Magic;                 // LEGACY_NAME_MAGIC
+    char Name[IDENTITY_NAME_LEN];   // The name, padded with nulls
+}Config_Legacy_Name;
+
+#define RECORD_SIZE(Len) (sizeof(Config_Record_Header) + (((Len) + 3) & ~3U))  // Flash used by a record with a Len byte value
+
+uint32_t Config_Page_Addr = 0;                      /// Address of the current page, 0 if nothing has been stored yet
+uint32_t Config_Sequence = 0;                       /// Sequence of the current page
+uint16_t Config_Used = 0;                           /// Bytes of the current page used by the log
+uint16_t Config_Load_us = 0;                        /// Time taken by Config_Initialise()
+volatile bool Config_Pending = false;               /// A commit has been asked for
+volatile bool Config_Writing = false;               /// Config_Main() is writing a commit, set until the flash is locked again
+CONFIG_RESULT Config_Result = CONFIG_RESULT_NONE;   /// Result of the latest commit
+
+/**
+  * @brief  CRC-32 of a record, from the CRC unit (polynomial 0x04C11DB7, initial value 0xFFFFFFFF)
+  * @param  Key: The record key
+  * @param  Value: The value
+  * @param  Len: Bytes in the value
+  * @retval The CRC
+  */
+static uint32_t Record_CRC(uint8_t Key, const uint8_t *Value, uint8_t Len)
+{
+    LL_CRC_ResetCRCCalculationUnit(CRC);
+    LL_CRC_FeedData8(CRC, Key);
+    LL_CRC_FeedData8(CRC, Len);
+    for(uint8_t b = 0; b < Len; b++)
+    {
+        LL_CRC_FeedData8(CRC, Value[b]);
+    }
+    return LL_CRC_ReadData32(CRC);
+}
+
+/**
+  * @brief  Walk the log of a page, finding the newest valid record of each setting.
+  *         Records with a bad CRC (eg a write cut short by a power loss) are skipped.
+  * @param  Page_Addr: The page
+  * @param  Newest: Filled with the newest valid record of each key, NULL where there is none
+  * @retval Bytes of the page used by the log, including any bad records
+  */
+static uint16_t Scan_Log(uint32_t Page_Addr, const Config_Record_Header *Newest[NUM_CONFIG_KEYS])
+{
+    memset(Newest, 0, NUM_CONFIG_KEYS * sizeof(Newest[0]));
+
+    uint16_t Offset = sizeof(Config_Page_Header);
+    while(Offset + sizeof(Config_Record_Header) <= CONFIG_PAGE_SIZE)
+    {
+        const Config_Record_Header *Rec = (const Config_Record_Header *)(Page_Addr + Offset);
+        if((Rec->Key == CONFIG_END_KEY) && (Rec->Len == 0xFF))
+        {
+            break;  // erased
+        }
+        if(Offset + RECORD_SIZE(Rec->Len) > CONFIG_PAGE_SIZE)
+        {
+            return CONFIG_PAGE_SIZE;    // runs off the end of the page, treat the page as full
+        }
+        if((Rec->Key < NUM_CONFIG_KEYS) && (Rec->Len <= CONFIG_MAX_LEN) && (Rec->Crc == Record_CRC(Rec->Key, (const uint8_t *)(Rec + 1), Rec->Len)))
+        {
+            Newest[Rec->Key] = Rec;
+        }
+        Offset += RECORD_SIZE(Rec->Len);
+    }
+    return Offset;
+}
+
+/**
+  * @brief  Program half words into flash. The flash must be unlocked and the destination erased
+  * @param  Addr: Where to write, half word aligned
+  * @param  Data: What to write
+  * @param  Len: Bytes to write, a multiple of 2
+  * @retval true if written, false if programming failed
+  */
+static bool Program(uint32_t Addr, const void *Data, uint16_t Len)
+{
+    const uint16_t *Half_Words = (const uint16_t *)Data;
+    for(uint16_t h = 0; h < Len / 2; h++)
+    {
+        if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, Addr + (h * 2), Half_Words[h]) != HAL_OK)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+  * @brief  Append a record to the log. The key and length go first so the log can be walked past a record cut short,
+  *         and the CRC goes last. The flash must be unlocked
+  * @param  Addr: Where to write, the end of the log
+  * @param  Key: The setting
+  * @param  Value: The value
+  * @param  Len: Bytes in the value
+  * @retval true if written, false if programming failed
+  */
+static bool Write_Record(uint32_t Addr, CONFIG_KEY Key, const uint8_t *Value, uint8_t Len)
+{
+    Config_Record_Header Header = {.Key = Key, .Len = Len, .Unused = 0, .Crc = Record_CRC(Key, Value, Len)};
+    uint8_t Padded[CONFIG_MAX_LEN] = {0};
+    memcpy(Padded, Value, Len);
+
+    return Program(Addr, &Header, offsetof(Config_Record_Header, Crc))
+        && Program(Addr + sizeof(Header), Padded, RECORD_SIZE(Len) - sizeof(Header))
+        && Program(Addr + offsetof(Config_Record_Header, Crc), &Header.Crc, sizeof(Header.Crc));
+}
+
+/**
+  * @brief  Start the log again on the next page, with every setting. The header is written last, so the current page is
+  *         kept until the new one is complete. The flash must be unlocked
+  * @param  Values: The value of each setting
+  * @param  Lens: Bytes in the value of each setting
+  * @retval true if written, false if erasing or programming failed
+  */
+static bool Start_Page(uint8_t Values[NUM_CONFIG_KEYS][CONFIG_MAX_LEN], const uint8_t Lens[NUM_CONFIG_KEYS])
+{
+    uint32_t Page_Addr = CONFIG_FLASH_ADDR;
+    if(Config_Page_Addr != 0)
+    {
+        uint8_t Page = (Config_Page_Addr - CONFIG_FLASH_ADDR) / CONFIG_PAGE_SIZE;
+        Page_Addr = CONFIG_FLASH_ADDR + (((Page + 1) % CONFIG_NUM_PAGES) * CONFIG_PAGE_SIZE);
+    }
+
+    FLASH_EraseInitTypeDef Erase;
+    Erase.TypeErase = FLASH_TYPEERASE_PAGES;
+    Erase.PageAddress = Page_Addr;
+    Erase.NbPages = 1;
+    uint32_t Page_Error;
+    if(HAL_FLASHEx_Erase(&Erase, &Page_Error) != HAL_OK)
+    {
+        return false;
+    }
+
+    uint16_t Offset = sizeof(Config_Page_Header);
+    for(uint8_t k = 0; k < NUM_CONFIG_KEYS; k++)
+    {
+        if(!Write_Record(Page_Addr + Offset, (CONFIG_KEY)k, Values[k], Lens[k]))
+        {
+            return false;
+        }
+        Offset += RECORD_SIZE(Lens[k]);
+    }
+
+    Config_Page_Header Header = {.Magic = CONFIG_MAGIC, .Sequence = Config_Sequence + 1};
+    if(!Program(Page_Addr + offsetof(Config_Page_Header, Sequence), &Header.Sequence, sizeof(Header.Sequence))
+       || !Program(Page_Addr, &Header.Magic, sizeof(Header.Magic)))
+    {
+        return false;
+    }
+
+    Config_Page_Addr = Page_Addr;
+    Config_Sequence = Header.Sequence;
+    Config_Used = Offset;
+    return true;
+}
+
+/**
+  * @brief  Read the stored settings and apply them. Call this once during power-on init, after the modules with settings
+  *         have been initialised, so the stored values replace their defaults
+  * @retval None
+  */
+void Config_Initialise(void)
+{
+    uint32_t Start_us = Timebase_Get_us();
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_CRC);
+
+    Config_Page_Addr = 0;
+    Config_Sequence = 0;
+    Config_Used = 0;
+    for(uint8_t p = 0; p < CONFIG_NUM_PAGES; p++)
+    {
+        const Config_Page_Header *Header = (const Config_Page_Header *)(CONFIG_FLASH_ADDR + (p * CONFIG_PAGE_SIZE));
+        if((Header->Magic == CONFIG_MAGIC) && (Header->Sequence > Config_Sequence))
+        {
+            Config_Page_Addr = (uint32_t)Header;
+            Config_Sequence = Header->Sequence;
+        }
+    }
+
+    if(Config_Page_Addr != 0)
+    {
+        const Config_Record_Header *Newest[NUM_CONFIG_KEYS];
+        Config_Used = Scan_Log(Config_Page_Addr, Newest);
+        for(uint8_t k = 0; k < NUM_CONFIG_KEYS; k++)
+        {
+            if(Newest[k] != NULL)
+            {
+                Config_Set((CONFIG_KEY)k, (const uint8_t *)(Newest[k] + 1), Newest[k]->Len);
+            }
+        }
+    }
+    else
+    {
+        const Config_Legacy_Name *Legacy = (const Config_Legacy_Name *)LEGACY_NAME_ADDR;
+        if((Legacy->Magic == LEGACY_NAME_MAGIC) && Config_Set(CONFIG_NAME, (const uint8_t *)Legacy->Name, strnlen(Legacy->Name, IDENTITY_NAME_LEN)))
+        {
+            Config_Commit();    // move it into the store
+        }
+    }
+
+    Config_Load_us = Timebase_Get_us() - Start_us;
+}
+
+/**
+  * @brief  Main loop call - writes the settings to flash once a commit has been asked for
+  * @retval None
+  */
+void Config_Main(void)
+{
+    if(!Config_Pending)
+    {
+        return;
+    }
+    Config_Writing = true;     // set before Pending is cleared, so there is no moment where neither shows the commit
+    Config_Pending = false;
+
+    uint8_t Values[NUM_CONFIG_KEYS][CONFIG_MAX_LEN];
+    uint8_t Lens[NUM_CONFIG_KEYS];
+    for(uint8_t k = 0; k < NUM_CONFIG_KEYS; k++)
+    {   // take every value first, so they can't change between sizing the commit and writing it
+        Lens[k] = Config_Get((CONFIG_KEY)k, Values[k]);
+    }
+
+    const Config_Record_Header *Newest[NUM_CONFIG_KEYS] = {NULL};
+    uint16_t Used = CONFIG_PAGE_SIZE;   // nothing stored yet, so start a page
+    if(Config_Page_Addr != 0)
+    {
+        Used = Scan_Log(Config_Page_Addr, Newest);
+    }
+
+    bool Changed[NUM_CONFIG_KEYS];
+    uint16_t Needed = 0;
+    for(uint8_t k = 0; k < NUM_CONFIG_KEYS; k++)
+    {
+        Changed[k] = (Newest[k] == NULL) || (Newest[k]->Len != Lens[k]) || (memcmp(Newest[k] + 1, Values[k], Lens[k]) != 0);
+        if(Changed[k])
+        {
+            Needed += RECORD_SIZE(Lens[k]);
+        }
+    }
+
+    bool Ok = true;
+    HAL_FLASH_Unlock();
+    if(Used + Needed <= CONFIG_PAGE_SIZE)
+    {
+        for(uint8_t k = 0; (k < NUM_CONFIG_KEYS) && Ok; k++)
+        {
+            if(Changed[k])
+            {
+                Ok = Write_Record(Config_Page_Addr + Used, (CONFIG_KEY)k, Values[k], Lens[k]);
+                Used += RECORD_SIZE(Lens[k]);
+            }
+        }
+        Config_Used = Used;
+    }
+    else
+    {
+        Ok = Start_Page(Values, Lens);
+    }
+    HAL_FLASH_Lock();
+
+    Config_Result = Ok ? CONFIG_RESULT_OK : CONFIG_RESULT_FAILED;
+    Config_Writing = false;
+}
+
+/**
+  * @brief  Check if a commit is being written. Between the flash operations the interrupts still run, so a reset or the
+  *         updater started from one must wait for this to clear, or the commit is lost
+  * @retval true from when Config_Main() takes a commit until the flash is locked again
+  */
+bool Config_Is_Writing(void)
+{
+    return Config_Writing;
+}
+
+/**
+  * @brief  Ask for the current settings to be written to flash. They are written from Config_Main(). Safe to call from interrupts
+  * @retval None
+  */
+void Config_Commit(void)
+{
+    Config_Pending = true;
+    Scheduler_Set_Event(SCHED_EVENT_CONFIG);
+}
+
+/**
+  * @brief  Check how a setting's value is held
+  * @param  Key: The setting
+  * @retval true for text, false for a number held as 4 bytes (uint32_t)
+  */
+bool Config_Is_Text(CONFIG_KEY Key)
+{
+    return Key == CONFIG_NAME;
+}
+
+/**
+  * @brief  Read the value a setting has now, from the module that uses it
+  * @param  Key: The setting
+  * @param  Value: Filled with the value. Text is not null terminated, numbers are a uint32_t
+  * @retval Bytes in the value, 0 if Key is not valid
+  */
+uint8_t Config_Get(CONFIG_KEY Key, uint8_t Value[CONFIG_MAX_LEN])
+{
+    uint32_t Num;
+    uint8_t Len;
+    uint32_t Primask;
+    Failsafe_Status_Type Failsafe;
+    switch(Key)
+    {
+        case CONFIG_NAME:
+            Primask = __get_PRIMASK();
+            __disable_irq();    // the name can be set by a command part way through the copy
+            Len = strnlen(Identity_Get_Name(), IDENTITY_NAME_LEN);
+            memcpy(Value, Identity_Get_Name(), Len);
+            __set_PRIMASK(Primask);
+            return Len;
+        case CONFIG_FAILSAFE_TIMEOUT:
+            Failsafe_Get_Status(&Failsafe, false);
+            Num = Failsafe.Timeout_ms;
+            break;
+        case CONFIG_FAILSAFE_MODE:
+            Failsafe_Get_Status(&Failsafe, false);
+            Num = Failsafe.Mode;
+            break;
+        case CONFIG_STATS_WINDOW:
+            Num = Current_Stats_Get_Window();
+            break;
+        default:
+            return 0;
+    }
+    memcpy(Value, &Num, sizeof(Num));
+    return sizeof(Num);
+}
+
+/**
+  * @brief  Change a setting straight away, through the module that uses it. Call Config_Commit() to store it
+  * @param  Key: The setting
+  * @param  Value: The value. Text is not null terminated, numbers are a uint32_t
+  * @param  Len: Bytes in the value
+  * @retval true if set, false if the key or value is not valid
+  */
+bool Config_Set(CONFIG_KEY Key, const uint8_t *Value, uint8_t Len)
+{
+    if(Key == CONFIG_NAME)
+    {
+        return Identity_Set_Name(Value, Len);
+    }
+
+    uint32_t Num;
+    if(Len != sizeof(Num))
+    {
+        return false;
+    }
+    memcpy(&Num, Value, sizeof(Num));
+    switch(Key)
+    {
+        case CONFIG_FAILSAFE_TIMEOUT:
+            return Failsafe_Set_Timeout(Num);
+        case CONFIG_FAILSAFE_MODE:
+            return (Num < NUM_FAILSAFE_MODES) && Failsafe_Set_Mode((FAILSAFE_MODE_TYPE)Num);
+        case CONFIG_STATS_WINDOW:
+            return (Num <= STATS_MAX_WINDOW) && Current_Stats_Set_Window(Num);
+        default:
+            return false;
+    }
+}
+
+/**
+  * @brief  Read the state of the store
+  * @param  Status: Filled with the status
+  * @retval None
+  */
+void Config_Get_Status(Config_Status_Type *Status)
+{
+    Status->Sequence = Config_Sequence;
+    Status->Used = Config_Used;
+    Status->Load_us = Config_Load_us;
+    Status->Pending = Config_Pending || Config_Writing;
+    Status->Result = Config_Result;
+}
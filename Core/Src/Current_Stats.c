@@ -0,0 +1,276 @@
+/**
+  @file Current_Stats.c
+  @brief Streaming mean, RMS, peak and minimum of each current sense channel over a sliding window of samples.
+  @details Each new ADC sample updates the statistics incrementally, so nothing has to be recalculated over the whole window
+           and the host does not have to pull raw samples to calculate them itself.
+           - Mean and RMS are kept as a running sum and running sum of squares. The oldest sample is subtracted as the new one is added.
+           - Peak and minimum are kept with a monotonic wedge of sample positions. The front of the wedge is always the peak (or minimum)
+             of the window. Each sample is pushed and popped at most once so the update is amortised constant time.
+
+           How to use:
+           1. Call Current_Stats_Initialise() during system initialisation.
+           2. Call Current_Stats_Add_Sample() from the ADC interrupt for each new sample of each channel.
+           3. Call Current_Stats_Get() at any time to read a consistent snapshot of the statistics.
+           4. Optionally call Current_Stats_Set_Window() to change the window length. This restarts the statistics.
+ */
+
+#include "Current_Stats.h"
+#include "main.h"
+
+/**
+  * @brief  Monotonic wedge of sample positions in the window. Values are in chronological order, oldest at the front.
+  */
+typedef struct
+{
+    uint8_t Pos[STATS_MAX_WINDOW];  // position in the Samples[] ring of each entry
+    uint8_t Head;                   // index of the front (oldest) entry
+    uint8_t Count;                  // number of entries in the wedge
+}Wedge_Type;
+
+/**
+  * @brief  Sliding window and running statistics of one channel
+  */
+typedef struct
+{
+    uint16_t Samples[STATS_MAX_WINDOW];  // ring of the last Window_Len samples
+    uint8_t Next;                        // position in Samples[] that the next sample will be written to
+    uint8_t Count;                       // number of valid samples in the window, up to Window_Len
+    uint32_t Sum;                        // sum of all samples in the window
+    uint32_t Sum_Sq;                     // sum of the squares of all samples in the window. 12 bit samples, max 255 samples fits 32 bits
+    Wedge_Type Max;                      // wedge of decreasing values, front is the peak
+    Wedge_Type Min;                      // wedge of increasing values, front is the minimum
+}Stats_Channel_Type;
+
+Stats_Channel_Type Stats_Channels[NUM_ADC_PINS];
+uint8_t Window_Len = STATS_DEFAULT_WINDOW;  /// Number of samples in the sliding window
+
+/**
+  * @brief  Increment a position in the window, wrapping back to 0 at the end of the window.
+  *         Used instead of % since the M0 has no hardware divide.
+  * @param  Pos: current position
+  * @retval The following position
+  */
+static uint8_t Next_Pos(uint8_t Pos)
+{
+    if(++Pos >= Window_Len)
+    {
+        Pos = 0;
+    }
+    return Pos;
+}
+
+/**
+  * @brief  Add a sample position to the back of the wedge, first removing any entries it supersedes.
+  * @param  W: The wedge to push onto
+  * @param  Samples: The sample ring the wedge refers to
+  * @param  Pos: Position in the sample ring of the new sample
+  * @param  Is_Max: true to keep the maximum at the front, false to keep the minimum at the front
+  * @retval None
+  */
+static void Wedge_Push(Wedge_Type *W, const uint16_t *Samples, uint8_t Pos, bool Is_Max)
+{
+    uint16_t Value = Samples[Pos];
+
+    while(W->Count > 0)
+    {
+        uint16_t Back = W->Head + W->Count - 1;
+        if(Back >= Window_Len)
+        {
+            Back -= Window_Len;
+        }
+        uint16_t Back_Value = Samples[W->Pos[Back]];
+        if((Is_Max && (Back_Value > Value)) || (!Is_Max && (Back_Value < Value)))
+        {
+            break;  // the back entry is still a candidate once this sample has left the window
+        }
+        W->Count--;
+    }
+
+    uint16_t Tail = W->Head + W->Count;
+    if(Tail >= Window_Len)
+    {
+        Tail -= Window_Len;
+    }
+    W->Pos[Tail] = Pos;
+    W->Count++;
+}
+
+/**
+  * @brief  Remove the front of the wedge if it refers to the sample position that is leaving the window
+  * @param  W: The wedge
+  * @param  Pos: Position in the sample ring of the sample that is leaving the window
+  * @retval None
+  */
+static void Wedge_Expire(Wedge_Type *W, uint8_t Pos)
+{
+    if((W->Count > 0) && (W->Pos[W->Head] == Pos))
+    {
+        W->Head = Next_Pos(W->Head);
+        W->Count--;
+    }
+}
+
+/**
+  * @brief  Integer square root
+  * @param  Value: number to find the root of
+  * @retval floor(sqrt(Value))
+  */
+static uint16_t Sqrt_U32(uint32_t Value)
+{
+    uint32_t Root = 0;
+    uint32_t Bit = 1UL << 30;
+
+    while(Bit > Value)
+    {
+        Bit >>= 2;
+    }
+    while(Bit != 0)
+    {
+        if(Value >= Root + Bit)
+        {
+            Value -= Root + Bit;
+            Root = (Root >> 1) + Bit;
+        }
+        else
+        {
+            Root >>= 1;
+        }
+        Bit >>= 2;
+    }
+    return (uint16_t)Root;
+}
+
+/**
+  * @brief  Clear the statistics of all channels. Interrupts should be disabled by the caller.
+  * @retval None
+  */
+static void Reset_Channels(void)
+{
+    for(uint8_t c = 0; c < NUM_ADC_PINS; c++)
+    {
+        Stats_Channels[c].Next = 0;
+        Stats_Channels[c].Count = 0;
+        Stats_Channels[c].Sum = 0;
+        Stats_Channels[c].Sum_Sq = 0;
+        Stats_Channels[c].Max.Head = 0;
+        Stats_Channels[c].Max.Count = 0;
+        Stats_Channels[c].Min.Head = 0;
+        Stats_Channels[c].Min.Count = 0;
+    }
+}
+
+/**
+  * @brief  Initialise the statistics. Call this once during power-on init.
+  * @retval None
+  */
+void Current_Stats_Initialise(void)
+{
+    Window_Len = STATS_DEFAULT_WINDOW;
+    Reset_Channels();
+}
+
+/**
+  * @brief  Add a new sample to the channel's window and update its statistics. Call this from the ADC interrupt.
+  * @param  Pin: The channel the sample belongs to
+  * @param  Sample: Raw ADC value
+  * @retval None
+  */
+void Current_Stats_Add_Sample(ADC_PIN Pin, uint16_t Sample)
+{
+    if(Pin >= NUM_ADC_PINS)
+    {
+        return;
+    }
+
+    Stats_Channel_Type *Ch = &Stats_Channels[Pin];
+    uint8_t Pos = Ch->Next;
+
+    if(Ch->Count >= Window_Len)
+    {   // window is full, the oldest sample is at the position about to be overwritten
+        uint32_t Oldest = Ch->Samples[Pos];
+        Ch->Sum -= Oldest;
+        Ch->Sum_Sq -= Oldest * Oldest;
+        Wedge_Expire(&Ch->Max, Pos);
+        Wedge_Expire(&Ch->Min, Pos);
+    }
+    else
+    {
+        Ch->Count++;
+    }
+
+    Ch->Samples[Pos] = Sample;
+    Ch->Sum += Sample;
+    Ch->Sum_Sq += (uint32_t)Sample * Sample;
+    Wedge_Push(&Ch->Max, Ch->Samples, Pos, true);
+    Wedge_Push(&Ch->Min, Ch->Samples, Pos, false);
+
+    Ch->Next = Next_Pos(Pos);
+}
+
+/**
+  * @brief  Read the statistics of a channel over the current window
+  * @param  Pin: The channel to read
+  * @param  Stats: Filled with the statistics. All zero if the channel has no samples yet
+  * @retval None
+  */
+void Current_Stats_Get(ADC_PIN Pin, Current_Stats_Type *Stats)
+{
+    Stats->Mean = 0;
+    Stats->RMS = 0;
+    Stats->Peak = 0;
+    Stats->Min = 0;
+
+    if(Pin >= NUM_ADC_PINS)
+    {
+        return;
+    }
+
+    // take a consistent snapshot, the ADC interrupt updates these
+    Stats_Channel_Type *Ch = &Stats_Channels[Pin];
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    uint8_t Count = Ch->Count;
+    uint32_t Sum = Ch->Sum;
+    uint32_t Sum_Sq = Ch->Sum_Sq;
+    uint16_t Peak = Ch->Samples[Ch->Max.Pos[Ch->Max.Head]];
+    uint16_t Min = Ch->Samples[Ch->Min.Pos[Ch->Min.Head]];
+    __set_PRIMASK(Primask);
+
+    if(Count > 0)
+    {
+        Stats->Mean = Sum / Count;
+        Stats->RMS = Sqrt_U32(Sum_Sq / Count);
+        Stats->Peak = Peak;
+        Stats->Min = Min;
+    }
+}
+
+/**
+  * @brief  Get the current sliding window length
+  * @retval Number of samples in the window
+  */
+uint8_t Current_Stats_Get_Window(void)
+{
+    return Window_Len;
+}
+
+/**
+  * @brief  Change the sliding window length. This restarts the statistics of all channels.
+  * @param  Len: Number of samples in the window, between 1 and STATS_MAX_WINDOW
+  * @retval true if the window was changed, false if Len is out of range
+  */
+bool Current_Stats_Set_Window(uint8_t Len)
+{
+    if((Len == 0) || (Len > STATS_MAX_WINDOW))
+    {
+        return false;
+    }
+
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    Window_Len = Len;
+    Reset_Channels();
+    __set_PRIMASK(Primask);
+
+    return true;
+}
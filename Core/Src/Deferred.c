@@ -0,0 +1,70 @@
+/**
+  @file Deferred.c
+  @brief Runs work handed on by interrupts at PendSV level, so it never delays the time critical interrupts.
+  @details An interrupt that has slow work to do (executing a command, running the FFT) posts it with Deferred_Post() and
+           returns. This pends PendSV, the lowest priority exception, which runs the work as soon as no other interrupt is active.
+           Unlike the main loop it does not wait for a scheduler pass or a wake from WFI, and it still runs if the main loop is
+           busy, eg writing flash.
+
+           Interrupt priorities (Cortex-M0, 0 is the highest of 4), set in STM32CubeMX:
+           0 - ADC1, TIM3   Current samples and the PWM timer. Nothing can delay them except other level 0 work and critical sections.
+           1 - TIM17        Timebase and the application tick (failsafe, thermal model, suspend ramp, RX timeouts).
+                            Preempts the USB, so a burst of USB traffic can't delay the control loop.
+           2 - USB, SysTick USB packets and framing received bytes into commands. The HAL ms tick is here, above PendSV, so a long
+                            FFT does not lose ticks.
+           3 - PendSV       Command execution and replies, the speed estimate FFT, and starting a firmware update.
+                            Preempted by everything above.
+           The main loop (LED, flash writes, reboot) runs below all of them.
+           With TICK_FROM_SOF the application tick runs from the USB start of frame, so at level 2, while the host is sending frames.
+
+           The application tick jitter (how late the tick interrupt is) is measured by Timebase_Interrupt() and reported in the
+           'T' reply, so the effect of these priorities can be checked on the hardware.
+
+           How to use:
+           1. Make a table of Deferred_Task.
+           2. Call Deferred_Run() with the table from PendSV_Handler().
+           3. Call Deferred_Post() from any interrupt with work for a task.
+ */
+
+#include "Deferred.h"
+#include "main.h"
+
+volatile uint32_t Deferred_Pending = 0;     /// DEFER_WORK bits posted since PendSV last ran
+
+/**
+  * @brief  Hand work on to be run at PendSV level. Safe to call from any interrupt or the main loop
+  * @param  Work: The DEFER_WORK to run
+  * @retval None
+  */
+void Deferred_Post(DEFER_WORK Work)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    Deferred_Pending |= Work;
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Run every task that has work posted. Call this from PendSV_Handler().
+  *         Work posted while the tasks are running pends PendSV again, so it is run straight after.
+  * @param  Tasks: The task table
+  * @param  Num_Tasks: Number of tasks in the table
+  * @retval None
+  */
+void Deferred_Run(const Deferred_Task *Tasks, uint8_t Num_Tasks)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t Work = Deferred_Pending;
+    Deferred_Pending = 0;
+    __set_PRIMASK(Primask);
+
+    for(uint8_t t = 0; t < Num_Tasks; t++)
+    {
+        if(Work & Tasks[t].Work)
+        {
+            Tasks[t].Run();
+        }
+    }
+}
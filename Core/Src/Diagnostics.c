@@ -0,0 +1,88 @@
+/**
+  @file Diagnostics.c
+  @brief Counters for the USB and protocol health, so a misbehaving rig can show where bytes and frames are being lost.
+  @details Each point that can drop or reject data counts it in Diag_Counters[] with DIAGNOSTICS_INC() or DIAGNOSTICS_ADD().
+           These are a single increment of a global so they cost next to nothing on the hot paths in the USB and timer interrupts.
+
+           The counters are 32 bits and wrap. The host should work with the difference between two reads.
+
+           The boot record keeps the time since reset that each step of the USB connection was first reached, so the host can
+           see how long the device took to be usable after a reset or a watchdog reboot.
+           The times come from the HAL tick, which starts at reset, so they are in ms with 1 ms resolution.
+
+           How to use:
+           1. Add a DIAG_COUNTER entry for a new counter and count it with DIAGNOSTICS_INC() where the event happens.
+           2. Call Diagnostics_Snapshot() to read every counter at the same instant, then Diagnostics_Clear() with the snapshot to
+              clear the counters that were reported.
+           3. Call Diagnostics_Boot_Milestone() at each step of the boot, and Diagnostics_Get_Boot() to read the record.
+
+           No initialise function is needed, the counters and the boot record start at zero from the C start up zeroing.
+ */
+
+#include "Diagnostics.h"
+#include "main.h"
+
+volatile uint32_t Diag_Counters[NUM_DIAG_COUNTERS];        /// The health counters, indexed by DIAG_COUNTER
+volatile uint32_t Boot_Milestone_ms[NUM_BOOT_MILESTONES];  /// Time each boot milestone was first reached, indexed by BOOT_MILESTONE
+
+/**
+  * @brief  Read all of the counters at the same instant
+  * @param  Counters: Filled with the value of each counter, indexed by DIAG_COUNTER
+  * @retval None
+  */
+void Diagnostics_Snapshot(uint32_t Counters[NUM_DIAG_COUNTERS])
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    for(uint8_t c = 0; c < NUM_DIAG_COUNTERS; c++)
+    {
+        Counters[c] = Diag_Counters[c];
+    }
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Clear counters that have been reported. The snapshot values are taken off, rather than the counters zeroed, so
+  *         events counted since the snapshot are kept for the next read
+  * @param  Counters: The snapshot that was reported, from Diagnostics_Snapshot()
+  * @param  First: The first counter to clear
+  * @param  Num: Number of counters to clear from First. Counters outside this range are left alone
+  * @retval None
+  */
+void Diagnostics_Clear(const uint32_t Counters[NUM_DIAG_COUNTERS], uint8_t First, uint8_t Num)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    for(uint8_t c = First; (c < NUM_DIAG_COUNTERS) && (c < First + Num); c++)
+    {
+        Diag_Counters[c] -= Counters[c];
+    }
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Record that a step of the boot has been reached. Only the first time is kept, so a later re-enumeration does not overwrite it
+  * @param  Milestone: The step reached
+  * @retval None
+  */
+void Diagnostics_Boot_Milestone(BOOT_MILESTONE Milestone)
+{
+    if(Boot_Milestone_ms[Milestone] == 0)
+    {
+        uint32_t Now = HAL_GetTick();
+        Boot_Milestone_ms[Milestone] = (Now != 0) ? Now : 1;    // 0 means not reached
+    }
+}
+
+/**
+  * @brief  Read the boot record
+  * @param  Milestone_ms: Filled with the time since reset each milestone was reached, indexed by BOOT_MILESTONE. 0 if not reached yet
+  * @retval None
+  */
+void Diagnostics_Get_Boot(uint32_t Milestone_ms[NUM_BOOT_MILESTONES])
+{
+    for(uint8_t m = 0; m < NUM_BOOT_MILESTONES; m++)
+    {
+        Milestone_ms[m] = Boot_Milestone_ms[m];
+    }
+}
@@ -0,0 +1,179 @@
+/**
+  @file Failsafe.c
+  @brief Stops the motor if the host application stops talking to us, eg it has crashed or the cable has been pulled.
+  @details Comms_RX only drops partially received packets, so without this the outputs stay at the last values the host set
+           for as long as the board is powered.
+
+           Every valid command (one that is acknowledged) restarts the timeout. If no valid command arrives for
+           Timeout_ms, the failsafe trips:
+           - Ramp down: each tick PWM_L and PWM_R are reduced by FAILSAFE_RAMP_STEP_PERCENT, so the motor is not stopped dead.
+           - Safe state: once both are off the half bridges are left as set by the mode. FAILSAFE_COAST turns ENA_L and
+             ENA_R off so the motor freewheels. FAILSAFE_BRAKE turns them fully on, with both low sides on the motor is
+             shorted and brakes.
+           This all runs in the application tick, so it still happens if the main loop or the USB stack has stopped.
+
+           A trip is latched, so that when the host reconnects it can tell its outputs were stopped. The host reads and
+           clears it with the 'W' command. The next valid command re-arms the failsafe, but leaves the outputs as they are
+           until the host sets them again.
+
+           The failsafe does nothing until the first valid command after power on, so a board that has never been talked
+           to does not report a trip. A timeout of 0 disables it.
+
+           How to use:
+           1. Call Failsafe_Initialise() during system initialisation.
+           2. Call Failsafe_Command_Received() each time a command has been executed successfully.
+           3. Call Failsafe_Timer_Interrupt() from the periodic application tick.
+           4. Call Failsafe_Get_Status() to read and clear the latched trip.
+ */
+
+#include "Failsafe.h"
+#include "IO.h"
+#include "main.h"
+#include "Timebase.h"
+#include "Trace.h"
+
+volatile FAILSAFE_STATE Failsafe_State = FAILSAFE_IDLE;     /// Current state
+volatile uint16_t Failsafe_Timeout_ms = FAILSAFE_TIMEOUT_MS; /// Time without a valid command before tripping. 0 = disabled
+volatile FAILSAFE_MODE_TYPE Failsafe_Mode = FAILSAFE_MODE;  /// Safe state the outputs are ramped to
+volatile uint32_t Failsafe_Deadline_ms = 0;                 /// When to trip, see Timebase_Deadline_ms()
+volatile uint32_t Failsafe_Trips = 0;                       /// Number of times tripped since power on
+volatile bool Failsafe_Latched = false;                     /// true if tripped since the host last cleared it
+
+/**
+  * @brief  Start the failsafe with the power on timeout and mode. Call this once during power-on init.
+  * @retval None
+  */
+void Failsafe_Initialise(void)
+{
+    Failsafe_State = FAILSAFE_IDLE;
+    Failsafe_Timeout_ms = FAILSAFE_TIMEOUT_MS;
+    Failsafe_Mode = FAILSAFE_MODE;
+    Failsafe_Trips = 0;
+    Failsafe_Latched = false;
+}
+
+/**
+  * @brief  The host is alive. Restart the timeout, and stop any ramp down. Call this after each command that was acknowledged.
+  * @retval None
+  */
+void Failsafe_Command_Received(void)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    if(Failsafe_Timeout_ms > 0)
+    {
+        Failsafe_Deadline_ms = Timebase_Deadline_ms(Failsafe_Timeout_ms);
+        Failsafe_State = FAILSAFE_ARMED;
+    }
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Set the time without a valid command before tripping. Takes effect from the next valid command.
+  * @param  Timeout_ms: The timeout, up to FAILSAFE_MAX_TIMEOUT_MS. 0 disables the failsafe
+  * @retval true if set, false if the timeout is too long
+  */
+bool Failsafe_Set_Timeout(uint32_t Timeout_ms)
+{
+    if(Timeout_ms > FAILSAFE_MAX_TIMEOUT_MS)
+    {
+        return false;
+    }
+
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    Failsafe_Timeout_ms = Timeout_ms;
+    if(Timeout_ms == 0)
+    {
+        Failsafe_State = FAILSAFE_IDLE;
+    }
+    __set_PRIMASK(Primask);
+    return true;
+}
+
+/**
+  * @brief  Set the safe state the outputs are ramped to. Takes effect from the next trip.
+  * @param  Mode: FAILSAFE_COAST or FAILSAFE_BRAKE
+  * @retval true if set, false if the mode is not valid
+  */
+bool Failsafe_Set_Mode(FAILSAFE_MODE_TYPE Mode)
+{
+    if(Mode >= NUM_FAILSAFE_MODES)
+    {
+        return false;
+    }
+    Failsafe_Mode = Mode;
+    return true;
+}
+
+/**
+  * @brief  Read the failsafe, and optionally clear the latched trip. Reading and clearing together means a trip can't be
+  *         missed between the two.
+  * @param  Status: Filled with a consistent snapshot, Latched is as it was before any clear
+  * @param  Clear: true to clear the latched trip
+  * @retval None
+  */
+void Failsafe_Get_Status(Failsafe_Status_Type *Status, bool Clear)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    Status->Timeout_ms = Failsafe_Timeout_ms;
+    Status->Mode = Failsafe_Mode;
+    Status->State = Failsafe_State;
+    Status->Trips = Failsafe_Trips;
+    Status->Latched = Failsafe_Latched;
+    if(Clear)
+    {
+        Failsafe_Latched = false;
+    }
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Periodic processing. Call this from the application tick.
+  *         Trips once the timeout has passed, then ramps PWM_L and PWM_R down one step and sets the safe state once they are off.
+  * @retval None
+  */
+void Failsafe_Timer_Interrupt(void)
+{
+    if(Failsafe_State == FAILSAFE_ARMED)
+    {
+        if(!Timebase_Expired_ms(Failsafe_Deadline_ms))
+        {
+            return;
+        }
+        Failsafe_Trips++;
+        Failsafe_Latched = true;
+        Failsafe_State = FAILSAFE_RAMP_DOWN;
+        TRACE(TRACE_FAILSAFE, Failsafe_Mode);
+    }
+
+    if(Failsafe_State != FAILSAFE_RAMP_DOWN)
+    {
+        return;
+    }
+
+    bool All_Off = true;
+    for(uint8_t pwm = PWM_L; pwm <= PWM_R; pwm++)
+    {
+        uint8_t Percent = IO_Get_PWM_Requested((PWM_PIN)pwm);
+        if(Percent > FAILSAFE_RAMP_STEP_PERCENT)
+        {
+            Percent -= FAILSAFE_RAMP_STEP_PERCENT;
+            All_Off = false;
+        }
+        else
+        {
+            Percent = 0;
+        }
+        IO_Set_PWM_Percent(Percent, (PWM_PIN)pwm);
+    }
+
+    if(All_Off)
+    {
+        uint8_t Enable = (Failsafe_Mode == FAILSAFE_BRAKE) ? 100 : 0;
+        IO_Set_PWM_Percent(Enable, ENA_L);
+        IO_Set_PWM_Percent(Enable, ENA_R);
+        Failsafe_State = FAILSAFE_SAFE;
+    }
+}
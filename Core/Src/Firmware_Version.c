@@ -18,7 +18,14 @@
 
 #define FW_VERSION PROJ_NAME "v" PROJ_VERSION
 
+/* Short git commit hash the image was built from, passed in by the makefile. Ends in -dirty if there were uncommitted
+   changes */
+#ifndef BUILD_HASH
+#define BUILD_HASH "unknown"
+#endif
+
 const char FW_Ver[] = FW_VERSION;
+const char FW_Build_Hash[] = BUILD_HASH;
 
 /**
   * @brief  Read and return the current firmware version string.  
@@ -30,4 +37,15 @@ const char *Firmware_Version_Get(void)
 {
     return FW_Ver;
 
-}
\ No newline at end of file
+}
+
+/**
+  * @brief  Read the git commit hash the firmware was built from.  
+  *
+  * @param  none
+  * @retval null terminated string of the hash, "unknown" if it wasn't built from a git tree 
+  */
+const char *Firmware_Version_Get_Build_Hash(void)
+{
+    return FW_Build_Hash;
+}
@@ -9,6 +9,10 @@
 #include <IO.h>
 #include <stdbool.h>
 #include "main.h"
+#include "stm32f0xx_ll_adc.h"
+#include "MCU_7960_USB.h"
+#include "Timebase.h"
+#include "Trace.h"
 
 /**
   @brief  Definition of the digital IO Pins. These only have a basic on or off state, without any additional features.
@@ -56,6 +60,37 @@ const PWM_Pin_Type PWM_Pins[NUM_PWM_PINS] = {
 	{&htim3,  TIM_CHANNEL_4}
 };
 
+extern ADC_HandleTypeDef hadc;		/// ADC converts the motor current sense pins. This is set up in STM32CubeMX
+extern TIM_HandleTypeDef htim1;		/// tim1 update event triggers each ADC sequence at ADC_SAMPLE_RATE_HZ. This is set up in STM32CubeMX
+
+#define ADC_VREFINT_IDX NUM_ADC_PINS			/// Index of the internal reference in ADC_Values[], after the ADC pins
+#define NUM_ADC_CHANNELS (NUM_ADC_PINS + 1)		/// ADC pins plus the internal reference
+#define VREFINT_FILTER_SHIFT 4					/// VREFINT is averaged over approx 2^VREFINT_FILTER_SHIFT samples
+
+/**
+  @brief Index into ADC_Values[] for each conversion in the ADC scan sequence. The ADC scans from the lowest channel number upwards.
+         Make sure that the number of elements in the array matches NUM_ADC_CHANNELS.
+*/
+const uint8_t ADC_Sequence[NUM_ADC_CHANNELS] = {
+	ISENSE_R,			// ADC_IN0
+	ISENSE_L,			// ADC_IN1
+	ADC_VREFINT_IDX		// ADC_IN17, internal reference
+};
+
+volatile uint16_t ADC_Values[NUM_ADC_CHANNELS];		/// Latest raw conversion result of each ADC channel
+volatile uint32_t ADC_Timestamp_us = 0;				/// Timebase_Get_us() when the latest ADC sequence completed
+volatile uint32_t Vrefint_Filtered = 0;				/// VREFINT raw value averaged by a moving average filter, scaled by 2^VREFINT_FILTER_SHIFT
+volatile uint16_t VDDA_mV = VREFINT_CAL_VREF;		/// Latest measured analog supply voltage. This is the ADC full scale voltage
+volatile uint32_t Current_Scale_Q12 = 0;			/// mA per ADC count in Q12 fixed point, for the current VDDA
+
+/**
+  @brief PWM pins whose duty is limited by IO_Set_PWM_Limit(). These set the motor drive duty, the enable pins are left as requested. 
+*/
+const bool PWM_Is_Limited[NUM_PWM_PINS] = {false, false, true, true};
+
+volatile uint8_t PWM_Requested[NUM_PWM_PINS] = {0, 0, 0, 0};	/// Last percent requested for each PWM pin, before any limit is applied
+volatile uint8_t PWM_Limit_Percent = 100;						/// Maximum percent that can be applied to the PWM_Is_Limited[] pins
+
 /**
   * @brief  Set the output pin to logic high state. If pin is not in OUTPUT_PIN enum then no action is performed  
   * @param  pin: the pin to be set high
@@ -82,16 +117,36 @@ void IO_Set_OP_Low(OUTPUT_PIN pin)
 }
 
 /**
-  @brief  Not yet implemented
-  		  Initialise the ADC by performing calibration. 
-          This should be done at least once at power-on.
+  @brief  Recalculate the current scale factor from the latest VDDA measurement.
+          I_load = V_IS / ISENSE_R_OHMS * ISENSE_KILIS, V_IS = Raw * VDDA / 4095 
+          64 bit maths is only used here, and this is only called periodically, so the per sample conversion stays 32 bit.
   @param  none   
   @retval none
 */
-void ADC_Initialise(void)
+void Update_Current_Scale(void)
 {
+	uint32_t Vref = Vrefint_Filtered >> VREFINT_FILTER_SHIFT;
+	if(Vref > 0)
+	{	// VREFINT is a fixed voltage, so the lower it reads the higher VDDA is. VREFINT_CAL was measured at VDDA = VREFINT_CAL_VREF
+		VDDA_mV = ((uint32_t)*VREFINT_CAL_ADDR * VREFINT_CAL_VREF) / Vref;
+	}
+	Current_Scale_Q12 = (((uint64_t)VDDA_mV * ISENSE_KILIS) << 12) / (4095UL * ISENSE_R_OHMS);
+}
 
-
+/**
+  @brief  Initialise the ADC by performing calibration, then start the conversions.
+          This should be done at least once at power-on, before the ADC is enabled.
+  @param  none   
+  @retval none
+*/
+void ADC_Initialise(void)
+{
+	if(HAL_ADCEx_Calibration_Start(&hadc) != HAL_OK)
+	{
+		Error_Handler();
+	}
+	Update_Current_Scale();		// use the nominal VDDA until VREFINT has been measured
+	HAL_ADC_Start_IT(&hadc);	// start the sequence conversions, each sequence is triggered by tim1
 }
 
 /**
@@ -103,21 +158,19 @@ void ADC_Initialise(void)
 void IO_Initialise(void)
 {
 	ADC_Initialise();
-
+	HAL_TIM_Base_Start(&htim1);		// start triggering the ADC sequence conversions
 
 }
 
 /**
-  * @brief  Set the output pin pwm percent to the value specified. If pin is not in PWM_PIN enum then no action is performed.
+  * @brief  Apply the pwm percent to the output pin timer. If pin is not in PWM_PIN enum then no action is performed.
   *         Any Value greater than 100 is set to 100%.
   *         PWM pins are controlled by the timer blocks (configured in PWM mode) attached to the physical pins. 
   * @param  Value_Percent: A whole value between 0 and 100 (inclusive). 
-  *                        0% is equivalent to the the output being off (always low) 
-  *                        100% is equivalent to the the output being on (always high) 
   * @param  pwm: the pwm capable pin to apply the signal to.   
   * @retval none
   */
-void IO_Set_PWM_Percent(uint8_t Value_Percent, PWM_PIN pwm)
+static void Apply_PWM_Percent(uint8_t Value_Percent, PWM_PIN pwm)
 {
 	static bool Already_Initialised[NUM_PWM_PINS] = {false, false, false, false};
 
@@ -146,15 +199,14 @@ void IO_Set_PWM_Percent(uint8_t Value_Percent, PWM_PIN pwm)
 
 		This_Timer = PWM_Pins[pwm].Timer;
 		Timer_Channel = PWM_Pins[pwm].Channel;
+		TRACE(TRACE_PWM_ENA_L + pwm, Value_Percent);
 
-		float Reg_Val = This_Timer->Instance->ARR+1;
-		Reg_Val *= Value_Percent;
-		Reg_Val /= 100;
+		uint32_t Reg_Val = ((This_Timer->Instance->ARR + 1) * Value_Percent) / 100;
 
 		if(Already_Initialised[pwm] == false)
 		{
 			HAL_TIM_PWM_Stop(This_Timer, Timer_Channel);
-			sConfigOC.Pulse = (uint32_t)Reg_Val;
+			sConfigOC.Pulse = Reg_Val;
 			if (HAL_TIM_PWM_ConfigChannel(This_Timer, &sConfigOC, Timer_Channel) != HAL_OK)
 			{
 				Error_Handler();
@@ -170,6 +222,64 @@ void IO_Set_PWM_Percent(uint8_t Value_Percent, PWM_PIN pwm)
 	}
 }
 
+/**
+  * @brief  Set the output pin pwm percent to the value specified. If pin is not in PWM_PIN enum then no action is performed.
+  *         Any Value greater than 100 is set to 100%.
+  *         The value is remembered, and if the pin is limited by IO_Set_PWM_Limit() the lower of the value and the limit is applied.
+  *         Safe to call from any interrupt. Commands set the outputs at PendSV level while the tick can also be changing them.
+  * @param  Value_Percent: A whole value between 0 and 100 (inclusive). 
+  *                        0% is equivalent to the the output being off (always low) 
+  *                        100% is equivalent to the the output being on (always high) 
+  * @param  pwm: the pwm capable pin to apply the signal to.   
+  * @retval none
+  */
+void IO_Set_PWM_Percent(uint8_t Value_Percent, PWM_PIN pwm)
+{
+	if(pwm < NUM_PWM_PINS)
+	{
+		uint32_t Primask = __get_PRIMASK();
+		__disable_irq();	// keep the request, the limit and the timer in step
+		PWM_Requested[pwm] = Value_Percent;
+		if(PWM_Is_Limited[pwm] && (Value_Percent > PWM_Limit_Percent))
+		{
+			Value_Percent = PWM_Limit_Percent;
+		}
+		Apply_PWM_Percent(Value_Percent, pwm);
+		__set_PRIMASK(Primask);
+	}
+}
+
+/**
+  * @brief  Limit the duty of the motor drive PWM pins (PWM_L and PWM_R), eg for thermal derating. 
+  *         The outputs are updated straight away, and are restored to the requested values when the limit is raised again.
+  * @param  Limit_Percent: Maximum duty allowed, 0 to 100. 0 holds the motor drive off, 100 removes the limit.
+  * @retval none
+  */
+void IO_Set_PWM_Limit(uint8_t Limit_Percent)
+{
+	if(Limit_Percent > 100)
+	{
+		Limit_Percent = 100;
+	}
+	uint32_t Primask = __get_PRIMASK();
+	__disable_irq();	// keep the request, the limit and the timer in step
+	PWM_Limit_Percent = Limit_Percent;
+
+	for(uint8_t pwm = 0; pwm < NUM_PWM_PINS; pwm++)
+	{
+		if(PWM_Is_Limited[pwm])
+		{
+			uint8_t Value_Percent = PWM_Requested[pwm];
+			if(Value_Percent > Limit_Percent)
+			{
+				Value_Percent = Limit_Percent;
+			}
+			Apply_PWM_Percent(Value_Percent, (PWM_PIN)pwm);
+		}
+	}
+	__set_PRIMASK(Primask);
+}
+
 /**
   * @brief  Get the current pwm percent being applied to the specified pin. If pin is not in PWM_PIN enum then no action is performed and 0 is returned.
   *         PWM value is calculated by reading the current timer pulse value and ARR value, and calculating the duty from these.
@@ -189,7 +299,7 @@ uint8_t IO_Get_PWM_Percent(PWM_PIN pwm)
 		uint32_t Compare = __HAL_TIM_GET_COMPARE(This_Timer, Timer_Channel);
 		uint32_t ARR = __HAL_TIM_GET_AUTORELOAD(This_Timer);
 
-		return (uint8_t)(( ((float)Compare)/ARR) * 100);		
+		return (uint8_t)((Compare * 100) / ARR);
 	}
 
 	return 0;
@@ -197,12 +307,116 @@ uint8_t IO_Get_PWM_Percent(PWM_PIN pwm)
 }
 
 /**
-  * @brief  Not yet implemented
-  * 		Get the current ADC value of the specified pin. 
+  * @brief  Get the pwm percent last requested for the specified pin, before any limit from IO_Set_PWM_Limit() is applied.
+  * @param  pwm: the pwm pin to read. Any pin outside of the PWM_PIN enum will return 0
+  * @retval A value between 0 and 100 (inclusive)
+  */
+uint8_t IO_Get_PWM_Requested(PWM_PIN pwm)
+{
+	if(pwm < NUM_PWM_PINS)
+	{
+		return PWM_Requested[pwm];
+	}
+	return 0;
+}
+
+/**
+  * @brief  Get the latest ADC value of the specified pin. 
   * @param  pin: the ADC_PIN to read. Any pin outside of the ADC_PIN enum will return 0  
-  * @retval none
+  * @retval Raw 12 bit ADC value
   */
 uint16_t IO_Get_ADC(ADC_PIN pin)
 {
+	if(pin < NUM_ADC_PINS)
+	{
+		return ADC_Values[pin];
+	}
+
 	return 0;
 }
+
+/**
+  * @brief  Get the time that the latest ADC values were converted. 
+  *         This is taken at the end of the sequence, so lags the TIM1 trigger by the conversion time (approx 15us)
+  * @retval Timestamp in us, from Timebase_Get_us()
+  */
+uint32_t IO_Get_ADC_Timestamp_us(void)
+{
+	return ADC_Timestamp_us;
+}
+
+/**
+  * @brief  Convert a raw IS ADC value into the motor load current, using integer maths only.
+  * @param  Raw: Raw 12 bit ADC value of an IS pin, or any statistic (mean/peak etc) of the raw values
+  * @retval Load current in mA
+  */
+uint32_t IO_ADC_To_mA(uint16_t Raw)
+{
+	return ((uint32_t)Raw * Current_Scale_Q12) >> 12;
+}
+
+/**
+  * @brief  Get the latest motor load current measured by the specified pin. 
+  * @param  pin: the ADC_PIN to read. Any pin outside of the ADC_PIN enum will return 0  
+  * @retval Load current in mA, limited to 65535
+  */
+uint16_t IO_Get_Current_mA(ADC_PIN pin)
+{
+	uint32_t mA = IO_ADC_To_mA(IO_Get_ADC(pin));
+	if(mA > UINT16_MAX)
+	{
+		mA = UINT16_MAX;
+	}
+	return (uint16_t)mA;
+}
+
+/**
+  * @brief  Get the analog supply voltage, as measured from VREFINT. 
+  * @retval VDDA in mV
+  */
+uint16_t IO_Get_VDDA_mV(void)
+{
+	return VDDA_mV;
+}
+
+/**
+  * @brief  Main loop processing. Call this periodically from the main loop. 
+  *         Corrects the current scaling for any drift in the supply voltage.
+  * @retval none
+  */
+void IO_Main(void)
+{
+	Update_Current_Scale();
+}
+
+/**
+  * @brief  ADC end of conversion callback, called by the HAL from the ADC interrupt once for each pin in the sequence.
+  *         Saves the result, and once the whole sequence has been converted passes control to MCU_7960_USB_ADC_Interrupt()
+  * @param  Adc_Handle: the ADC that has completed a conversion
+  * @retval none
+  */
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *Adc_Handle)
+{
+	static uint8_t Sequence_Idx = 0;
+
+	uint16_t Value = HAL_ADC_GetValue(Adc_Handle);
+	if(Sequence_Idx < NUM_ADC_CHANNELS)
+	{
+		ADC_Values[ADC_Sequence[Sequence_Idx++]] = Value;
+	}
+
+	if(__HAL_ADC_GET_FLAG(Adc_Handle, ADC_FLAG_EOS))
+	{	// end of sequence, all pins have a new value
+		ADC_Timestamp_us = Timebase_Get_us();
+		Sequence_Idx = 0;
+		if(Vrefint_Filtered == 0)
+		{	// first sample, preload the filter
+			Vrefint_Filtered = (uint32_t)ADC_Values[ADC_VREFINT_IDX] << VREFINT_FILTER_SHIFT;
+		}
+		else
+		{
+			Vrefint_Filtered += ADC_Values[ADC_VREFINT_IDX] - (Vrefint_Filtered >> VREFINT_FILTER_SHIFT);
+		}
+		MCU_7960_USB_ADC_Interrupt();
+	}
+}
@@ -0,0 +1,112 @@
+/**
+  @file Identity.c
+  @brief Identifies each unit, so a host with several boards plugged in can tell which is which.
+  @details Three parts make up the identity:
+           - The 96 bit unique ID programmed by ST. Reported as 24 hex chars, the three UID words in address order. The USB
+             serial number string is the same text, so the host can match ports to units from the USB descriptors alone.
+           - A name the host sets, such as where the board is fitted. It is kept in the settings store (CONFIG_NAME, see Config.c)
+             so it survives power cycles and firmware updates. Up to IDENTITY_NAME_LEN printable chars, but not the packet framing
+             chars or a comma, so it can be sent back in a comma separated reply.
+           - A bitmap of the IDENTITY_CAP features built into this firmware.
+
+           How to use:
+           1. Call Identity_Initialise() once at start up, before Config_Initialise() restores the stored name.
+           2. Call Identity_Set_Name() to change the name, then Config_Commit() to store it, and the Identity_Get_...() functions
+              to read the identity.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Identity.h"
+#include "main.h"
+#include "MCU_7960_USB.h"
+#include "Profile.h"
+#include "Trace.h"
+#include "usbd_conf.h"
+
+char Identity_Name[IDENTITY_NAME_LEN+1];    /// The current name, null terminated
+
+/**
+  * @brief  Start with no name. Config_Initialise() sets the stored name, if there is one
+  *
+  * @param  None
+  * @retval None
+  */
+void Identity_Initialise(void)
+{
+    memset(Identity_Name, 0, sizeof(Identity_Name));
+}
+
+/**
+  * @brief  Set a new name. It is used straight away, call Config_Commit() to store it
+  *
+  * @param  Name: The new name, not null terminated
+  * @param  Len: Chars in the name. 0 clears the name
+  * @retval true if the name was accepted, false if it is too long or has a char that isn't allowed
+  */
+bool Identity_Set_Name(const uint8_t *Name, uint8_t Len)
+{
+    if(Len > IDENTITY_NAME_LEN)
+    {
+        return false;
+    }
+    for(uint8_t c = 0; c < Len; c++)
+    {
+        if((Name[c] < ' ') || (Name[c] > '~') || (Name[c] == ',') || (Name[c] == '{') || (Name[c] == '}'))
+        {
+            return false;
+        }
+    }
+
+    memset(Identity_Name, 0, sizeof(Identity_Name));
+    memcpy(Identity_Name, Name, Len);
+    return true;
+}
+
+/**
+  * @brief  The name the host set
+  *
+  * @param  None
+  * @retval The name, null terminated. Empty if none has been set
+  */
+const char *Identity_Get_Name(void)
+{
+    return Identity_Name;
+}
+
+/**
+  * @brief  The 96 bit unique ID as text. The same as the USB serial number string
+  *
+  * @param  Str: Where to put the 24 hex chars and a null terminator
+  * @retval None
+  */
+void Identity_Get_UID_Hex(char Str[IDENTITY_UID_HEX_LEN+1])
+{
+    const uint32_t *UID = (const uint32_t *)UID_BASE;
+    sprintf(Str, "%08lX%08lX%08lX", (unsigned long)UID[0], (unsigned long)UID[1], (unsigned long)UID[2]);
+}
+
+/**
+  * @brief  The features built into this firmware
+  *
+  * @param  None
+  * @retval Bitmap of IDENTITY_CAP bits
+  */
+uint32_t Identity_Get_Capabilities(void)
+{
+    uint32_t Caps = IDENTITY_CAP_CURRENT_STATS | IDENTITY_CAP_SPEED_ESTIMATE | IDENTITY_CAP_THERMAL | IDENTITY_CAP_SUSPEND_STOP;
+#if (USB_INTERFACE_HID == 1)
+    Caps |= IDENTITY_CAP_HID;
+#endif
+#if (TICK_FROM_SOF == 1)
+    Caps |= IDENTITY_CAP_TICK_FROM_SOF;
+#endif
+#if (PROFILE_ENABLE == 1)
+    Caps |= IDENTITY_CAP_PROFILE;
+#endif
+#if (TRACE_ENABLE == 1)
+    Caps |= IDENTITY_CAP_TRACE;
+#endif
+    return Caps;
+}
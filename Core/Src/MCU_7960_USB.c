@@ -4,12 +4,24 @@
         This allows for cleaner seperation from the CubeMX code and may be easier to manage.
   
 */
-#include "Clock.h"
 #include "Comms_Controller.h"
+#include "Config.h"
+#include "Current_Stats.h"
+#include "Deferred.h"
+#include "Failsafe.h"
+#include "Identity.h"
 #include "IO.h"
 #include "LED.h"
 #include "main.h"
+#include "Power.h"
+#include "Profile.h"
 #include "Reboot.h"
+#include "Scheduler.h"
+#include "Speed_Estimate.h"
+#include "Thermal.h"
+#include "Timebase.h"
+#include "Trace.h"
+#include "Update.h"
 #include "MCU_7960_USB.h"
 
 
@@ -20,30 +32,127 @@
 */
 void MCU_7960_USB_Initialise(void)
 {
-    Clock_Calc_Timer_ms();
+    Reboot_Initialise();
+#if (TRACE_ENABLE == 1)
+    Trace_Initialise();
+#endif
+#if (PROFILE_ENABLE == 1)
+    Profile_Initialise();
+#endif
+    Timebase_Initialise();
+    Current_Stats_Initialise();
+    Thermal_Initialise();
+    Failsafe_Initialise();
+    Identity_Initialise();
+    Config_Initialise();        // after the modules with settings, so the stored values replace their defaults
     IO_Initialise();
     Comms_Controller_Initialise();
 }
 
+/**
+ @brief The main loop tasks, see Scheduler.c. Event tasks run as soon as the interrupt that has work for them sets the event.
+*/
+Scheduler_Task Main_Tasks[] = {
+    {LED_Toggle, 0, 250, 0},                                // heartbeat
+    {IO_Main, 0, 250, 0},                                   // follow supply voltage drift
+    {Reboot_Main, SCHED_EVENT_REBOOT, 0, 0},
+    {Config_Main, SCHED_EVENT_CONFIG, 0, 0},
+};
+
+/**
+ @brief The deferred tasks, see Deferred.c. Run at PendSV level as soon as an interrupt posts work for them.
+*/
+const Deferred_Task Deferred_Tasks[] = {
+    {Comms_Controller_Deferred, DEFER_COMMAND},
+    {Speed_Estimate_Deferred, DEFER_SPEED_WINDOW},
+    {Update_Deferred, DEFER_UPDATE},
+};
+
 /**
  @brief The main application loop.
         Call this from within the main() loop created by CubeMX.This will get executed every loop of main()
+        Runs the tasks that have work to do, then sleeps until the next interrupt.
  
 */
 void MCU_7960_USB_Main(void)
 {
-    LED_Toggle();
-    Reboot_Main();
-    HAL_Delay(250);
+    Scheduler_Run(Main_Tasks, sizeof(Main_Tasks)/sizeof(Main_Tasks[0]));
+}
+
+/**
+ @brief Deferred work interrupt.
+        Call this from PendSV_Handler(). Runs the work that the other interrupts have posted with Deferred_Post().
+*/
+void MCU_7960_USB_Deferred_Interrupt(void)
+{
+    Deferred_Run(Deferred_Tasks, sizeof(Deferred_Tasks)/sizeof(Deferred_Tasks[0]));
+}
+
+#if (TICK_FROM_SOF == 1)
+volatile uint8_t Ticks_Since_SOF = SOF_LOST_TICKS;    /// Timer intervals since the last USB start of frame
+#endif
+
+/**
+ @brief Periodic application processing, called once per tick from either the timer or the USB start of frame.
+        Any functions that require periodic processing can be placed in this routine. 
+*/
+static void Application_Tick(void)
+{
+    PROFILE_BEGIN(PROBE_TICK);
+    TRACE(TRACE_TICK_ENTRY, 0);
+    Comms_Controller_Timer_Interrupt();
+    Thermal_Timer_Interrupt();
+    Power_Timer_Interrupt();
+    Failsafe_Timer_Interrupt();
+    Reboot_Timer_Interrupt();
+    Update_Timer_Interrupt();
+    TRACE(TRACE_TICK_EXIT, 0);
+    PROFILE_END(PROBE_TICK);
 }
 
 /**
  @brief Application general purpose timer interrupt.
-        Call this from a general timer. It should be the same timer interrupt that is referenced in Clock.c
-        Any functions that require periodic processing can be placed in this interrupt routine. 
-        The timer should already be started in the main initialisation (after MCU_7960_USB_Initialise() has finished). 
+        Call this each time Timebase_Interrupt() reports a tick, every TIMEBASE_TICK_US.
+        With TICK_FROM_SOF the tick is skipped while the USB start of frame is driving it. TIMEBASE_TICK_US must then be 1000 to match the USB frames. 
 */
 void MCU_7960_USB_Timer_Interrupt(void)
 {
-    Comms_Controller_Timer_Interrupt();
+#if (TICK_FROM_SOF == 1)
+    if(Ticks_Since_SOF < SOF_LOST_TICKS)
+    {
+        Ticks_Since_SOF++;
+        return;
+    }
+#endif
+    Application_Tick();
+}
+
+/**
+ @brief USB start of frame interrupt, every 1ms while the host is sending frames.
+        Call this from the PCD SOF callback.
+*/
+void MCU_7960_USB_SOF_Interrupt(void)
+{
+    Comms_Controller_SOF_Interrupt();
+#if (TICK_FROM_SOF == 1)
+    Ticks_Since_SOF = 0;
+    Application_Tick();
+#endif
+}
+
+/**
+ @brief Application ADC interrupt.
+        Called from the ADC interrupt each time the full ADC sequence has been converted (at ADC_SAMPLE_RATE_HZ). 
+        New values of all ADC pins are available from IO_Get_ADC().
+        Keep processing here short, anything heavier should be done from MCU_7960_USB_Main().
+*/
+void MCU_7960_USB_ADC_Interrupt(void)
+{
+    PROFILE_BEGIN(PROBE_ADC_ISR);
+    TRACE(TRACE_ADC_ISR_ENTRY, 0);
+    Current_Stats_Add_Sample(ISENSE_L, IO_Get_ADC(ISENSE_L));
+    Current_Stats_Add_Sample(ISENSE_R, IO_Get_ADC(ISENSE_R));
+    Speed_Estimate_Add_Sample(IO_Get_ADC(ISENSE_L) + IO_Get_ADC(ISENSE_R));   // only one half bridge drives at a time, so the sum is the motor current
+    TRACE(TRACE_ADC_ISR_EXIT, 0);
+    PROFILE_END(PROBE_ADC_ISR);
 }
@@ -0,0 +1,177 @@
+/**
+  @file Power.c
+  @brief What to do with the motor outputs and the MCU while the USB host is suspended.
+  @details When the host suspends the bus (it sleeps, or stops sending frames) the outputs are ramped down to off, then the MCU
+           enters STOP mode so the device draws as little as possible from the bus. When the host resumes, the clocks and tick are
+           restored straight away in the USB wakeup interrupt and the outputs are put back.
+
+           - Ramp down: each tick every PWM pin is reduced by POWER_RAMP_STEP_PERCENT, so the motor is not stopped dead.
+             The values the host set are saved first so they can be restored.
+           - STOP: set up from the tick once every output is off. SLEEPONEXIT makes the core enter STOP as soon as the interrupt
+             returns, so the main loop does not need to know about it. In STOP the PLL, HSE, timers, ADC and USB clocks are gated.
+             Only the USB wakeup (EXTI line 18) can wake the MCU. Any other interrupt would go straight back to STOP on return.
+           - Resume: runs in the USB interrupt. The MCU wakes on the HSI, so the system clock is restored first, then the tick,
+             then the outputs. The time taken is measured with the microsecond timebase and kept for the host.
+             The timebase does not count while in STOP, and counts at HSI/48 until the system clock is restored, so that part
+             is scaled up to real microseconds.
+           A resume during the ramp down restores the outputs without going through STOP.
+
+           How to use:
+           1. Call Power_USB_Suspend() from the PCD suspend callback.
+           2. Call Power_USB_Resume() from the PCD resume callback, before the USB library is told about the resume.
+           3. Call Power_Timer_Interrupt() from the periodic application tick.
+           4. Call Power_Get_Status() to read the suspend/resume history.
+
+           No initialise function is needed, the module starts in POWER_RUN from the C start up zeroing.
+ */
+
+#include <stdbool.h>
+
+#include "IO.h"
+#include "main.h"
+#include "Power.h"
+#include "Timebase.h"
+#include "Trace.h"
+
+extern void SystemClock_Config(void);
+
+volatile POWER_STATE Power_State = POWER_RUN;   /// Current power state
+uint8_t Saved_PWM[NUM_PWM_PINS];                /// PWM percent the host had set when the suspend started
+uint32_t Power_Stops = 0;                       /// Number of times STOP mode has been entered
+uint32_t Last_Resume_us = 0;                    /// Time taken by the most recent resume from STOP
+uint32_t Max_Resume_us = 0;                     /// Longest resume from STOP
+
+/**
+  * @brief  Gate the clocks and enter STOP mode when the current interrupt returns. Call with every output off.
+  * @retval None
+  */
+static void Enter_Stop(void)
+{
+    Power_State = POWER_STOP;
+    Power_Stops++;
+
+    HAL_SuspendTick();
+    __HAL_RCC_PWR_CLK_ENABLE();
+    MODIFY_REG(PWR->CR, (PWR_CR_PDDS | PWR_CR_LPDS), PWR_LOWPOWERREGULATOR_ON);    // STOP rather than STANDBY, low power regulator
+    __HAL_USB_WAKEUP_EXTI_ENABLE_IT();                                              // the USB wakeup is the only way out of STOP
+    SCB->SCR |= (SCB_SCR_SLEEPDEEP_Msk | SCB_SCR_SLEEPONEXIT_Msk);
+}
+
+/**
+  * @brief  Put the outputs back to the values saved when the suspend started, or leave them off.
+  * @retval None
+  */
+static void Restore_Outputs(void)
+{
+    for(uint8_t pwm = 0; pwm < NUM_PWM_PINS; pwm++)
+    {
+#if (POWER_RESTORE_OUTPUTS == 1)
+        IO_Set_PWM_Percent(Saved_PWM[pwm], (PWM_PIN)pwm);
+#else
+        IO_Set_PWM_Percent(0, (PWM_PIN)pwm);
+#endif
+    }
+}
+
+/**
+  * @brief  The host has suspended the bus. Start ramping the outputs down. Call this from the PCD suspend callback.
+  * @retval None
+  */
+void Power_USB_Suspend(void)
+{
+    TRACE(TRACE_USB_SUSPEND, Power_State);
+    if(Power_State != POWER_RUN)
+    {
+        return;     // already suspending
+    }
+
+    for(uint8_t pwm = 0; pwm < NUM_PWM_PINS; pwm++)
+    {
+        Saved_PWM[pwm] = IO_Get_PWM_Requested((PWM_PIN)pwm);
+    }
+    Power_State = POWER_RAMP_DOWN;
+}
+
+/**
+  * @brief  The host has resumed the bus. Restore the clocks if we were in STOP, then the outputs.
+  *         Call this from the PCD resume callback, before the USB library handles the resume.
+  * @retval None
+  */
+void Power_USB_Resume(void)
+{
+    TRACE(TRACE_USB_RESUME, Power_State);
+    if(Power_State == POWER_STOP)
+    {
+        uint32_t Wake_us = Timebase_Get_us();
+        uint32_t Wake_Clock_Hz = HAL_RCC_GetSysClockFreq();    // HSI, the timebase is running slow until the clock is restored
+
+        SCB->SCR &= ~(SCB_SCR_SLEEPDEEP_Msk | SCB_SCR_SLEEPONEXIT_Msk);
+        SystemClock_Config();
+        uint32_t Clock_us = Timebase_Get_us();
+        HAL_ResumeTick();
+        Restore_Outputs();
+        Power_State = POWER_RUN;
+
+        // the time before the clock was restored was counted slow, scale it up by the clock ratio
+        Last_Resume_us = ((Clock_us - Wake_us) * (SystemCoreClock / Wake_Clock_Hz)) + (Timebase_Get_us() - Clock_us);
+        if(Last_Resume_us > Max_Resume_us)
+        {
+            Max_Resume_us = Last_Resume_us;
+        }
+    }
+    else if(Power_State == POWER_RAMP_DOWN)
+    {   // resumed before we got as far as STOP
+        Restore_Outputs();
+        Power_State = POWER_RUN;
+    }
+}
+
+/**
+  * @brief  Periodic processing. Call this from the application tick.
+  *         While suspending, ramp each output down one step, and enter STOP once they are all off.
+  * @retval None
+  */
+void Power_Timer_Interrupt(void)
+{
+    if(Power_State != POWER_RAMP_DOWN)
+    {
+        return;
+    }
+
+    bool All_Off = true;
+    for(uint8_t pwm = 0; pwm < NUM_PWM_PINS; pwm++)
+    {
+        uint8_t Percent = IO_Get_PWM_Requested((PWM_PIN)pwm);
+        if(Percent > POWER_RAMP_STEP_PERCENT)
+        {
+            Percent -= POWER_RAMP_STEP_PERCENT;
+            All_Off = false;
+        }
+        else
+        {
+            Percent = 0;
+        }
+        IO_Set_PWM_Percent(Percent, (PWM_PIN)pwm);
+    }
+
+    if(All_Off)
+    {
+        Enter_Stop();
+    }
+}
+
+/**
+  * @brief  Read the suspend/resume history
+  * @param  Status: Filled with a consistent snapshot of the history
+  * @retval None
+  */
+void Power_Get_Status(Power_Status_Type *Status)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    Status->State = Power_State;
+    Status->Stops = Power_Stops;
+    Status->Last_Resume_us = Last_Resume_us;
+    Status->Max_Resume_us = Max_Resume_us;
+    __set_PRIMASK(Primask);
+}
@@ -0,0 +1,130 @@
+/**
+  @file Profile.c
+  @brief Measures how many CPU cycles sections of code take, eg the command processing or an interrupt.
+  @details The Cortex-M0 has no DWT cycle counter, so cycles are counted with SysTick. It counts down from SysTick->LOAD
+           at the CPU clock, once per HAL tick (1ms), so the cycle count is the HAL ms tick times the reload plus how far
+           SysTick has counted down. The count is 32 bits and wraps every 89 seconds at 48MHz, which is fine for timing
+           sections up to 44 seconds long.
+
+           Each probe keeps the number of runs and the min, max and total cycles. The time taken by the markers themselves
+           is measured once at start up and taken off every run, so an empty section reads 0.
+
+           A probe that runs inside another (eg a byte received inside the USB interrupt) is included in the time of both.
+           Interrupts are included in the time of any section they interrupt.
+
+           Only built when PROFILE_ENABLE is 1, otherwise the markers are empty and none of this is compiled.
+
+           How to use:
+           1. Call Profile_Initialise() during system initialisation.
+           2. Put PROFILE_BEGIN(probe) at the start of the code to time and PROFILE_END(probe) at the end.
+           3. Call Profile_Get() to read the statistics for a probe and Profile_Reset() to start again.
+ */
+
+#include "main.h"
+#include "Profile.h"
+
+#if (PROFILE_ENABLE == 1)
+
+volatile Profile_Stats_Type Profile_Stats[NUM_PROBES];  /// Statistics for each probe, indexed by PROBE
+uint32_t Profile_Overhead = 0;                          /// Cycles taken by an empty PROFILE_BEGIN()/PROFILE_END() pair
+
+/**
+  * @brief  Read the cycle count. Safe to call from any interrupt or the main loop.
+  * @retval CPU cycles, wraps every 2^32 cycles
+  */
+uint32_t Profile_Cycles(void)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t Ms = uwTick;       // read directly rather than with HAL_GetTick(), to keep the markers short
+    uint32_t Val = SysTick->VAL;
+    if((SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) && (Val > (SysTick->LOAD / 2)))
+    {   // SysTick has wrapped but its interrupt has not run yet, eg we are in a higher or equal priority interrupt
+        Ms++;
+    }
+    __set_PRIMASK(Primask);
+
+    return (Ms * (SysTick->LOAD + 1)) + (SysTick->LOAD - Val);
+}
+
+/**
+  * @brief  Clear the statistics of every probe
+  * @retval None
+  */
+void Profile_Reset(void)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    for(uint8_t p = 0; p < NUM_PROBES; p++)
+    {
+        Profile_Stats[p].Count = 0;
+        Profile_Stats[p].Min = UINT32_MAX;
+        Profile_Stats[p].Max = 0;
+        Profile_Stats[p].Total = 0;
+    }
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Clear the statistics and measure the time taken by the markers. Call this once during power-on init.
+  * @retval None
+  */
+void Profile_Initialise(void)
+{
+    Profile_Overhead = 0;
+    uint32_t Min = UINT32_MAX;
+    for(uint8_t i = 0; i < 8; i++)
+    {   // the shortest of a few, in case an interrupt lands in one of them
+        uint32_t Start = Profile_Cycles();
+        uint32_t Cycles = Profile_Cycles() - Start;
+        if(Cycles < Min)
+        {
+            Min = Cycles;
+        }
+    }
+    Profile_Overhead = Min;
+    Profile_Reset();
+}
+
+/**
+  * @brief  Add a run to the statistics of a probe. Called by PROFILE_END()
+  * @param  Probe: The probe
+  * @param  Start: Profile_Cycles() at the start of the run
+  * @retval None
+  */
+void Profile_Record(PROBE Probe, uint32_t Start)
+{
+    uint32_t Cycles = Profile_Cycles() - Start;
+    Cycles = (Cycles > Profile_Overhead) ? Cycles - Profile_Overhead : 0;
+
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    volatile Profile_Stats_Type *Stats = &Profile_Stats[Probe];
+    Stats->Count++;
+    Stats->Total += Cycles;
+    if(Cycles < Stats->Min)
+    {
+        Stats->Min = Cycles;
+    }
+    if(Cycles > Stats->Max)
+    {
+        Stats->Max = Cycles;
+    }
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Read the statistics of a probe
+  * @param  Probe: The probe
+  * @param  Stats: Filled with a consistent snapshot of the statistics
+  * @retval None
+  */
+void Profile_Get(PROBE Probe, Profile_Stats_Type *Stats)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    *Stats = *(Profile_Stats_Type *)&Profile_Stats[Probe];
+    __set_PRIMASK(Primask);
+}
+
+#endif
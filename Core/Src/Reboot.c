@@ -1,26 +1,144 @@
 /**
  @file Reboot.c
- @brief Used to initiate a reboot of the MCU
-        Long term plan is to allow a reboot into DFU mode also - this is not yet implemented. 
+ @brief Used to initiate a reboot of the MCU, and to report why the last one happened
+        There are three ways to reboot:
+        - Normal: the window watchdog is started from the main loop and resets the MCU when it expires.
+        - Immediate: a software reset from the application tick REBOOT_DELAY_MS after the request, long enough for the reply to
+          the command to be sent. It does not depend on the main loop, so the time to reboot is bounded.
+        - DFU: as immediate, but a flag is left in .noinit RAM first. Straight after the reset, before the clocks and
+          peripherals are set up, Reboot_Start_Bootloader() sees it and jumps to ST's USB DFU bootloader in system memory.
+          The firmware can then be updated over USB without fitting the BOOT0 jumper. The bootloader runs until the next
+          power on or reset, or until the host tells it to start the new firmware.
+        The immediate and DFU resets wait, for up to REBOOT_MAX_DELAY_MS, for a pending settings commit to be written.
+
+        How to use:
+        1. Call Reboot_Start_Bootloader() first thing in main(), before HAL_Init().
+        2. Call Reboot_Initialise() once at start up to capture and clear the reset flags.
+        3. Call Reboot_Main() from the main loop when SCHED_EVENT_REBOOT is set, and Reboot_Timer_Interrupt() from the
+           application tick.
 */
 #include <stdbool.h>
 
+#include "Config.h"
 #include "main.h"
 #include "Reboot.h"
+#include "Scheduler.h"
+#include "Timebase.h"
+
+#define REBOOT_MAGIC_DFU 0x44465521UL   // "DFU!", left in Reboot_Magic to start the bootloader after the reset
 
 Reboot_Request_Type R = REBOOT_REQUEST_NONE;
+uint8_t Reset_Flags = 0;    /// RCC_CSR reset flags from before this boot, see Reboot_Get_Reset_Flags()
+volatile Reboot_Request_Type Reset_Request = REBOOT_REQUEST_NONE;   /// Immediate or DFU reset waiting for the application tick
+volatile uint32_t Reset_Deadline_ms = 0;                            /// When to reset, see Timebase_Deadline_ms()
+volatile uint32_t Reset_Latest_ms = 0;                              /// Reset by then even if a settings commit is still pending
+uint32_t Reboot_Magic __attribute__((section(".noinit")));          /// REBOOT_MAGIC_DFU to start the bootloader after the reset
+
+/**
+  * @brief  Start ST's DFU bootloader if the reset was asked for by a REBOOT_REQUEST_DFU, otherwise return.
+  *         Call this first thing in main(), before HAL_Init(), so the clocks and peripherals are still as the reset left
+  *         them, as the bootloader expects.
+  *
+  * @param  None
+  * @retval None. Does not return if the bootloader is started
+  */
+void Reboot_Start_Bootloader(void)
+{
+    // .noinit RAM is random after a power on, so only trust the flag after a software reset
+    bool Start = (Reboot_Magic == REBOOT_MAGIC_DFU) && (RCC->CSR & RCC_CSR_SFTRSTF);
+    Reboot_Magic = 0;   // so the next reset starts the application again
+    if(!Start)
+    {
+        return;
+    }
+
+    // map the system memory at 0, as booting with BOOT0 high does, then start the bootloader from its vector table
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+    __HAL_SYSCFG_REMAPMEMORY_SYSTEMFLASH();
+    const uint32_t *Vectors = (const uint32_t *)REBOOT_SYSTEM_MEMORY_ADDR;
+    void (*Bootloader)(void) = (void (*)(void))Vectors[1];
+    __set_MSP(Vectors[0]);
+    Bootloader();
+}
+
+/**
+  * @brief  Capture why the MCU reset, then clear the flags so the next reset is reported on its own
+  *
+  * @param  None
+  * @retval None
+  */
+void Reboot_Initialise(void)
+{
+    Reset_Flags = (uint8_t)(RCC->CSR >> RCC_CSR_RMVF_Pos);
+    __HAL_RCC_CLEAR_RESET_FLAGS();
+}
+
+/**
+  * @brief  Why the MCU last reset
+  *
+  * @param  None
+  * @retval The RCC_CSR reset flags shifted down by 24, so bit 6 = window watchdog (a host requested reboot), bit 5 = independent watchdog,
+  *         bit 4 = software (an immediate or DFU reboot), bit 3 = power on, bit 2 = reset pin (also set by every other internal reset), bit 1 = option byte load,
+  *         bit 7 = low power
+  */
+uint8_t Reboot_Get_Reset_Flags(void)
+{
+    return Reset_Flags;
+}
 
 /**
   * @brief  Reboot the processor
   *
   * @param  R: Type of request
   *            REBOOT_REQUEST_NORMAL = just reset and restart the application firmware, same like a normal power-on
-  *            REBOOT_REQUEST_DFU = reboot into the DFU bootloader (not yet implemented, setting this has no effect).
+  *            REBOOT_REQUEST_DFU = reboot into the DFU bootloader, REBOOT_DELAY_MS after the request.
+  *            REBOOT_REQUEST_IMMEDIATE = software reset REBOOT_DELAY_MS after the request, then restart the application firmware.
   * @retval None
   */
 void Reboot_Request(Reboot_Request_Type req)
 {
-    R = req;
+    if(req == REBOOT_REQUEST_NORMAL)
+    {
+        R = req;
+        Scheduler_Set_Event(SCHED_EVENT_REBOOT);
+    }
+    else if((req == REBOOT_REQUEST_DFU) || (req == REBOOT_REQUEST_IMMEDIATE))
+    {
+        uint32_t Primask = __get_PRIMASK();
+        __disable_irq();
+        Reset_Deadline_ms = Timebase_Deadline_ms(REBOOT_DELAY_MS);
+        Reset_Latest_ms = Timebase_Deadline_ms(REBOOT_MAX_DELAY_MS);
+        Reset_Request = req;
+        __set_PRIMASK(Primask);
+    }
+}
+
+/**
+  * @brief  Periodic processing. Call this from the application tick.
+  *         Resets the MCU once an immediate or DFU reboot is due and any pending settings commit has been written.
+  *
+  * @param  None
+  * @retval None
+  */
+void Reboot_Timer_Interrupt(void)
+{
+    if((Reset_Request == REBOOT_REQUEST_NONE) || !Timebase_Expired_ms(Reset_Deadline_ms))
+    {
+        return;
+    }
+
+    Config_Status_Type Config;
+    Config_Get_Status(&Config);
+    if(Config_Is_Writing() || (Config.Pending && !Timebase_Expired_ms(Reset_Latest_ms)))
+    {   // a commit being written always finishes within a page erase, only one that hasn't started is given up on
+        return;
+    }
+
+    if(Reset_Request == REBOOT_REQUEST_DFU)
+    {
+        Reboot_Magic = REBOOT_MAGIC_DFU;
+    }
+    NVIC_SystemReset();
 }
 
 /**
@@ -0,0 +1,74 @@
+/**
+  @file Scheduler.c
+  @brief Runs the main loop tasks when they have work to do, and sleeps the CPU when none do.
+  @details Each task in the table passed to Scheduler_Run() can run on events, at a period, or both.
+           - Events are set with Scheduler_Set_Event(), usually from an interrupt that has just handed work to the main loop
+             (eg settings to write to flash). The task runs on the next pass instead of waiting for its period.
+           - Periods are timed with HAL_GetTick(), so have 1ms resolution.
+           Tasks run to completion one after another in table order. None should take long, as every task waits behind it.
+           Interrupts are not held up by tasks.
+
+           Once a pass has run, the CPU sleeps with WFI until the next interrupt. Interrupts are masked from the event check until the
+           WFI, so an event set in between still wakes the CPU (a pending interrupt ends WFI even while masked) and is not left
+           waiting for the next one. The 1ms HAL tick wakes the CPU at least every ms, which is what runs the periodic tasks.
+
+           How to use:
+           1. Make a table of Scheduler_Task, with Last_Run_ms set to 0.
+           2. Call Scheduler_Run() with the table from the main loop. Each call runs one pass then sleeps.
+           3. Call Scheduler_Set_Event() to have event tasks run as soon as possible.
+ */
+
+#include <stdbool.h>
+
+#include "main.h"
+#include "Scheduler.h"
+
+volatile uint32_t Pending_Events = 0;   /// SCHED_EVENT bits set since the last pass
+
+/**
+  * @brief  Ask for the tasks waiting on an event to be run. Safe to call from interrupts
+  * @param  Event: The SCHED_EVENT that has happened
+  * @retval None
+  */
+void Scheduler_Set_Event(SCHED_EVENT Event)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    Pending_Events |= Event;
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Run every task that has an event pending or whose period has elapsed, then sleep until the next interrupt
+  * @param  Tasks: The task table
+  * @param  Num_Tasks: Number of tasks in the table
+  * @retval None
+  */
+void Scheduler_Run(Scheduler_Task *Tasks, uint8_t Num_Tasks)
+{
+    __disable_irq();
+    uint32_t Events = Pending_Events;
+    Pending_Events = 0;
+    __enable_irq();
+
+    uint32_t Now = HAL_GetTick();
+    for(uint8_t t = 0; t < Num_Tasks; t++)
+    {
+        bool Due = (Tasks[t].Period_ms != 0) && ((Now - Tasks[t].Last_Run_ms) >= Tasks[t].Period_ms);
+        if(Due)
+        {
+            Tasks[t].Last_Run_ms = Now;
+        }
+        if(Due || (Events & Tasks[t].Events))
+        {
+            Tasks[t].Run();
+        }
+    }
+
+    __disable_irq();
+    if(Pending_Events == 0)
+    {
+        __WFI();
+    }
+    __enable_irq();
+}
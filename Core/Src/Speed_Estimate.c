@@ -0,0 +1,239 @@
+/**
+  @file Speed_Estimate.c
+  @brief Estimates the motor speed from the commutation ripple in the motor current, without needing an encoder.
+  @details A brushed motor's current has a ripple each time the commutator switches segments. The ripple frequency is
+           proportional to the motor speed, so finding the dominant ripple frequency gives us the speed.
+
+           How to use:
+           1. Call Speed_Estimate_Add_Sample() from the ADC interrupt for each new current sample. This only copies the sample
+              into the capture window so it is cheap enough for interrupt context.
+           2. Call Speed_Estimate_Deferred() when DEFER_SPEED_WINDOW is posted. Once a full window has been captured, this will
+              run the FFT, find the dominant ripple bin and update the speed. The FFT runs at PendSV level so it is always
+              preempted by the USB, ADC and timer interrupts and never delays them.
+           3. Call Speed_Estimate_Get_RPM() to read the latest estimate.
+
+           While the FFT is being processed the capture window is owned by Speed_Estimate_Deferred() and any new samples are dropped.
+           Capture restarts once the result has been calculated.
+
+           The CMSIS arm_rfft_q15() was not used as its init function links in the twiddle tables for every FFT length up to 8192,
+           which is more than the 32KB of flash. A small radix-2 fixed point FFT with a single quarter wave sine table is used instead.
+ */
+
+#include <stdbool.h>
+
+#include "IO.h"
+#include "Deferred.h"
+#include "Profile.h"
+#include "Speed_Estimate.h"
+
+#define SINE_TABLE_LEN (SPEED_FFT_LEN/4 + 1)    // Quarter wave sine table, the rest of the wave is mirrored from this
+
+/**
+  @brief Quarter wave of sin(2*pi*i/SPEED_FFT_LEN) in Q15 format, i = 0 to SPEED_FFT_LEN/4
+*/
+const int16_t Sine_Q15[SINE_TABLE_LEN] = {
+    0, 1608, 3212, 4808, 6393, 7962, 9512, 11039, 12539, 14010, 15446, 16846, 18204, 19519, 20787, 22005,
+    23170, 24279, 25329, 26319, 27245, 28105, 28898, 29621, 30273, 30852, 31356, 31785, 32137, 32412, 32609, 32728,
+    32767
+};
+
+int16_t Speed_Window[2*SPEED_FFT_LEN];      /// Capture window and FFT work buffer. Complex interleaved (real, imaginary) pairs
+volatile uint16_t Speed_Window_Idx = 0;     /// Next sample position in the capture window
+volatile bool Speed_Window_Ready = false;   /// true when the window is full and owned by Speed_Estimate_Deferred()
+volatile uint16_t Speed_RPM = 0;            /// Latest speed estimate
+
+/**
+  * @brief  Look up sin(2*pi*Idx/SPEED_FFT_LEN) from the quarter wave table
+  * @param  Idx: angle index between 0 and SPEED_FFT_LEN-1
+  * @retval Sine value in Q15 format
+  */
+static int16_t Sin_Q15(uint16_t Idx)
+{
+    Idx &= (SPEED_FFT_LEN-1);
+    if(Idx <= SPEED_FFT_LEN/4)
+    {
+        return Sine_Q15[Idx];
+    }
+    else if(Idx <= SPEED_FFT_LEN/2)
+    {
+        return Sine_Q15[SPEED_FFT_LEN/2 - Idx];
+    }
+    else if(Idx <= 3*SPEED_FFT_LEN/4)
+    {
+        return -Sine_Q15[Idx - SPEED_FFT_LEN/2];
+    }
+    return -Sine_Q15[SPEED_FFT_LEN - Idx];
+}
+
+/**
+  * @brief  In-place radix-2 decimation in time FFT in Q15 format.
+  *         Each stage is scaled by 1/2 to prevent overflow, so the output is the FFT divided by SPEED_FFT_LEN.
+  * @param  Buf: SPEED_FFT_LEN complex interleaved (real, imaginary) values
+  * @retval None
+  */
+static void FFT_Q15(int16_t *Buf)
+{
+    // reorder the input into bit reversed order
+    uint16_t j = 0;
+    for(uint16_t i = 1; i < SPEED_FFT_LEN; i++)
+    {
+        uint16_t Bit = SPEED_FFT_LEN >> 1;
+        for(; j & Bit; Bit >>= 1)
+        {
+            j ^= Bit;
+        }
+        j ^= Bit;
+        if(i < j)
+        {
+            int16_t Tmp = Buf[2*i];
+            Buf[2*i] = Buf[2*j];
+            Buf[2*j] = Tmp;
+            Tmp = Buf[2*i+1];
+            Buf[2*i+1] = Buf[2*j+1];
+            Buf[2*j+1] = Tmp;
+        }
+    }
+
+    // butterfly stages
+    for(uint16_t Len = 2; Len <= SPEED_FFT_LEN; Len <<= 1)
+    {
+        uint16_t Half = Len >> 1;
+        uint16_t Step = SPEED_FFT_LEN / Len;
+        for(uint16_t i = 0; i < SPEED_FFT_LEN; i += Len)
+        {
+            for(uint16_t k = 0; k < Half; k++)
+            {
+                int32_t Cos = Sin_Q15(k*Step + SPEED_FFT_LEN/4);
+                int32_t Sin = Sin_Q15(k*Step);
+                int16_t *A = &Buf[2*(i+k)];
+                int16_t *B = &Buf[2*(i+k+Half)];
+
+                // B * W where W = cos - j.sin
+                int32_t Tr = (B[0]*Cos + B[1]*Sin) >> 15;
+                int32_t Ti = (B[1]*Cos - B[0]*Sin) >> 15;
+
+                B[0] = (A[0] - Tr) >> 1;
+                B[1] = (A[1] - Ti) >> 1;
+                A[0] = (A[0] + Tr) >> 1;
+                A[1] = (A[1] + Ti) >> 1;
+            }
+        }
+    }
+}
+
+/**
+  * @brief  Squared magnitude of an FFT bin
+  * @param  Bin: The bin number
+  * @retval re^2 + im^2
+  */
+static uint32_t Bin_Mag(uint16_t Bin)
+{
+    int32_t Re = Speed_Window[2*Bin];
+    int32_t Im = Speed_Window[2*Bin+1];
+    return (uint32_t)(Re*Re) + (uint32_t)(Im*Im);
+}
+
+/**
+  * @brief  Add a new current sample to the capture window. Call this from the ADC interrupt.
+  *         Samples are dropped while a full window is waiting to be processed.
+  * @param  Sample: The raw motor current ADC sample
+  * @retval None
+  */
+void Speed_Estimate_Add_Sample(uint16_t Sample)
+{
+    if(Speed_Window_Ready)
+    {
+        return;     // window is owned by the FFT
+    }
+
+    Speed_Window[2*Speed_Window_Idx] = (int16_t)Sample;
+    if(++Speed_Window_Idx >= SPEED_FFT_LEN)
+    {
+        Speed_Window_Ready = true;    // hand the window over to Speed_Estimate_Deferred()
+        Deferred_Post(DEFER_SPEED_WINDOW);
+    }
+}
+
+/**
+  * @brief  Get the latest speed estimate
+  * @retval Motor speed in RPM. 0 if no ripple could be detected (motor stopped)
+  */
+uint16_t Speed_Estimate_Get_RPM(void)
+{
+    return Speed_RPM;
+}
+
+/**
+  * @brief  Background processing. Call this from the deferred work, when DEFER_SPEED_WINDOW is posted.
+  *         When a full window of samples is available, run the FFT on it and update the speed estimate.
+  * @retval None
+  */
+void Speed_Estimate_Deferred(void)
+{
+    if(!Speed_Window_Ready)
+    {
+        return;
+    }
+    PROFILE_BEGIN(PROBE_SPEED_FFT);
+
+    // remove the DC component then scale the samples up to use the full Q15 range
+    int32_t Mean = 0;
+    for(uint16_t i = 0; i < SPEED_FFT_LEN; i++)
+    {
+        Mean += Speed_Window[2*i];
+    }
+    Mean /= SPEED_FFT_LEN;
+    for(uint16_t i = 0; i < SPEED_FFT_LEN; i++)
+    {
+        Speed_Window[2*i] = (int16_t)((Speed_Window[2*i] - Mean) * 4);    // 2 x 12 bit channels summed = 13 bits, x4 = 15 bits
+        Speed_Window[2*i+1] = 0;
+    }
+
+    FFT_Q15(Speed_Window);
+
+    // search for the dominant ripple, ignoring DC and the PWM frequency
+    const uint16_t Exclude_Bin = (SPEED_EXCLUDE_HZ * SPEED_FFT_LEN + ADC_SAMPLE_RATE_HZ/2) / ADC_SAMPLE_RATE_HZ;
+    uint16_t Peak_Bin = 0;
+    uint32_t Peak_Mag = 0;
+    for(uint16_t k = 1; k < SPEED_FFT_LEN/2; k++)
+    {
+        if((k+1 >= Exclude_Bin) && (k <= Exclude_Bin+1))
+        {
+            continue;
+        }
+        uint32_t Mag = Bin_Mag(k);
+        if(Mag > Peak_Mag)
+        {
+            Peak_Mag = Mag;
+            Peak_Bin = k;
+        }
+    }
+
+    uint32_t RPM = 0;
+    if(Peak_Mag >= SPEED_MIN_PEAK_MAG)
+    {
+        // parabolic interpolation between the neighbouring bins, in 1/16ths of a bin
+        int32_t Prev = Bin_Mag(Peak_Bin-1) >> 8;
+        int32_t Peak = Peak_Mag >> 8;
+        int32_t Next = Bin_Mag(Peak_Bin+1) >> 8;
+        int32_t Denom = 2*Peak - Prev - Next;
+        int32_t Delta_16 = 0;
+        if(Denom > 0)
+        {
+            Delta_16 = (8 * (Next - Prev)) / Denom;
+        }
+
+        int32_t Bin_16 = (Peak_Bin * 16) + Delta_16;
+        RPM = ((uint32_t)Bin_16 * ADC_SAMPLE_RATE_HZ * 60) / (16UL * SPEED_FFT_LEN * SPEED_RIPPLES_PER_REV);
+        if(RPM > UINT16_MAX)
+        {
+            RPM = UINT16_MAX;
+        }
+    }
+    Speed_RPM = (uint16_t)RPM;
+
+    // release the window to start capturing again
+    Speed_Window_Idx = 0;
+    Speed_Window_Ready = false;
+    PROFILE_END(PROBE_SPEED_FFT);
+}
@@ -0,0 +1,129 @@
+/**
+  @file Thermal.c
+  @brief I2t thermal model protecting the motor and driver from long periods of over current, such as a stall.
+  @details The model integrates the heating effect of the motor current each timer interrupt:
+           Heat += (I^2 - THERMAL_I_CONT_MA^2) * dt
+           Above the continuous current rating heat accumulates, below it the model cools, and it never goes below 0.
+           
+           - Below THERMAL_DERATE_PERMILLE of the trip limit the outputs are not affected.
+           - Between THERMAL_DERATE_PERMILLE and the trip limit the allowed PWM duty is reduced linearly to 0.
+           - At the trip limit the outputs are held off until the model has cooled to THERMAL_RESET_PERMILLE.
+
+           The heat level and PWM limit are reported in the status reply so the host can plan duty cycles ahead of a trip.
+
+           How to use:
+           1. Call Thermal_Initialise() during system initialisation.
+           2. Call Thermal_Timer_Interrupt() from the periodic timer interrupt.
+
+           Heat is kept in units of mA^2 * timer ticks / 2^20, so that the per tick update is 32 bit integer maths only.
+ */
+
+#include "IO.h"
+#include "Thermal.h"
+#include "Timebase.h"
+
+#define HEAT_SHIFT 20       // mA^2 values are divided by 2^HEAT_SHIFT before being accumulated, so the heat fits 32 bits
+
+const uint32_t I_Cont_Sq = ((uint32_t)THERMAL_I_CONT_MA * THERMAL_I_CONT_MA) >> HEAT_SHIFT;   /// continuous current squared, in heat units per tick
+const uint32_t Heat_Limit = (uint32_t)(((uint64_t)THERMAL_I2T_LIMIT_A2S * 1000000UL * TIMEBASE_TICKS_PER_SEC) >> HEAT_SHIFT);  /// Heat at which the outputs trip. 1A^2 = 1000000mA^2
+volatile uint32_t Heat = 0;         /// Accumulated heat of the model
+volatile uint16_t Heat_Permille = 0;    /// Heat as per mille of Heat_Limit
+volatile uint8_t PWM_Limit = 100;   /// Maximum PWM percent currently allowed by the model
+volatile bool Tripped = false;      /// true when the limit has been reached and the model has not yet cooled to the reset level
+
+/**
+  * @brief  Initialise the thermal model. Call this once during power-on init.
+  * @retval None
+  */
+void Thermal_Initialise(void)
+{
+    Heat = 0;
+    Heat_Permille = 0;
+    PWM_Limit = 100;
+    Tripped = false;
+}
+
+/**
+  * @brief  Get the maximum PWM percent currently allowed by the thermal model
+  * @retval 100 if there is no derating, down to 0 when tripped
+  */
+uint8_t Thermal_Get_PWM_Limit(void)
+{
+    return PWM_Limit;
+}
+
+/**
+  * @brief  Get the accumulated heat as a fraction of the trip limit
+  * @retval 0 = cold, 1000 = trip limit
+  */
+uint16_t Thermal_Get_Permille(void)
+{
+    return Heat_Permille;
+}
+
+/**
+  * @brief  Check if the model has tripped the outputs
+  * @retval true if tripped, the outputs are held off until the model cools to THERMAL_RESET_PERMILLE
+  */
+bool Thermal_Is_Tripped(void)
+{
+    return Tripped;
+}
+
+/**
+  * @brief  Update the model with the latest motor current. Call this every timer interrupt.
+  * @retval None
+  */
+void Thermal_Timer_Interrupt(void)
+{
+    // only one half bridge drives at a time, so the sum is the motor current
+    uint32_t mA = IO_ADC_To_mA(IO_Get_ADC(ISENSE_L) + IO_Get_ADC(ISENSE_R));
+    uint32_t I_Sq = (mA * mA) >> HEAT_SHIFT;
+
+    if(I_Sq > I_Cont_Sq)
+    {
+        uint32_t Rise = I_Sq - I_Cont_Sq;
+        Heat = (Heat > UINT32_MAX - Rise) ? UINT32_MAX : Heat + Rise;
+    }
+    else
+    {
+        uint32_t Fall = I_Cont_Sq - I_Sq;
+        Heat = (Heat > Fall) ? Heat - Fall : 0;
+    }
+
+    uint32_t Permille = Heat / (Heat_Limit / 1000 + 1);
+    if(Permille > 1000)
+    {
+        Permille = 1000;
+    }
+    Heat_Permille = Permille;
+
+    uint8_t Limit;
+    if(Permille >= 1000)
+    {
+        Tripped = true;
+    }
+    else if(Tripped && (Permille <= THERMAL_RESET_PERMILLE))
+    {
+        Tripped = false;
+    }
+
+    if(Tripped)
+    {
+        Limit = 0;
+    }
+    else if(Permille > THERMAL_DERATE_PERMILLE)
+    {
+        Limit = (100 * (1000 - Permille)) / (1000 - THERMAL_DERATE_PERMILLE);
+    }
+    else
+    {
+        Limit = 100;
+    }
+
+    if(Limit != PWM_Limit)
+    {   // only touch the outputs when the limit changes
+        PWM_Limit = Limit;
+        IO_Set_PWM_Limit(Limit);
+    }
+}
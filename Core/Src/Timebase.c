@@ -0,0 +1,190 @@
+/**
+  @file Timebase.c
+  @brief Free running 32 bit microsecond timebase, used to timestamp samples and replies so the host can
+         correlate them with its own clock and other sensors. Also keeps a millisecond count and makes the application tick.
+  @details TIMEBASE_HANDLE counts at 1MHz over its full 16 bit range (set up in STM32CubeMX). The upper 16 bits are
+           counted in software by the overflow interrupt. The timestamp wraps every 2^32us, approx 71.6 minutes.
+
+           TIM1 was not used as it already triggers the ADC, and its 250us period would need an interrupt at 4kHz.
+           The 16 bit period of this timer only needs an interrupt every 65.536ms.
+
+           The application tick comes from compare channel 1 of the same timer. Each compare moves the compare value on by
+           TIMEBASE_TICK_US, so the tick is an exact number of microseconds and does not depend on any other timer. The PWM timers
+           can have their frequency changed without affecting any timing.
+           How late the interrupt runs after the compare (the latency) is measured each tick, so the jitter of the tick caused by
+           other interrupts and critical sections can be seen. See Timebase_Get_Tick_Latency().
+           The millisecond count is kept by the tick. If the interrupt is held off for longer than a tick (eg a flash erase) the
+           missed ticks are added to the count, so it does not fall behind. Only one application tick is made for them.
+
+           Deadlines: Timebase_Deadline_...() gives the time a delay from now, and Timebase_Expired_...() checks if that time has been
+           reached. The check is by the signed difference, so it works across the counter wrapping, for delays up to half the
+           wrap (35 minutes for us, 24 days for ms). Everything is integer maths.
+
+           How to use:
+           1. Call Timebase_Initialise() during system initialisation.
+           2. Call Timebase_Interrupt() from the timer interrupt, instead of the HAL handler. Run the application tick when it returns true.
+           3. Call Timebase_Get_us(), Timebase_Get_ms() and the deadline functions from any context.
+ */
+
+#include "main.h"
+#include "Timebase.h"
+#include "Trace.h"
+
+#define TIMEBASE_HANDLE htim17   /// The timer counting microseconds
+
+extern TIM_HandleTypeDef TIMEBASE_HANDLE;   // tim17 counts at 1MHz. This is set up in STM32CubeMX
+
+volatile uint16_t Timebase_Overflows = 0;   /// Upper 16 bits of the microsecond count
+volatile uint32_t Timebase_ms = 0;          /// Milliseconds since Timebase_Initialise(), counted by the tick
+volatile Timebase_Latency_Type Tick_Latency = {0, UINT16_MAX, 0};   /// How late the tick interrupt has been running
+
+/**
+  * @brief  Start the timebase counting and the application tick. Call this once during power-on init.
+  * @retval None
+  */
+void Timebase_Initialise(void)
+{
+    Timebase_Overflows = 0;
+    Timebase_ms = 0;
+    Tick_Latency.Min_us = UINT16_MAX;
+    Tick_Latency.Max_us = 0;
+    __HAL_TIM_SET_COUNTER(&TIMEBASE_HANDLE, 0);
+    __HAL_TIM_SET_COMPARE(&TIMEBASE_HANDLE, TIM_CHANNEL_1, TIMEBASE_TICK_US);
+    __HAL_TIM_CLEAR_FLAG(&TIMEBASE_HANDLE, TIM_FLAG_CC1);
+    __HAL_TIM_ENABLE_IT(&TIMEBASE_HANDLE, TIM_IT_CC1);  // the channel is left frozen, only the compare flag is used
+    if(HAL_TIM_Base_Start_IT(&TIMEBASE_HANDLE) != HAL_OK)
+    {
+        Error_Handler();
+    }
+}
+
+/**
+  * @brief  Handle the timer interrupt. Counts overflows of the 16 bit timer and makes the tick.
+  *         Call this from the timer interrupt instead of the HAL handler. Only the flags handled here are cleared, so an overflow
+  *         during the application tick is left pending and counted when the interrupt runs again. The HAL handler would clear
+  *         it uncounted, and the timestamp would jump back 65.536ms
+  * @retval true if a tick is due, false for an overflow only
+  */
+bool Timebase_Interrupt(void)
+{
+    if(__HAL_TIM_GET_FLAG(&TIMEBASE_HANDLE, TIM_FLAG_UPDATE))
+    {
+        __HAL_TIM_CLEAR_FLAG(&TIMEBASE_HANDLE, TIM_FLAG_UPDATE);
+        Timebase_Overflows++;
+        TRACE(TRACE_TIMEBASE_WRAP, Timebase_Overflows);
+    }
+
+    if(!__HAL_TIM_GET_FLAG(&TIMEBASE_HANDLE, TIM_FLAG_CC1))
+    {
+        return false;
+    }
+    __HAL_TIM_CLEAR_FLAG(&TIMEBASE_HANDLE, TIM_FLAG_CC1);
+
+    uint16_t Compare = __HAL_TIM_GET_COMPARE(&TIMEBASE_HANDLE, TIM_CHANNEL_1);
+    uint16_t Late_us = __HAL_TIM_GET_COUNTER(&TIMEBASE_HANDLE) - Compare;
+    Tick_Latency.Last_us = Late_us;
+    if(Late_us < Tick_Latency.Min_us)
+    {
+        Tick_Latency.Min_us = Late_us;
+    }
+    if(Late_us > Tick_Latency.Max_us)
+    {
+        Tick_Latency.Max_us = Late_us;
+    }
+
+    do
+    {   // move on to the next tick, and past any that were missed while the interrupt was held off
+        Compare += TIMEBASE_TICK_US;
+        Timebase_ms += TIMEBASE_TICK_US / 1000;
+    }while((int16_t)(__HAL_TIM_GET_COUNTER(&TIMEBASE_HANDLE) - Compare) >= 0);
+    __HAL_TIM_SET_COMPARE(&TIMEBASE_HANDLE, TIM_CHANNEL_1, Compare);
+
+    return true;
+}
+
+/**
+  * @brief  Get the microseconds since Timebase_Initialise(). Safe to call from any interrupt or the main loop.
+  * @retval Timestamp in us, wraps every 2^32us
+  */
+uint32_t Timebase_Get_us(void)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t High = Timebase_Overflows;
+    uint16_t Count = __HAL_TIM_GET_COUNTER(&TIMEBASE_HANDLE);
+    if(__HAL_TIM_GET_FLAG(&TIMEBASE_HANDLE, TIM_FLAG_UPDATE) && (Count < 0x8000))
+    {   // the timer has wrapped but the overflow interrupt has not run yet, eg we are in a higher or equal priority interrupt
+        High++;
+    }
+    __set_PRIMASK(Primask);
+
+    return (High << 16) | Count;
+}
+
+/**
+  * @brief  Get the milliseconds since Timebase_Initialise(). Safe to call from any interrupt or the main loop.
+  * @retval Time in ms, wraps every 2^32ms
+  */
+uint32_t Timebase_Get_ms(void)
+{
+    return Timebase_ms;
+}
+
+/**
+  * @brief  Read how late the tick interrupt has been running, and optionally restart the min and max
+  * @param  Latency: Filled with a consistent snapshot
+  * @param  Reset: true to restart the min and max once they have been read
+  * @retval None
+  */
+void Timebase_Get_Tick_Latency(Timebase_Latency_Type *Latency, bool Reset)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    *Latency = *(Timebase_Latency_Type *)&Tick_Latency;
+    if(Reset)
+    {
+        Tick_Latency.Min_us = UINT16_MAX;
+        Tick_Latency.Max_us = 0;
+    }
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Get the deadline a delay from now, for Timebase_Expired_us()
+  * @param  Delay_us: The delay, up to 2^31us
+  * @retval The deadline
+  */
+uint32_t Timebase_Deadline_us(uint32_t Delay_us)
+{
+    return Timebase_Get_us() + Delay_us;
+}
+
+/**
+  * @brief  Check if a deadline from Timebase_Deadline_us() has been reached
+  * @param  Deadline_us: The deadline
+  * @retval true once the deadline has been reached
+  */
+bool Timebase_Expired_us(uint32_t Deadline_us)
+{
+    return (int32_t)(Timebase_Get_us() - Deadline_us) >= 0;
+}
+
+/**
+  * @brief  Get the deadline a delay from now, for Timebase_Expired_ms()
+  * @param  Delay_ms: The delay, up to 2^31ms
+  * @retval The deadline
+  */
+uint32_t Timebase_Deadline_ms(uint32_t Delay_ms)
+{
+    return Timebase_ms + Delay_ms;
+}
+
+/**
+  * @brief  Check if a deadline from Timebase_Deadline_ms() has been reached. Resolution is one tick
+  * @param  Deadline_ms: The deadline
+  * @retval true once the deadline has been reached
+  */
+bool Timebase_Expired_ms(uint32_t Deadline_ms)
+{
+    return (int32_t)(Timebase_ms - Deadline_ms) >= 0;
+}
@@ -0,0 +1,128 @@
+/**
+  @file Trace.c
+  @brief A timeline of what the firmware has been doing, kept in RAM for the host to read, to find intermittent latency spikes.
+  @details Events such as bytes received, commands executed, replies sent, outputs set and interrupt entry and exit are recorded
+           with TRACE() into a ring of the last TRACE_LEN events. Each is 4 bytes: the low 16 bits of the microsecond
+           timebase, the TRACE_EVENT and one byte of data. Recording is inline, a mask test, a timer read and a store with
+           interrupts masked, so it can be left in every interrupt.
+
+           The timestamps wrap every 65.536ms. The timebase overflow is itself an event (TRACE_TIMEBASE_WRAP), so the host can
+           rebuild the full time by counting them.
+
+           The trace is frozen, so the events leading up to it are kept, when:
+           - The host asks for it with the 'L' command, eg when it has seen a late reply.
+           - The CPU takes a hard fault, or Error_Handler() is called.
+           The ring is in the .noinit section, which the startup does not clear. A frozen trace is kept over a reset (the
+           reset pin, a debugger or the watchdog, but not a power cycle), so the events before a fault can be read after it.
+
+           How to use:
+           1. Call Trace_Initialise() as early as possible in the system initialisation.
+           2. Add TRACE(event, data) wherever an event happens.
+           3. Call Trace_Freeze() to stop recording, and Trace_Get_Status() and Trace_Get_Record() to read the trace.
+           4. Call Trace_Start() to clear the trace and record again.
+
+           Only built when TRACE_ENABLE is 1, otherwise TRACE() is empty and none of this is compiled.
+ */
+
+#include "main.h"
+#include "Trace.h"
+
+#if (TRACE_ENABLE == 1)
+
+#define TRACE_MAGIC 0x54524143UL    // "TRAC", marks the .noinit variables as holding a trace from before the reset
+
+volatile Trace_Record Trace_Ring[TRACE_LEN] __attribute__((section(".noinit")));   /// The events, oldest overwritten first
+volatile uint32_t Trace_Idx __attribute__((section(".noinit")));                   /// Number of events recorded since the trace was cleared
+volatile bool Trace_Frozen __attribute__((section(".noinit")));                    /// true once frozen, no events are recorded
+uint32_t Trace_Magic __attribute__((section(".noinit")));                          /// TRACE_MAGIC once the variables above are valid
+volatile uint32_t Trace_Mask = 0;                                                  /// Events being recorded, bit n for TRACE_EVENT n. 0 while frozen
+
+/**
+  * @brief  Keep a trace frozen before the reset so it can be read, otherwise clear it and start recording with the default mask.
+  *         Call this once during power-on init, before any events.
+  * @retval None
+  */
+void Trace_Initialise(void)
+{
+    if((Trace_Magic == TRACE_MAGIC) && Trace_Frozen)
+    {
+        Trace_Mask = 0;
+        return;
+    }
+    Trace_Start(TRACE_DEFAULT_MASK);
+}
+
+/**
+  * @brief  Clear the trace and start recording
+  * @param  Mask: The events to record, bit n for TRACE_EVENT n
+  * @retval None
+  */
+void Trace_Start(uint32_t Mask)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    Trace_Idx = 0;
+    Trace_Frozen = false;
+    Trace_Magic = TRACE_MAGIC;
+    Trace_Mask = Mask;
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Stop recording, so the events up to now are kept. A TRACE_FREEZE event is recorded first, whatever the mask.
+  *         Safe to call from any interrupt or fault handler.
+  * @param  Reason: Why the trace is being frozen
+  * @retval None
+  */
+void Trace_Freeze(TRACE_FREEZE_REASON Reason)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    if(!Trace_Frozen)
+    {
+        Trace_Mask = (1UL << TRACE_FREEZE);
+        Trace_Event(TRACE_FREEZE, Reason);
+        Trace_Mask = 0;
+        Trace_Frozen = true;
+    }
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Read the trace status
+  * @param  Status: Filled with the status
+  * @retval None
+  */
+void Trace_Get_Status(Trace_Status_Type *Status)
+{
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    Status->Frozen = Trace_Frozen;
+    Status->Total = Trace_Idx;
+    Status->Entries = (Trace_Idx < TRACE_LEN) ? Trace_Idx : TRACE_LEN;
+    Status->Mask = Trace_Mask;
+    __set_PRIMASK(Primask);
+}
+
+/**
+  * @brief  Read one event. Freeze the trace first, or new events will move the entries along while they are being read
+  * @param  Entry: Which event, 0 is the oldest held
+  * @param  Rec: Filled with the event
+  * @retval true if the entry is held, false if Entry is past the newest event
+  */
+bool Trace_Get_Record(uint16_t Entry, Trace_Record *Rec)
+{
+    bool Found = false;
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t Entries = (Trace_Idx < TRACE_LEN) ? Trace_Idx : TRACE_LEN;
+    if(Entry < Entries)
+    {
+        Rec->Word = Trace_Ring[(Trace_Idx - Entries + Entry) & (TRACE_LEN - 1)].Word;
+        Found = true;
+    }
+    __set_PRIMASK(Primask);
+    return Found;
+}
+
+#endif
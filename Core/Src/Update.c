@@ -0,0 +1,596 @@
+/**
+  @file Update.c
+  @brief Replaces the application image with one streamed from the host, over the same USB link and command framing.
+  @details The part has 32K of flash, too little to hold a second image while the first one runs, and a USB stack too large
+           for a small boot region. So the image is replaced in place:
+           1. The host sends {GS<len>,<crc>}, and gets {GA} back. The outputs are turned off and the updater takes over
+              UPDATE_START_DELAY_MS later, at PendSV level, so the reply has gone and no other interrupt is part way through.
+           2. The updater runs from RAM with interrupts disabled, polling the USB data endpoints directly. The device stays
+              enumerated, the host keeps the port open and sees nothing change. It erases the last page of the image,
+              programs the Started word of the update record (see Update_Info_Type) and sends {GA0,}.
+           3. The host streams {GW<offset>,<data>}, up to UPDATE_DATA_MAX bytes each, in order. Each page is erased as the
+              image reaches it. Every write is answered with {GA<next offset>,}, or {GP<next offset>,} if it was not the
+              expected offset or not valid, and the host resends from there. While a page is erased or a packet programmed
+              the data OUT endpoint NAKs, so the host can send without waiting for each reply, as long as it reads them.
+           4. The host sends {GE}. The updater checks the CRC of the whole image, programs the rest of the update record,
+              replies {GA<crc>,} and resets. If the length or CRC is wrong it replies {GP<crc>,} and waits for a {GS} to
+              start again.
+           {GS} is also accepted by the updater, to start again with the same or a new length and CRC.
+           All numbers are hex, the updater can't divide. The data is the image bytes as hex, two digits a byte, in whole
+           half words. The CRC is from the CRC unit fed with the image as 32 bit words: CRC-32/MPEG-2 of the image with the
+           bytes of each word reversed. The image is the application region, build/<target>_update.bin, padded to a
+           whole number of words.
+
+           The boot code (Boot.c) checks the record at every reset. An update cut short by a power loss or unplugging
+           leaves Started without Done, so the boot code starts ST's USB DFU bootloader instead of half an image and the
+           unit can still be recovered over USB. With the default CDC interface the data endpoints are double buffered,
+           the updater switches them to single buffered, which needs no buffer tracking.
+
+           How to use:
+           1. Call Update_Timer_Interrupt() from the application tick, and Update_Deferred() from the deferred work on DEFER_UPDATE.
+           2. Call Update_Request() when the host asks for an update.
+ */
+
+#include <stddef.h>
+
+#include "Comms_Defs.h"
+#include "Config.h"
+#include "Deferred.h"
+#include "IO.h"
+#include "main.h"
+#include "Timebase.h"
+#include "Update.h"
+#include "usbd_conf.h"
+#if (USB_INTERFACE_HID == 1)
+#include "usbd_raw_hid.h"
+#endif
+
+#if (USB_INTERFACE_HID == 1)
+#define UPDATE_EP_OUT (RAW_HID_EPOUT_ADDR & 0x0FU)
+#define UPDATE_EP_IN (RAW_HID_EPIN_ADDR & 0x0FU)
+#else
+#define UPDATE_EP_OUT (CDC_OUT_EP & 0x0FU)
+#define UPDATE_EP_IN (CDC_IN_EP & 0x0FU)
+#endif
+#define UPDATE_PACKET_SIZE 64                                           // Full speed data packet, and the HID report size
+/* PMA offsets of an endpoint's buffers, read from its buffer descriptor table entry in the same way as PCD_SET_EP_TX_ADDRESS()
+   and PCD_EP_RX_CNT(). The HAL's PCD_GET_EP_TX/RX_ADDRESS() use macros this HAL version doesn't define */
+#define UPDATE_EP_TX_ADDR(Ep) (*(__IO uint16_t *)((uint32_t)USB + 0x400U + ((USB->BTABLE + ((uint32_t)(Ep) * 8U)) * PMA_ACCESS)))
+#define UPDATE_EP_RX_ADDR(Ep) (*(__IO uint16_t *)((uint32_t)USB + 0x400U + ((USB->BTABLE + ((uint32_t)(Ep) * 8U) + 4U) * PMA_ACCESS)))
+#define UPDATE_INFO_PAGE (UPDATE_INFO_ADDR & ~(UPDATE_PAGE_SIZE - 1))   // Page holding the update record, erased first
+#define UPDATE_TX_WAIT 1000000UL                                        // Polls of the IN endpoint before resetting anyway once done
+
+/**
+  * @brief  The updater's state, on its stack
+  */
+typedef struct
+{
+    uint32_t Len;                       // Image length given by the host
+    uint32_t Crc;                       // Expected CRC
+    uint32_t Next;                      // Offset of the next image byte expected
+    uint32_t Erase_Addr;                // Next page that has not been erased
+    Comms_RX_Expect Expect;             // Framing of the command being received
+    uint8_t Command;                    // Its command letter
+    uint8_t Payload_Len;                // Its payload
+    uint8_t Payload[PAYLOAD_BUF_SIZE];
+}Updater_Type;
+
+/* The update record of a programmed image is erased, so the boot code starts it without a check. It is in the image,
+   rather than left out, so programming the image also clears the record of an earlier update */
+const Update_Info_Type Update_Info __attribute__((section(".update_info"), used)) = {UPDATE_ERASED, UPDATE_ERASED, UPDATE_ERASED, UPDATE_ERASED};
+
+volatile bool Update_Requested = false;     /// The host has asked for an update, waiting for the reply to go
+volatile uint32_t Update_Len = 0;           /// Image length from the request
+volatile uint32_t Update_Crc = 0;           /// Image CRC from the request
+volatile uint32_t Update_Deadline_ms = 0;   /// When to start, see Timebase_Deadline_ms()
+volatile uint32_t Update_Latest_ms = 0;     /// Start by then even if a settings commit is still pending
+
+/**
+  * @brief  Append a number as hex digits followed by a comma. Callable while the image is erased
+  * @param  Buf: Buffer to append to, with room for 9 more bytes
+  * @param  Len: Bytes already in Buf
+  * @param  Num: The number
+  * @retval The new length
+  */
+UPDATE_RAM_FUNC uint8_t Update_Append_Hex(uint8_t *Buf, uint8_t Len, uint32_t Num)
+{
+    bool Leading = true;
+    for(int8_t Shift = 28; Shift >= 0; Shift -= 4)
+    {
+        uint8_t Digit = (Num >> Shift) & 0x0F;
+        if(Leading && (Digit == 0) && (Shift > 0))
+        {
+            continue;
+        }
+        Leading = false;
+        Buf[Len++] = (Digit < 10) ? ('0' + Digit) : ('A' + Digit - 10);
+    }
+    Buf[Len++] = ',';
+    return Len;
+}
+
+/**
+  * @brief  Value of a hex digit
+  * @param  c: The character
+  * @retval 0 to 15, or 0xFF if c is not a hex digit
+  */
+UPDATE_RAM_FUNC static uint8_t Hex_Digit(uint8_t c)
+{
+    if((c >= '0') && (c <= '9'))
+    {
+        return c - '0';
+    }
+    if((c >= 'A') && (c <= 'F'))
+    {
+        return c - 'A' + 10;
+    }
+    if((c >= 'a') && (c <= 'f'))
+    {
+        return c - 'a' + 10;
+    }
+    return 0xFF;
+}
+
+/**
+  * @brief  Read a hex number of up to 8 digits, and the comma after it if there is one. Callable while the image is erased
+  * @param  Buf: The text
+  * @param  Len: Length of the text
+  * @param  Pos: Where to start, moved past the number and comma
+  * @param  Num: Filled with the number
+  * @retval true if there was a number
+  */
+UPDATE_RAM_FUNC bool Update_Parse_Hex(const uint8_t *Buf, uint8_t Len, uint8_t *Pos, uint32_t *Num)
+{
+    uint8_t Digits = 0;
+    *Num = 0;
+    while((*Pos < Len) && (Hex_Digit(Buf[*Pos]) != 0xFF))
+    {
+        if(++Digits > 8)
+        {
+            return false;
+        }
+        *Num = (*Num << 4) | Hex_Digit(Buf[(*Pos)++]);
+    }
+    if((*Pos < Len) && (Buf[*Pos] == ','))
+    {
+        (*Pos)++;
+    }
+    return Digits > 0;
+}
+
+/**
+  * @brief  CRC-32 of a whole number of words, from the CRC unit (polynomial 0x04C11DB7, initial value 0xFFFFFFFF).
+  *         Uses the registers rather than the LL functions, which may not be inlined
+  * @param  Data: The words
+  * @param  Len: Length in bytes, a multiple of 4
+  * @retval The CRC
+  */
+UPDATE_RAM_FUNC uint32_t Update_CRC(const uint32_t *Data, uint32_t Len)
+{
+    CRC->CR = CRC_CR_RESET;
+    for(uint32_t w = 0; w < (Len >> 2); w++)
+    {
+        CRC->DR = Data[w];
+    }
+    return CRC->DR;
+}
+
+/**
+  * @brief  Reset the MCU, the boot code then checks the image
+  * @retval Does not return
+  */
+UPDATE_RAM_FUNC static void Reset(void)
+{
+    __DSB();
+    SCB->AIRCR = (0x5FAUL << SCB_AIRCR_VECTKEY_Pos) | SCB_AIRCR_SYSRESETREQ_Msk;
+    __DSB();
+    while(1)
+    {
+    }
+}
+
+/**
+  * @brief  Wait for the flash to finish erasing or programming, and clear the result
+  * @retval true if it succeeded
+  */
+UPDATE_RAM_FUNC static bool Flash_Wait(void)
+{
+    while(FLASH->SR & FLASH_SR_BSY)
+    {
+    }
+    bool Ok = !(FLASH->SR & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR));
+    FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+    return Ok;
+}
+
+/**
+  * @brief  Erase a flash page
+  * @param  Addr: Start of the page
+  * @retval true if erased
+  */
+UPDATE_RAM_FUNC static bool Flash_Erase(uint32_t Addr)
+{
+    FLASH->CR |= FLASH_CR_PER;
+    FLASH->AR = Addr;
+    FLASH->CR |= FLASH_CR_STRT;
+    bool Ok = Flash_Wait();
+    FLASH->CR &= ~FLASH_CR_PER;
+    return Ok;
+}
+
+/**
+  * @brief  Program a half word of erased flash
+  * @param  Addr: Where, half word aligned
+  * @param  Half: The value
+  * @retval true if programmed and read back
+  */
+UPDATE_RAM_FUNC static bool Flash_Program(uint32_t Addr, uint16_t Half)
+{
+    FLASH->CR |= FLASH_CR_PG;
+    *(volatile uint16_t *)Addr = Half;
+    bool Ok = Flash_Wait() && (*(volatile uint16_t *)Addr == Half);
+    FLASH->CR &= ~FLASH_CR_PG;
+    return Ok;
+}
+
+/**
+  * @brief  Program a word of erased flash
+  * @param  Addr: Where, word aligned
+  * @param  Word: The value
+  * @retval true if programmed
+  */
+UPDATE_RAM_FUNC static bool Flash_Program_Word(uint32_t Addr, uint32_t Word)
+{
+    return Flash_Program(Addr, (uint16_t)Word) && Flash_Program(Addr + 2, (uint16_t)(Word >> 16));
+}
+
+/**
+  * @brief  Deal with the bus while the updater waits. A bus reset means the host has given up on the device, so reset
+  *         too. Control requests can't be answered without the USB stack, so they are stalled
+  * @retval None
+  */
+UPDATE_RAM_FUNC static void Poll_Bus(void)
+{
+    if(USB->ISTR & USB_ISTR_RESET)
+    {
+        Reset();
+    }
+    if(PCD_GET_ENDPOINT(USB, 0) & USB_EP_CTR_RX)
+    {
+        PCD_CLEAR_RX_EP_CTR(USB, 0);
+        PCD_SET_EP_TXRX_STATUS(USB, 0, USB_EP_RX_STALL, USB_EP_TX_STALL);
+    }
+    if(PCD_GET_ENDPOINT(USB, 0) & USB_EP_CTR_TX)
+    {
+        PCD_CLEAR_TX_EP_CTR(USB, 0);
+    }
+    if(PCD_GET_ENDPOINT(USB, UPDATE_EP_IN) & USB_EP_CTR_TX)
+    {
+        PCD_CLEAR_TX_EP_CTR(USB, UPDATE_EP_IN);
+    }
+}
+
+/**
+  * @brief  Send a reply once the host has taken the last one
+  * @param  Buf: The reply, UPDATE_PACKET_SIZE bytes with zeros after the frame
+  * @param  Len: Length of the frame
+  * @retval None
+  */
+UPDATE_RAM_FUNC static void Send(const uint8_t *Buf, uint8_t Len)
+{
+    while(PCD_GET_EP_TX_STATUS(USB, UPDATE_EP_IN) == USB_EP_TX_VALID)
+    {
+        Poll_Bus();
+    }
+#if (USB_INTERFACE_HID == 1)
+    Len = UPDATE_PACKET_SIZE;   // reports are always full length
+#endif
+    volatile uint16_t *Pma = (volatile uint16_t *)(USB_PMAADDR + UPDATE_EP_TX_ADDR(UPDATE_EP_IN));
+    for(uint8_t b = 0; b < Len; b += 2)
+    {
+        Pma[b >> 1] = Buf[b] | (Buf[b + 1] << 8);
+    }
+    PCD_SET_EP_TX_CNT(USB, UPDATE_EP_IN, Len);
+    PCD_SET_EP_TX_STATUS(USB, UPDATE_EP_IN, USB_EP_TX_VALID);
+}
+
+/**
+  * @brief  Start, or start again: erase the page with the update record and mark the update as started, so from here on
+  *         the boot code won't run the image until it is complete
+  * @param  U: The updater
+  * @retval true if the record was written
+  */
+UPDATE_RAM_FUNC static bool Start(Updater_Type *U)
+{
+    U->Next = 0;
+    U->Erase_Addr = UPDATE_APP_ADDR;
+    return Flash_Erase(UPDATE_INFO_PAGE) && Flash_Program_Word(UPDATE_INFO_ADDR + offsetof(Update_Info_Type, Started), UPDATE_STARTED_MAGIC);
+}
+
+/**
+  * @brief  Program the data of a {GW<offset>,<data>} command, erasing pages as they are reached
+  * @param  U: The updater, with the command payload
+  * @retval true if the data was at the expected offset, valid and programmed
+  */
+UPDATE_RAM_FUNC static bool Write(Updater_Type *U)
+{
+    uint8_t Pos = 1;
+    uint32_t Offset;
+    if(!Update_Parse_Hex(U->Payload, U->Payload_Len, &Pos, &Offset) || (Offset != U->Next))
+    {
+        return false;
+    }
+    uint8_t Digits = U->Payload_Len - Pos;
+    if((Digits == 0) || (Digits & 3) || ((U->Next + (Digits >> 1)) > U->Len))
+    {
+        return false;   // whole half words only, and no further than the length given
+    }
+    for(uint8_t d = Pos; d < U->Payload_Len; d++)
+    {
+        if(Hex_Digit(U->Payload[d]) == 0xFF)
+        {
+            return false;
+        }
+    }
+
+    for(uint8_t d = Pos; d < U->Payload_Len; d += 4)
+    {
+        uint32_t Addr = UPDATE_APP_ADDR + U->Next;
+        if(Addr >= U->Erase_Addr)
+        {
+            if((U->Erase_Addr != UPDATE_INFO_PAGE) && !Flash_Erase(U->Erase_Addr))
+            {
+                return false;
+            }
+            U->Erase_Addr += UPDATE_PAGE_SIZE;
+        }
+        uint16_t Half = (Hex_Digit(U->Payload[d]) << 4) | Hex_Digit(U->Payload[d + 1])
+                      | (Hex_Digit(U->Payload[d + 2]) << 12) | (Hex_Digit(U->Payload[d + 3]) << 8);
+        if(!Flash_Program(Addr, Half))
+        {
+            return false;
+        }
+        U->Next += 2;
+    }
+    return true;
+}
+
+/**
+  * @brief  Execute a received command and reply
+  * @param  U: The updater, with the command
+  * @retval None. Resets once an image has been completed
+  */
+UPDATE_RAM_FUNC static void Execute(Updater_Type *U)
+{
+    uint8_t Reply[UPDATE_PACKET_SIZE];
+    for(uint8_t b = 0; b < UPDATE_PACKET_SIZE; b++)
+    {
+        Reply[b] = 0;
+    }
+    Reply[0] = SOP_BYTE;
+    Reply[1] = U->Command;
+    Reply[2] = RESP_INV_COMMAND;
+    uint8_t Len = 3;
+    bool Done = false;
+
+    uint8_t Sub = (U->Payload_Len > 0) ? U->Payload[0] : 0;
+    if((U->Command != COMMAND_UPDATE) || (Sub == 0))
+    {
+        // only the update commands are available
+    }
+    else if(Sub == 'W')
+    {
+        Reply[2] = Write(U) ? RESP_ACK : RESP_INV_PAYLOAD;
+        Len = Update_Append_Hex(Reply, Len, U->Next);
+    }
+    else if(Sub == 'E')
+    {
+        uint32_t Crc = Update_CRC((const uint32_t *)UPDATE_APP_ADDR, U->Len);
+        Done = (U->Next == U->Len) && (Crc == U->Crc)
+            && Flash_Program_Word(UPDATE_INFO_ADDR + offsetof(Update_Info_Type, Len), U->Len)
+            && Flash_Program_Word(UPDATE_INFO_ADDR + offsetof(Update_Info_Type, Crc), Crc)
+            && Flash_Program_Word(UPDATE_INFO_ADDR + offsetof(Update_Info_Type, Done), UPDATE_DONE_MAGIC);
+        Reply[2] = Done ? RESP_ACK : RESP_INV_PAYLOAD;
+        Len = Update_Append_Hex(Reply, Len, Crc);
+    }
+    else if(Sub == 'S')
+    {
+        // optionally with a new length and CRC
+        uint8_t Pos = 1;
+        uint32_t New_Len, New_Crc;
+        bool Ok = true;
+        if(U->Payload_Len > 1)
+        {
+            Ok = Update_Parse_Hex(U->Payload, U->Payload_Len, &Pos, &New_Len) && Update_Parse_Hex(U->Payload, U->Payload_Len, &Pos, &New_Crc)
+              && (New_Len > 0) && (New_Len <= UPDATE_MAX_LEN) && !(New_Len & 3);
+            if(Ok)
+            {
+                U->Len = New_Len;
+                U->Crc = New_Crc;
+            }
+        }
+        Reply[2] = (Ok && Start(U)) ? RESP_ACK : RESP_INV_PAYLOAD;
+        Len = Update_Append_Hex(Reply, Len, U->Next);
+    }
+    else
+    {
+        Reply[2] = RESP_INV_PAYLOAD;
+    }
+    Reply[Len++] = EOP_BYTE;
+    Send(Reply, Len);
+
+    if(Done)
+    {
+        for(uint32_t w = 0; (w < UPDATE_TX_WAIT) && (PCD_GET_EP_TX_STATUS(USB, UPDATE_EP_IN) == USB_EP_TX_VALID); w++)
+        {
+            Poll_Bus();
+        }
+        Reset();
+    }
+}
+
+/**
+  * @brief  Frame the received bytes into commands, as Comms_RX does. A start of packet always starts a new command, the
+  *         update commands never have one in the payload
+  * @param  U: The updater
+  * @param  Byte: The received byte
+  * @retval None
+  */
+UPDATE_RAM_FUNC static void Receive_Byte(Updater_Type *U, uint8_t Byte)
+{
+    if(Byte == SOP_BYTE)
+    {
+        U->Expect = EXPECT_COMMAND;
+    }
+    else if(U->Expect == EXPECT_COMMAND)
+    {
+        U->Command = Byte;
+        U->Payload_Len = 0;
+        U->Expect = EXPECT_PAYLOAD;
+    }
+    else if(U->Expect == EXPECT_PAYLOAD)
+    {
+        if(Byte == EOP_BYTE)
+        {
+            U->Expect = EXPECT_SOP;
+            Execute(U);
+        }
+        else if(U->Payload_Len < PAYLOAD_BUF_SIZE)
+        {
+            U->Payload[U->Payload_Len++] = Byte;
+        }
+    }
+}
+
+/**
+  * @brief  The updater. Takes over the USB data endpoints and the flash until the new image is complete.
+  *         Call with interrupts disabled and the outputs off
+  * @param  Len: Image length from the start command
+  * @param  Crc: Image CRC from the start command
+  * @retval Does not return
+  */
+UPDATE_RAM_FUNC static void Update_Run(uint32_t Len, uint32_t Crc)
+{
+    Updater_Type U;     // set field by field, an initialiser can be a call to memset
+    U.Len = Len;
+    U.Crc = Crc;
+    U.Expect = EXPECT_SOP;
+
+    // finish anything the main loop had started, and unlock the flash
+    Flash_Wait();
+    FLASH->CR &= ~(FLASH_CR_PG | FLASH_CR_PER);
+    if(FLASH->CR & FLASH_CR_LOCK)
+    {
+        FLASH->KEYR = FLASH_KEY1;
+        FLASH->KEYR = FLASH_KEY2;
+    }
+    RCC->AHBENR |= RCC_AHBENR_CRCEN;
+
+    PCD_SET_EP_RX_STATUS(USB, UPDATE_EP_OUT, USB_EP_RX_NAK);
+    PCD_SET_EP_TX_STATUS(USB, UPDATE_EP_IN, USB_EP_TX_NAK);
+#if (USB_INTERFACE_HID == 0)
+    // single buffered, the OUT endpoint keeps its second buffer and the IN endpoint its first. The data toggles carry on
+    PCD_CLEAR_BULK_EP_DBUF(USB, UPDATE_EP_OUT);
+    PCD_CLEAR_BULK_EP_DBUF(USB, UPDATE_EP_IN);
+#endif
+    PCD_SET_EP_RX_CNT(USB, UPDATE_EP_OUT, UPDATE_PACKET_SIZE);
+    PCD_CLEAR_RX_EP_CTR(USB, UPDATE_EP_OUT);
+    PCD_CLEAR_TX_EP_CTR(USB, UPDATE_EP_IN);
+
+    // as a {GS} from the host, to send the first {GA0,}
+    U.Command = COMMAND_UPDATE;
+    U.Payload[0] = 'S';
+    U.Payload_Len = 1;
+    Execute(&U);
+
+    while(1)
+    {
+        PCD_SET_EP_RX_STATUS(USB, UPDATE_EP_OUT, USB_EP_RX_VALID);
+        while(!(PCD_GET_ENDPOINT(USB, UPDATE_EP_OUT) & USB_EP_CTR_RX))
+        {
+            Poll_Bus();
+        }
+        PCD_CLEAR_RX_EP_CTR(USB, UPDATE_EP_OUT);
+
+        // the endpoint NAKs until it is armed again, so the packet stays in the PMA while it is executed
+        uint16_t Count = PCD_GET_EP_RX_CNT(USB, UPDATE_EP_OUT);
+        const volatile uint16_t *Pma = (const volatile uint16_t *)(USB_PMAADDR + UPDATE_EP_RX_ADDR(UPDATE_EP_OUT));
+        for(uint16_t b = 0; (b < Count) && (b < UPDATE_PACKET_SIZE); b++)
+        {
+            uint16_t Half = Pma[b >> 1];
+            Receive_Byte(&U, (b & 1) ? (Half >> 8) : (Half & 0xFF));
+        }
+    }
+}
+
+/**
+  * @brief  How the running image was loaded
+  * @retval UPDATE_STATE_UPDATED if by the updater, UPDATE_STATE_PROGRAMMED otherwise
+  */
+UPDATE_STATE Update_Get_State(void)
+{
+    const volatile Update_Info_Type *Info = (const volatile Update_Info_Type *)UPDATE_INFO_ADDR;
+    return (Info->Started == UPDATE_ERASED) ? UPDATE_STATE_PROGRAMMED : UPDATE_STATE_UPDATED;
+}
+
+/**
+  * @brief  Start an update UPDATE_START_DELAY_MS from now, after the reply to the request has been sent
+  * @param  Len: Image length in bytes, a multiple of 4 up to UPDATE_MAX_LEN
+  * @param  Crc: Image CRC, see Update_CRC()
+  * @retval true if the update will start, false if the length is not valid
+  */
+bool Update_Request(uint32_t Len, uint32_t Crc)
+{
+    if((Len == 0) || (Len > UPDATE_MAX_LEN) || (Len & 3))
+    {
+        return false;
+    }
+
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    Update_Len = Len;
+    Update_Crc = Crc;
+    Update_Deadline_ms = Timebase_Deadline_ms(UPDATE_START_DELAY_MS);
+    Update_Latest_ms = Timebase_Deadline_ms(UPDATE_MAX_DELAY_MS);
+    Update_Requested = true;
+    __set_PRIMASK(Primask);
+    return true;
+}
+
+/**
+  * @brief  Periodic processing. Call this from the application tick.
+  *         Hands the update on to PendSV once it is due and any pending settings commit has been written.
+  * @retval None
+  */
+void Update_Timer_Interrupt(void)
+{
+    if(!Update_Requested || !Timebase_Expired_ms(Update_Deadline_ms))
+    {
+        return;
+    }
+
+    Config_Status_Type Config;
+    Config_Get_Status(&Config);
+    if(Config_Is_Writing() || (Config.Pending && !Timebase_Expired_ms(Update_Latest_ms)))
+    {   // the updater never returns to the main loop, so a commit being written must finish first. PendSV preempts the
+        // main loop, so no commit can start between this check and the updater taking over
+        return;
+    }
+
+    Update_Requested = false;
+    Deferred_Post(DEFER_UPDATE);
+}
+
+/**
+  * @brief  Deferred work, call this from PendSV on DEFER_UPDATE. Turns the outputs off and starts the updater.
+  * @retval Does not return
+  */
+void Update_Deferred(void)
+{
+    for(uint8_t pwm = 0; pwm < NUM_PWM_PINS; pwm++)
+    {
+        IO_Set_PWM_Percent(0, (PWM_PIN)pwm);
+    }
+    __disable_irq();
+    Update_Run(Update_Len, Update_Crc);
+}
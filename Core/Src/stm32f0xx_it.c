@@ -23,6 +23,9 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "MCU_7960_USB.h"
+#include "Profile.h"
+#include "Trace.h"
+#include "Timebase.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -59,6 +62,7 @@
 extern PCD_HandleTypeDef hpcd_USB_FS;
 extern ADC_HandleTypeDef hadc;
 extern TIM_HandleTypeDef htim3;
+extern TIM_HandleTypeDef htim17;
 /* USER CODE BEGIN EV */
 
 /* USER CODE END EV */
@@ -87,6 +91,9 @@ void NMI_Handler(void)
 void HardFault_Handler(void)
 {
   /* USER CODE BEGIN HardFault_IRQn 0 */
+#if (TRACE_ENABLE == 1)
+  Trace_Freeze(TRACE_FREEZE_HARD_FAULT);
+#endif
 
   /* USER CODE END HardFault_IRQn 0 */
   while (1)
@@ -116,6 +123,7 @@ void SVC_Handler(void)
 void PendSV_Handler(void)
 {
   /* USER CODE BEGIN PendSV_IRQn 0 */
+  MCU_7960_USB_Deferred_Interrupt();
 
   /* USER CODE END PendSV_IRQn 0 */
   /* USER CODE BEGIN PendSV_IRQn 1 */
@@ -169,21 +177,42 @@ void TIM3_IRQHandler(void)
   /* USER CODE END TIM3_IRQn 0 */
   HAL_TIM_IRQHandler(&htim3);
   /* USER CODE BEGIN TIM3_IRQn 1 */
-  MCU_7960_USB_Timer_Interrupt();
 
   /* USER CODE END TIM3_IRQn 1 */
 }
 
+/**
+  * @brief This function handles TIM17 global interrupt.
+  */
+void TIM17_IRQHandler(void)
+{
+  /* USER CODE BEGIN TIM17_IRQn 0 */
+  if(Timebase_Interrupt())
+  {
+    MCU_7960_USB_Timer_Interrupt();
+  }
+  /* Timebase owns every TIM17 flag, there is no HAL handler call. It would clear an overflow that happened during the tick
+     without it being counted. Left pending, the overflow runs this handler again. Remove the call if STM32CubeMX adds it back */
+  /* USER CODE END TIM17_IRQn 0 */
+  /* USER CODE BEGIN TIM17_IRQn 1 */
+
+  /* USER CODE END TIM17_IRQn 1 */
+}
+
 /**
   * @brief This function handles USB global Interrupt / USB wake-up interrupt through EXTI line 18.
   */
 void USB_IRQHandler(void)
 {
   /* USER CODE BEGIN USB_IRQn 0 */
+  PROFILE_BEGIN(PROBE_USB_ISR);
+  TRACE(TRACE_USB_ISR_ENTRY, 0);
 
   /* USER CODE END USB_IRQn 0 */
   HAL_PCD_IRQHandler(&hpcd_USB_FS);
   /* USER CODE BEGIN USB_IRQn 1 */
+  TRACE(TRACE_USB_ISR_EXIT, 0);
+  PROFILE_END(PROBE_USB_ISR);
 
   /* USER CODE END USB_IRQn 1 */
 }
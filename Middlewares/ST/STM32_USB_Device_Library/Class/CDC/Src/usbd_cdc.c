@@ -533,7 +533,7 @@ static uint8_t  USBD_CDC_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
     {
       /* Prepare Out endpoint to receive next packet */
       USBD_LL_PrepareReceive(pdev, CDC_OUT_EP, hcdc->RxBuffer,
-                             CDC_DATA_FS_OUT_PACKET_SIZE);
+                             CDC_DATA_FS_OUT_XFER_SIZE);
     }
   }
   return ret;
@@ -586,6 +586,7 @@ static uint8_t  USBD_CDC_Setup(USBD_HandleTypeDef *pdev,
   USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef *) pdev->pClassData;
   uint8_t ifalt = 0U;
   uint16_t status_info = 0U;
+  uint16_t len;
   uint8_t ret = USBD_OK;
 
   switch (req->bmRequest & USB_REQ_TYPE_MASK)
@@ -593,20 +594,22 @@ static uint8_t  USBD_CDC_Setup(USBD_HandleTypeDef *pdev,
     case USB_REQ_TYPE_CLASS :
       if (req->wLength)
       {
+        len = (uint16_t)MIN(sizeof(hcdc->data), req->wLength);   /* never let the host overrun hcdc->data */
+
         if (req->bmRequest & 0x80U)
         {
           ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->Control(req->bRequest,
                                                             (uint8_t *)(void *)hcdc->data,
-                                                            req->wLength);
+                                                            len);
 
-          USBD_CtlSendData(pdev, (uint8_t *)(void *)hcdc->data, req->wLength);
+          USBD_CtlSendData(pdev, (uint8_t *)(void *)hcdc->data, len);
         }
         else
         {
           hcdc->CmdOpCode = req->bRequest;
-          hcdc->CmdLength = (uint8_t)req->wLength;
+          hcdc->CmdLength = (uint8_t)len;
 
-          USBD_CtlPrepareRx(pdev, (uint8_t *)(void *)hcdc->data, req->wLength);
+          USBD_CtlPrepareRx(pdev, (uint8_t *)(void *)hcdc->data, len);
         }
       }
       else
@@ -692,6 +695,11 @@ static uint8_t  USBD_CDC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
     else
     {
       hcdc->TxState = 0U;
+
+      if (((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt != NULL)
+      {
+        ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt(hcdc->TxBuffer, &hcdc->TxLength, epnum);
+      }
     }
     return USBD_OK;
   }
@@ -921,7 +929,7 @@ uint8_t  USBD_CDC_ReceivePacket(USBD_HandleTypeDef *pdev)
       USBD_LL_PrepareReceive(pdev,
                              CDC_OUT_EP,
                              hcdc->RxBuffer,
-                             CDC_DATA_FS_OUT_PACKET_SIZE);
+                             CDC_DATA_FS_OUT_XFER_SIZE);
     }
     return USBD_OK;
   }
@@ -0,0 +1,24 @@
+/** @file      Sim_App.h
+ * @brief      Stand-in for the application side of the USB stack in the host simulation
+ * @details    See Sim_App.c
+ */
+
+#ifndef SIM_APP_H_
+#define SIM_APP_H_
+
+#include <stdint.h>
+
+#include "Comms_Defs.h"
+
+#define SIM_APP_TX_FRAME_SIZE (PAYLOAD_BUF_SIZE + 5)     // bytes per frame sent to the host, the longest reply frame
+
+extern uint32_t Sim_App_Rx_Bytes;
+extern uint32_t Sim_App_Rx_Errors;
+extern uint32_t Sim_App_SOFs;
+extern uint32_t Sim_App_Tx_Busy;
+extern uint32_t Sim_App_Tx_Frames;
+
+uint8_t Sim_App_Pattern(uint32_t Index);
+void Sim_App_Transmit_Poll(void);
+
+#endif
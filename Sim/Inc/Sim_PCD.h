@@ -0,0 +1,47 @@
+/** @file      Sim_PCD.h
+ * @brief      Host simulation of the USB peripheral (PCD) and its packet memory, driven by bus events from the simulated host
+ * @details    See Sim_PCD.c
+ */
+
+#ifndef SIM_PCD_H_
+#define SIM_PCD_H_
+
+#include <stdint.h>
+
+#define SIM_PMA_SIZE 1024       // bytes of packet memory in the STM32F070
+#define SIM_NUM_EPS 8           // endpoint registers in the USB peripheral
+
+/**
+  * @brief  Result of one transaction, as the host sees it. A non negative result from Sim_PCD_In() is the packet length
+  */
+typedef enum
+{
+    SIM_ACK = 0,                // Device took the packet
+    SIM_NAK = -1,               // Endpoint not ready, the host retries later
+    SIM_STALL = -2,             // Endpoint halted or the request was not supported
+    SIM_NO_RESPONSE = -3,       // No device at that address, endpoint not open, or the packet was malformed
+}SIM_RESULT;
+
+/**
+  * @brief  Counts of what the simulated peripheral has seen since power on
+  */
+typedef struct
+{
+    uint32_t Transactions;      // Tokens addressed to the device, including NAKed and STALLed ones
+    uint32_t Naks;              // Transactions answered with NAK
+    uint32_t Stalls;            // Transactions answered with STALL
+    uint32_t Pma_Errors;        // Endpoint buffers outside the PMA, overlapping the buffer table or another buffer, or misaligned
+    uint32_t Overruns;          // OUT packets longer than the space left in the armed transfer
+    uint16_t Pma_High_Water;    // Highest PMA byte used by an open endpoint buffer, +1
+}Sim_PCD_Stats_Type;
+
+void Sim_PCD_Bus_Reset(void);
+void Sim_PCD_Get_Stats(Sim_PCD_Stats_Type *Stats);
+int Sim_PCD_In(uint8_t Addr, uint8_t Ep, uint8_t *Data, uint16_t Max_Len);
+int Sim_PCD_Out(uint8_t Addr, uint8_t Ep, const uint8_t *Data, uint16_t Len);
+void Sim_PCD_Resume(void);
+int Sim_PCD_Setup(uint8_t Addr, const uint8_t Setup[8]);
+void Sim_PCD_SOF(void);
+void Sim_PCD_Suspend(void);
+
+#endif
@@ -0,0 +1,89 @@
+/** @file      stm32f0xx.h
+ * @brief      Host simulation stand-in for the STM32F0 device header
+ * @details    Found before the CMSIS device header on the Sim include path. It gives the USB stack and HAL PCD headers the
+ *             types and peripheral names they need, without the Cortex-M0 core header and its inline assembly.
+ *             The USB registers and unique ID are plain variables in Sim_PCD.c, so code that reads them runs unchanged.
+ *             Interrupts are not simulated, every call into the stack runs to completion, so the interrupt masking
+ *             intrinsics do nothing.
+ */
+
+#ifndef STM32F0XX_SIM_H_
+#define STM32F0XX_SIM_H_
+
+#include <stdint.h>
+
+#define STM32F0
+#ifndef STM32F070x6
+#define STM32F070x6
+#endif
+
+#define __IO volatile
+#define __I volatile const
+#define __O volatile
+
+/**
+  * @brief  Interrupt numbers referenced by the generated MSP code
+  */
+typedef enum
+{
+    USB_IRQn = 31
+}IRQn_Type;
+
+typedef enum
+{
+    DISABLE = 0,
+    ENABLE = !DISABLE
+}FunctionalState;
+
+/**
+  * @brief  Universal Serial Bus Full Speed Device registers, same layout as the CMSIS device header
+  */
+typedef struct
+{
+    __IO uint16_t EP0R;
+    __IO uint16_t RESERVED0;
+    __IO uint16_t EP1R;
+    __IO uint16_t RESERVED1;
+    __IO uint16_t EP2R;
+    __IO uint16_t RESERVED2;
+    __IO uint16_t EP3R;
+    __IO uint16_t RESERVED3;
+    __IO uint16_t EP4R;
+    __IO uint16_t RESERVED4;
+    __IO uint16_t EP5R;
+    __IO uint16_t RESERVED5;
+    __IO uint16_t EP6R;
+    __IO uint16_t RESERVED6;
+    __IO uint16_t EP7R;
+    __IO uint16_t RESERVED7[17];
+    __IO uint16_t CNTR;
+    __IO uint16_t RESERVED8;
+    __IO uint16_t ISTR;
+    __IO uint16_t RESERVED9;
+    __IO uint16_t FNR;
+    __IO uint16_t RESERVEDA;
+    __IO uint16_t DADDR;
+    __IO uint16_t RESERVEDB;
+    __IO uint16_t BTABLE;
+    __IO uint16_t RESERVEDC;
+    __IO uint16_t LPMCSR;
+    __IO uint16_t RESERVEDD;
+    __IO uint16_t BCDR;
+    __IO uint16_t RESERVEDE;
+}USB_TypeDef;
+
+extern USB_TypeDef Sim_USB_Regs;    // simulated USB register block, see Sim_PCD.c
+extern uint32_t Sim_UID[3];         // simulated 96 bit unique device ID, see Sim_PCD.c
+
+#define USB ((USB_TypeDef *)&Sim_USB_Regs)
+#define UID_BASE ((uintptr_t)Sim_UID)
+
+#define USB_FNR_FN ((uint16_t)0x07FFU)     /*!< Frame Number */
+#define USB_DADDR_EF ((uint8_t)0x80U)      /*!< Enable Function */
+
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t Primask) { (void)Primask; }
+
+#endif
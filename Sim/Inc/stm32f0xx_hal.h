@@ -0,0 +1,31 @@
+/** @file      stm32f0xx_hal.h
+ * @brief      Host simulation stand-in for the STM32F0 HAL header
+ * @details    Found before the HAL driver header on the Sim include path. It uses the real HAL PCD types, so usbd_conf.c
+ *             and the USB device library build unmodified against the simulated PCD in Sim_PCD.c.
+ *             The clock and interrupt controller calls in the generated MSP code have no effect in the simulation.
+ */
+
+#ifndef STM32F0XX_HAL_SIM_H_
+#define STM32F0XX_HAL_SIM_H_
+
+#define USE_HAL_PCD_REGISTER_CALLBACKS 0U
+
+#include "stm32f0xx_hal_def.h"
+#include "stm32f0xx_hal_pcd.h"
+
+typedef struct
+{
+    void *Instance;
+}TIM_HandleTypeDef;     // only referenced by prototypes in main.h
+
+#define __HAL_RCC_USB_CLK_ENABLE() do { } while(0)
+#define __HAL_RCC_USB_CLK_DISABLE() do { } while(0)
+
+static inline void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority) { (void)IRQn; (void)PreemptPriority; (void)SubPriority; }
+static inline void HAL_NVIC_EnableIRQ(IRQn_Type IRQn) { (void)IRQn; }
+static inline void HAL_NVIC_DisableIRQ(IRQn_Type IRQn) { (void)IRQn; }
+
+void HAL_Delay(uint32_t Delay);
+uint32_t HAL_GetTick(void);
+
+#endif
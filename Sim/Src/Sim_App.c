@@ -0,0 +1,125 @@
+/**
+  @file Sim_App.c
+  @brief Stand-in for the application side of the USB stack in the host simulation.
+  @details The USB_DEVICE sources call into the application for received bytes, frames, suspend and resume. In the simulation
+           these are replaced with a byte sink and a frame source, so the host can stream data through the real stack and check
+           every byte arrives intact and in order. Both use the same rolling byte pattern, see Sim_App_Pattern().
+
+           - Received bytes are checked against the pattern and counted.
+           - Frames to the host are built in a buffer pool block and sent in the same way as Send_Packet(), so the pool and the
+             transmit complete path are exercised too.
+
+           How to use:
+           1. Call Sim_App_Transmit_Poll() from the simulated main loop while an IN stream is wanted.
+           2. Read Sim_App_Rx_Bytes and Sim_App_Rx_Errors after an OUT stream.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Buffer_Pool.h"
+#include "Comms_Controller.h"
+#include "Diagnostics.h"
+#include "MCU_7960_USB.h"
+#include "Power.h"
+#include "Sim_App.h"
+#include "usbd_cdc_if.h"
+#include "usbd_raw_hid.h"
+
+uint32_t Sim_App_Rx_Bytes = 0;      /// Bytes delivered by the stack to the application
+uint32_t Sim_App_Rx_Errors = 0;     /// Delivered bytes that were not the next byte of the pattern
+uint32_t Sim_App_Tx_Frames = 0;     /// Frames the stack accepted to send to the host
+uint32_t Sim_App_Tx_Busy = 0;       /// Attempts to send while the last frame was still in flight
+uint32_t Sim_App_SOFs = 0;          /// Start of frame interrupts passed up from the stack
+
+/**
+  * @brief  The test byte pattern, so dropped, repeated or reordered bytes are seen
+  * @param  Index: Byte position in the stream
+  * @retval The byte
+  */
+uint8_t Sim_App_Pattern(uint32_t Index)
+{
+    return (uint8_t)((Index * 7U) + (Index >> 8));
+}
+
+/**
+  * @brief  Send the next frame to the host if the stack can take it
+  * @retval None
+  */
+void Sim_App_Transmit_Poll(void)
+{
+    uint8_t *Buf = Buffer_Pool_Alloc(SIM_APP_TX_FRAME_SIZE);
+    if(Buf == NULL)
+    {
+        DIAGNOSTICS_INC(DIAG_TX_DROPS);
+        return;
+    }
+    for(uint32_t i = 0; i < SIM_APP_TX_FRAME_SIZE; i++)
+    {
+        Buf[i] = Sim_App_Pattern((Sim_App_Tx_Frames * SIM_APP_TX_FRAME_SIZE) + i);
+    }
+
+#if (USB_INTERFACE_HID == 1)
+    uint8_t Result = Raw_HID_Transmit(Buf, SIM_APP_TX_FRAME_SIZE);
+    Buffer_Pool_Free(Buf);
+#else
+    uint8_t Result = CDC_Transmit_FS(Buf, SIM_APP_TX_FRAME_SIZE);
+    if(Result != USBD_OK)
+    {
+        Buffer_Pool_Free(Buf);
+    }
+#endif
+    if(Result == USBD_OK)
+    {
+        Sim_App_Tx_Frames++;
+    }
+    else
+    {
+        Sim_App_Tx_Busy++;
+    }
+}
+
+void Comms_Controller_Bytes_Received(uint8_t *Buf, uint32_t Num_Bytes)
+{
+    for(uint32_t i = 0; i < Num_Bytes; i++)
+    {
+        if(Buf[i] != Sim_App_Pattern(Sim_App_Rx_Bytes))
+        {
+            Sim_App_Rx_Errors++;
+        }
+        Sim_App_Rx_Bytes++;
+    }
+    DIAGNOSTICS_ADD(DIAG_RX_BYTES, Num_Bytes);
+}
+
+void Comms_Controller_Connect_USB(void)
+{
+    Diagnostics_Boot_Milestone(BOOT_USB_CONNECT);
+}
+
+void Comms_Controller_Tx_Done(void)
+{
+}
+
+void MCU_7960_USB_SOF_Interrupt(void)
+{
+    Sim_App_SOFs++;
+}
+
+void Power_USB_Suspend(void)
+{
+}
+
+void Power_USB_Resume(void)
+{
+}
+
+void SystemClock_Config(void)
+{
+}
+
+void Error_Handler(void)
+{
+    fprintf(stderr, "Sim: Error_Handler() called by the firmware\n");
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,601 @@
+/**
+  @file Sim_Main.c
+  @brief Simulated USB host. Enumerates the firmware's USB stack, streams data both ways through it, and reports the results.
+  @details Runs the unmodified USB_DEVICE sources and USB device library against the simulated peripheral in Sim_PCD.c.
+
+           Bus time is modelled in 1 ms full speed frames. Each transaction takes its data length plus SIM_TRANSACTION_OVERHEAD
+           byte times out of the SIM_FRAME_BYTES in a frame, so a frame carries at most 19 full 64 byte bulk packets, as on a real
+           full speed bus. An interrupt endpoint is polled at most once per frame. When a frame is full the host sends the next
+           start of frame. Bus reset, reset recovery and SET_ADDRESS recovery take the minimum times the USB specification allows.
+
+           Between every transaction the simulated firmware main loop runs once, so the firmware refills the IN endpoint as
+           soon as it can. The throughputs reported are therefore what the stack allows on an otherwise idle bus, not what the
+           full firmware achieves with its command processing.
+
+           Scenarios:
+           1. Enumerate as a PC host would: device descriptor, address, configuration and string descriptors, set the
+              configuration, then the class requests. The data endpoints are found from the configuration descriptor.
+           2. Stream SIM_OUT_BYTES to the device and check every byte arrives in order.
+           3. Stream SIM_IN_FRAMES frames from the device and check every byte arrives in order.
+           4. Suspend and resume the bus.
+
+           The program exits with a failure status if any check fails, so it can be run from a script.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Buffer_Pool.h"
+#include "Diagnostics.h"
+#include "Sim_App.h"
+#include "Sim_PCD.h"
+#include "stm32f0xx_hal.h"
+#include "usb_device.h"
+
+#define SIM_FRAME_BYTES 1500            // byte times in a 1 ms full speed frame
+#define SIM_TRANSACTION_OVERHEAD 13     // byte times for the token, handshake, sync, CRC and bus turnaround of one transaction
+#define SIM_NAK_TIMEOUT_MS 50           // a control transfer that is NAKed for this long has failed
+#define SIM_DEVICE_ADDRESS 5            // address given to the device in SET_ADDRESS
+#define SIM_OUT_BYTES 65536             // bytes sent to the device in the OUT stream
+#define SIM_OUT_URB_SIZE 4096           // bytes in each host OUT request, as a PC serial driver would write
+#define SIM_IN_FRAMES 1024              // frames read from the device in the IN stream
+
+#define DESC_DEVICE 1
+#define DESC_CONFIGURATION 2
+#define DESC_STRING 3
+#define DESC_ENDPOINT 5
+
+static uint32_t Frame_ms = 0;           /// Frames since the simulation started, also the HAL tick
+static uint32_t Frame_Used = 0;         /// Byte times used in the current frame
+static uint8_t Device_Address = 0;      /// Address the host talks to the device at
+static uint32_t Int_Polled_Frame[16];   /// Interrupt endpoints: frame each was last polled in, +1, indexed by address & 0x8F
+static bool Streaming_In = false;       /// The firmware main loop is sending frames to the host
+static int Failures = 0;
+
+/**
+  * @brief  A data endpoint of the device, found in its configuration descriptor
+  */
+typedef struct
+{
+    uint8_t Addr;           // Endpoint address, bit 7 set for IN
+    uint8_t Type;           // 2 = bulk, 3 = interrupt
+    uint16_t Max_Packet;
+}Host_EP_Type;
+
+static Host_EP_Type Data_Out;
+static Host_EP_Type Data_In;
+
+/**
+  * @brief  Record a failed check
+  * @param  What: Description of the failure
+  * @retval None
+  */
+static void Fail(const char *What)
+{
+    printf("FAIL: %s\n", What);
+    Failures++;
+}
+
+/**
+  * @brief  Start the next frame
+  * @retval None
+  */
+static void Next_Frame(void)
+{
+    Frame_ms++;
+    Frame_Used = 0;
+    Sim_PCD_SOF();
+}
+
+/**
+  * @brief  Let time pass with the bus idle except for start of frames
+  * @param  ms: Frames to wait
+  * @retval None
+  */
+static void Idle_Frames(uint32_t ms)
+{
+    for(uint32_t i = 0; i < ms; i++)
+    {
+        Next_Frame();
+    }
+}
+
+/**
+  * @brief  Take the bus time for a transaction, moving to the next frame if this one is full
+  * @param  Ep_Addr: Endpoint address, to limit interrupt endpoints to one transaction per frame, or 0 for control
+  * @param  Type: Endpoint type
+  * @param  Len: Data bytes in the transaction
+  * @retval None
+  */
+static void Bus_Slot(uint8_t Ep_Addr, uint8_t Type, uint16_t Len)
+{
+    uint32_t Cost = Len + SIM_TRANSACTION_OVERHEAD;
+
+    if(Frame_Used + Cost > SIM_FRAME_BYTES)
+    {
+        Next_Frame();
+    }
+    if(Type == 3)
+    {
+        uint8_t Idx = Ep_Addr & 0x8FU;
+        Idx = (uint8_t)((Idx & 0x0FU) | ((Idx & 0x80U) >> 4));
+        if(Int_Polled_Frame[Idx] == Frame_ms + 1)
+        {
+            Next_Frame();
+        }
+        Int_Polled_Frame[Idx] = Frame_ms + 1;
+    }
+    Frame_Used += Cost;
+}
+
+/**
+  * @brief  IN transaction, retried while NAKed. Runs the firmware main loop between tries
+  * @param  Ep: The endpoint
+  * @param  Data: Filled with the packet
+  * @param  Timeout_ms: Give up when NAKed for this long
+  * @retval Packet length, or a negative SIM_RESULT
+  */
+static int Host_In(const Host_EP_Type *Ep, uint8_t *Data, uint32_t Timeout_ms)
+{
+    uint32_t Start = Frame_ms;
+    int Result;
+
+    do
+    {
+        if(Streaming_In)
+        {
+            Sim_App_Transmit_Poll();
+        }
+        Bus_Slot(Ep->Addr, Ep->Type, Ep->Max_Packet);
+        Result = Sim_PCD_In(Device_Address, Ep->Addr & 0x0FU, Data, Ep->Max_Packet);
+    }while((Result == SIM_NAK) && ((Frame_ms - Start) < Timeout_ms));
+    return Result;
+}
+
+/**
+  * @brief  OUT transaction, retried while NAKed
+  * @param  Ep: The endpoint
+  * @param  Data: The packet
+  * @param  Len: Packet length
+  * @param  Timeout_ms: Give up when NAKed for this long
+  * @retval SIM_ACK, or a negative SIM_RESULT
+  */
+static int Host_Out(const Host_EP_Type *Ep, const uint8_t *Data, uint16_t Len, uint32_t Timeout_ms)
+{
+    uint32_t Start = Frame_ms;
+    int Result;
+
+    do
+    {
+        Bus_Slot(Ep->Addr, Ep->Type, Len);
+        Result = Sim_PCD_Out(Device_Address, Ep->Addr & 0x0FU, Data, Len);
+    }while((Result == SIM_NAK) && ((Frame_ms - Start) < Timeout_ms));
+    return Result;
+}
+
+/**
+  * @brief  Control transfer on EP0: setup, data and status stages
+  * @param  Request_Type: bmRequestType, bit 7 set for device to host
+  * @param  Request: bRequest
+  * @param  Value: wValue
+  * @param  Index: wIndex
+  * @param  Data: Data to send, or filled with the data received
+  * @param  Length: wLength
+  * @retval Bytes transferred in the data stage, or a negative SIM_RESULT
+  */
+static int Control(uint8_t Request_Type, uint8_t Request, uint16_t Value, uint16_t Index, uint8_t *Data, uint16_t Length)
+{
+    static const Host_EP_Type EP0_In = { 0x80, 0, 64 };
+    static const Host_EP_Type EP0_Out = { 0x00, 0, 64 };
+    uint8_t Setup[8] = { Request_Type, Request, (uint8_t)Value, (uint8_t)(Value >> 8), (uint8_t)Index, (uint8_t)(Index >> 8),
+                         (uint8_t)Length, (uint8_t)(Length >> 8) };
+    uint8_t Packet[64];
+    int Done = 0;
+    int Result;
+
+    Bus_Slot(0, 0, 8);
+    Result = Sim_PCD_Setup(Device_Address, Setup);
+    if(Result != SIM_ACK)
+    {
+        return Result;
+    }
+
+    if((Request_Type & 0x80U) != 0U)
+    {
+        while(Done < Length)
+        {
+            Result = Host_In(&EP0_In, Packet, SIM_NAK_TIMEOUT_MS);
+            if(Result < 0)
+            {
+                return Result;
+            }
+            int Copy = ((Done + Result) > Length) ? (Length - Done) : Result;
+            memcpy(&Data[Done], Packet, (size_t)Copy);
+            Done += Copy;
+            if(Result < EP0_In.Max_Packet)
+            {
+                break;      // short packet ends the data stage
+            }
+        }
+        Result = Host_Out(&EP0_Out, NULL, 0, SIM_NAK_TIMEOUT_MS);
+        return (Result == SIM_ACK) ? Done : Result;
+    }
+
+    while(Done < Length)
+    {
+        uint16_t Len = ((Length - Done) > EP0_Out.Max_Packet) ? EP0_Out.Max_Packet : (uint16_t)(Length - Done);
+        Result = Host_Out(&EP0_Out, &Data[Done], Len, SIM_NAK_TIMEOUT_MS);
+        if(Result != SIM_ACK)
+        {
+            return Result;
+        }
+        Done += Len;
+    }
+    Result = Host_In(&EP0_In, Packet, SIM_NAK_TIMEOUT_MS);
+    if(Result > 0)
+    {
+        return SIM_NO_RESPONSE;     // the status stage must be zero length
+    }
+    return (Result == 0) ? Done : Result;
+}
+
+/**
+  * @brief  Read a string descriptor and print it
+  * @param  Name: What the string is
+  * @param  Index: String index, 0 for none
+  * @retval None
+  */
+static void Print_String(const char *Name, uint8_t Index)
+{
+    uint8_t Desc[255];
+    char Text[128];
+    size_t n = 0;
+
+    if(Index == 0)
+    {
+        return;
+    }
+    int Len = Control(0x80, 6, (uint16_t)((DESC_STRING << 8) | Index), 0x0409, Desc, sizeof(Desc));
+    if((Len < 2) || (Desc[1] != DESC_STRING))
+    {
+        Fail("string descriptor");
+        return;
+    }
+    for(int i = 2; (i + 1 < Len) && (n < sizeof(Text) - 1); i += 2)
+    {
+        Text[n++] = (char)Desc[i];
+    }
+    Text[n] = '\0';
+    printf("  %-13s %s\n", Name, Text);
+}
+
+/**
+  * @brief  Enumerate the device as a PC host would, and find its data endpoints
+  * @retval None
+  */
+static void Enumerate(void)
+{
+    Sim_PCD_Stats_Type Before;
+    uint8_t Desc[255];
+    uint32_t Start_ms = Frame_ms;
+
+    Sim_PCD_Get_Stats(&Before);
+
+    Frame_ms += 10;                 // bus reset, at least 10 ms
+    Sim_PCD_Bus_Reset();
+    Idle_Frames(10);                // reset recovery
+    Device_Address = 0;
+
+    if(Control(0x80, 6, (DESC_DEVICE << 8), 0, Desc, 64) < 8)
+    {
+        Fail("device descriptor at address 0");
+        return;
+    }
+    if(Control(0x00, 5, SIM_DEVICE_ADDRESS, 0, NULL, 0) != 0)
+    {
+        Fail("SET_ADDRESS");
+        return;
+    }
+    Device_Address = SIM_DEVICE_ADDRESS;
+    Idle_Frames(2);                 // set address recovery
+
+    uint8_t Device[18];
+    if((Control(0x80, 6, (DESC_DEVICE << 8), 0, Device, sizeof(Device)) != (int)sizeof(Device)) || (Device[1] != DESC_DEVICE))
+    {
+        Fail("device descriptor");
+        return;
+    }
+
+    if(Control(0x80, 6, (DESC_CONFIGURATION << 8), 0, Desc, 9) != 9)
+    {
+        Fail("configuration descriptor header");
+        return;
+    }
+    uint16_t Total = (uint16_t)(Desc[2] | (Desc[3] << 8));
+    if((Total > sizeof(Desc)) || (Control(0x80, 6, (DESC_CONFIGURATION << 8), 0, Desc, Total) != Total))
+    {
+        Fail("configuration descriptor");
+        return;
+    }
+
+    printf("Device %04X:%04X, %u byte configuration\n", Device[8] | (Device[9] << 8), Device[10] | (Device[11] << 8), Total);
+    Print_String("Manufacturer", Device[14]);
+    Print_String("Product", Device[15]);
+    Print_String("Serial", Device[16]);
+
+    for(uint16_t i = 0; (i + 1) < Total; i += Desc[i])
+    {
+        if(Desc[i] == 0)
+        {
+            Fail("zero length descriptor in the configuration");
+            return;
+        }
+        if(Desc[i + 1] == DESC_ENDPOINT)
+        {
+            Host_EP_Type Ep = { Desc[i + 2], (uint8_t)(Desc[i + 3] & 3U), (uint16_t)(Desc[i + 4] | (Desc[i + 5] << 8)) };
+            printf("  Endpoint 0x%02X %s, %u bytes\n", Ep.Addr, (Ep.Type == 2) ? "bulk" : (Ep.Type == 3) ? "interrupt" : "other", Ep.Max_Packet);
+            if(((Ep.Addr & 0x80U) == 0U) && (Data_Out.Addr == 0))
+            {
+                Data_Out = Ep;
+            }
+        }
+    }
+    for(uint16_t i = 0; (i + 1) < Total; i += Desc[i])
+    {   // the data IN endpoint is the one with the same type as the data OUT, not the CDC notification endpoint
+        if((Desc[i + 1] == DESC_ENDPOINT) && ((Desc[i + 2] & 0x80U) != 0U) && ((Desc[i + 3] & 3U) == Data_Out.Type))
+        {
+            Data_In = (Host_EP_Type){ Desc[i + 2], (uint8_t)(Desc[i + 3] & 3U), (uint16_t)(Desc[i + 4] | (Desc[i + 5] << 8)) };
+            break;
+        }
+    }
+    if((Data_Out.Addr == 0) || (Data_In.Addr == 0))
+    {
+        Fail("no data endpoints in the configuration");
+        return;
+    }
+
+    if(Control(0x00, 9, Desc[5], 0, NULL, 0) != 0)
+    {
+        Fail("SET_CONFIGURATION");
+        return;
+    }
+
+    if(Data_Out.Type == 2)
+    {   // CDC: line coding 115200 8N1, then DTR and RTS, as a terminal program does when it opens the port
+        uint8_t Line_Coding[7] = { 0x00, 0xC2, 0x01, 0x00, 0, 0, 8 };
+        if((Control(0x21, 0x20, 0, 0, Line_Coding, sizeof(Line_Coding)) != (int)sizeof(Line_Coding))
+           || (Control(0xA1, 0x21, 0, 0, Line_Coding, sizeof(Line_Coding)) != (int)sizeof(Line_Coding))
+           || (Control(0x21, 0x22, 3, 0, NULL, 0) != 0))
+        {
+            Fail("CDC class requests");
+            return;
+        }
+    }
+    else
+    {   // HID: SET_IDLE 0 so reports are only sent when there is something new
+        if(Control(0x21, 0x0A, 0, 0, NULL, 0) != 0)
+        {
+            Fail("HID SET_IDLE");
+            return;
+        }
+    }
+
+    Sim_PCD_Stats_Type After;
+    uint32_t Boot_ms[NUM_BOOT_MILESTONES];
+    Sim_PCD_Get_Stats(&After);
+    Diagnostics_Get_Boot(Boot_ms);
+    printf("Enumerated in %lu ms, %lu transactions, %lu NAKed, %lu STALLed\n", (unsigned long)(Frame_ms - Start_ms),
+           (unsigned long)(After.Transactions - Before.Transactions), (unsigned long)(After.Naks - Before.Naks),
+           (unsigned long)(After.Stalls - Before.Stalls));
+    printf("Boot record: first bus reset at %lu ms, configured at %lu ms\n", (unsigned long)Boot_ms[BOOT_USB_RESET],
+           (unsigned long)Boot_ms[BOOT_USB_CONFIGURED]);
+    if((Boot_ms[BOOT_USB_RESET] == 0) || (Boot_ms[BOOT_USB_CONFIGURED] < Boot_ms[BOOT_USB_RESET]))
+    {
+        Fail("boot record");
+    }
+
+    // an unsupported request must be STALLed, and the next request must still work
+    if(Control(0x80, 6, (0x0F << 8), 0, Desc, 64) != SIM_STALL)
+    {
+        Fail("unsupported descriptor request was not STALLed");
+    }
+    if(Control(0x80, 0, 0, 0, Desc, 2) != 2)
+    {
+        Fail("GET_STATUS after a STALL");
+    }
+}
+
+/**
+  * @brief  Host CPU time, to show the cost of the stack per packet on the build machine
+  * @retval Nanoseconds
+  */
+static uint64_t Host_ns(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return ((uint64_t)Now.tv_sec * 1000000000U) + (uint64_t)Now.tv_nsec;
+}
+
+/**
+  * @brief  Print the throughput of a stream
+  * @param  Name: Stream name
+  * @param  Bytes: Payload bytes moved
+  * @param  Packets: Packets moved
+  * @param  Start_ms: Frame the stream started in
+  * @param  Stats_Before: Peripheral counts when the stream started
+  * @param  Cpu_ns: Host CPU time the stream took
+  * @retval None
+  */
+static void Print_Stream(const char *Name, uint32_t Bytes, uint32_t Packets, uint32_t Start_ms, const Sim_PCD_Stats_Type *Stats_Before, uint64_t Cpu_ns)
+{
+    Sim_PCD_Stats_Type Stats;
+    uint32_t ms = Frame_ms - Start_ms;
+
+    Sim_PCD_Get_Stats(&Stats);
+    if(ms == 0)
+    {
+        ms = 1;
+    }
+    printf("%s: %lu bytes in %lu packets over %lu ms = %lu KB/s, %.1f packets per frame, %lu NAKed, %.0f ns host CPU per packet\n",
+           Name, (unsigned long)Bytes, (unsigned long)Packets, (unsigned long)ms, (unsigned long)(Bytes / ms), (double)Packets / ms,
+           (unsigned long)(Stats.Naks - Stats_Before->Naks), (Packets != 0) ? (double)Cpu_ns / Packets : 0.0);
+}
+
+/**
+  * @brief  Stream bytes to the device in full packets, as a PC serial or HID driver would, and check they all arrive
+  * @retval None
+  */
+static void Stream_Out(void)
+{
+    static uint8_t Urb[SIM_OUT_URB_SIZE];
+    Sim_PCD_Stats_Type Before;
+    uint32_t Start_ms = Frame_ms;
+    uint32_t Sent = 0;
+    uint32_t Packets = 0;
+    uint32_t Rx_Start = Sim_App_Rx_Bytes;
+
+    Sim_PCD_Get_Stats(&Before);
+    uint64_t Cpu_Start = Host_ns();
+    while(Sent < SIM_OUT_BYTES)
+    {
+        for(uint32_t i = 0; i < SIM_OUT_URB_SIZE; i++)
+        {
+            Urb[i] = Sim_App_Pattern(Sent + i);
+        }
+        for(uint32_t Done = 0; Done < SIM_OUT_URB_SIZE; Done += Data_Out.Max_Packet)
+        {
+            if(Host_Out(&Data_Out, &Urb[Done], Data_Out.Max_Packet, 1000) != SIM_ACK)
+            {
+                Fail("OUT stream stopped");
+                return;
+            }
+            Packets++;
+        }
+        Sent += SIM_OUT_URB_SIZE;
+    }
+    uint64_t Cpu_ns = Host_ns() - Cpu_Start;
+
+    Print_Stream("OUT", Sent, Packets, Start_ms, &Before, Cpu_ns);
+    if((Sim_App_Rx_Bytes - Rx_Start) != Sent)
+    {
+        Fail("OUT stream bytes lost");
+    }
+    if(Sim_App_Rx_Errors != 0)
+    {
+        Fail("OUT stream bytes corrupted or out of order");
+    }
+}
+
+/**
+  * @brief  Read frames from the device, as the firmware sends command replies, and check they all arrive
+  * @retval None
+  */
+static void Stream_In(void)
+{
+    Sim_PCD_Stats_Type Before;
+    uint8_t Packet[64];
+    uint32_t Start_ms = Frame_ms;
+    uint32_t Frames = 0;
+    uint32_t Errors = 0;
+
+    Sim_PCD_Get_Stats(&Before);
+    Streaming_In = true;
+    uint64_t Cpu_Start = Host_ns();
+    while(Frames < SIM_IN_FRAMES)
+    {
+        int Len = Host_In(&Data_In, Packet, 1000);
+        if(Len < (int)SIM_APP_TX_FRAME_SIZE)
+        {
+            Fail("IN stream stopped or short frame");
+            Streaming_In = false;
+            return;
+        }
+        for(uint32_t i = 0; i < SIM_APP_TX_FRAME_SIZE; i++)
+        {   // one frame per packet. HID reports are padded after the frame
+            if(Packet[i] != Sim_App_Pattern((Frames * SIM_APP_TX_FRAME_SIZE) + i))
+            {
+                Errors++;
+            }
+        }
+        Frames++;
+    }
+    uint64_t Cpu_ns = Host_ns() - Cpu_Start;
+    Streaming_In = false;
+
+    Print_Stream("IN", Frames * SIM_APP_TX_FRAME_SIZE, Frames, Start_ms, &Before, Cpu_ns);
+    if(Errors != 0)
+    {
+        Fail("IN stream bytes corrupted or out of order");
+    }
+}
+
+/**
+  * @brief  Suspend the bus for 10 ms, then resume it and check the device still answers
+  * @retval None
+  */
+static void Suspend_Resume(void)
+{
+    uint8_t Status[2];
+
+    Frame_ms += 3;      // no start of frames for 3 ms is a suspend
+    Sim_PCD_Suspend();
+    Frame_ms += 10;
+    Sim_PCD_Resume();
+    Idle_Frames(10);    // resume recovery
+    if(Control(0x80, 0, 0, 0, Status, sizeof(Status)) != (int)sizeof(Status))
+    {
+        Fail("device did not answer after resume");
+    }
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return Frame_ms;
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+    Frame_ms += Delay;
+}
+
+int main(void)
+{
+    MX_USB_DEVICE_Init();
+
+    Enumerate();
+    if(Failures == 0)
+    {
+        Stream_Out();
+        Stream_In();
+        Suspend_Resume();
+    }
+
+    Sim_PCD_Stats_Type Stats;
+    Buffer_Pool_Usage_Type Pool;
+    uint32_t Diag[NUM_DIAG_COUNTERS];
+
+    Sim_PCD_Get_Stats(&Stats);
+    Buffer_Pool_Get_Usage(&Pool);
+    Diagnostics_Snapshot(Diag);
+    printf("PMA: %u of %u bytes used, %lu layout errors, %lu OUT overruns\n", Stats.Pma_High_Water, SIM_PMA_SIZE,
+           (unsigned long)Stats.Pma_Errors, (unsigned long)Stats.Overruns);
+    printf("Buffer pool: peak %u of %u blocks, %lu failed allocations\n", Pool.Peak, Pool.Total, (unsigned long)Pool.Fails);
+    printf("Firmware counters: %lu SOF, %lu resets, %lu suspends, %lu resumes, %lu transmits busy\n", (unsigned long)Sim_App_SOFs,
+           (unsigned long)Diag[DIAG_USB_RESET], (unsigned long)Diag[DIAG_USB_SUSPEND], (unsigned long)Diag[DIAG_USB_RESUME],
+           (unsigned long)Sim_App_Tx_Busy);
+
+    if((Stats.Pma_Errors != 0) || (Stats.Overruns != 0))
+    {
+        Fail("packet memory");
+    }
+    if(Failures != 0)
+    {
+        printf("%d check(s) failed\n", Failures);
+        return EXIT_FAILURE;
+    }
+    printf("All checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,743 @@
+/**
+  @file Sim_PCD.c
+  @brief Host simulation of the USB peripheral, so the unmodified USB device library and usbd_conf.c run in a Linux process.
+  @details This replaces the HAL PCD driver (stm32f0xx_hal_pcd.c and stm32f0xx_ll_usb.c) with the same API. Instead of an interrupt
+           handler reading the peripheral registers, the simulated host calls Sim_PCD_Setup(), Sim_PCD_Out() and Sim_PCD_In()
+           for each transaction, and these call the same HAL_PCD_xxxCallback()s in usbd_conf.c that the real interrupt handler does,
+           in the same order and with the same endpoint fields set.
+
+           - Packet memory: each endpoint's buffers are placed in a 1 KB PMA array at the addresses usbd_conf.c gives with
+             HAL_PCDEx_PMAConfig(), and the buffer table at the start of the PMA holds their addresses and counts, as on the chip.
+             Every packet is copied through the PMA, and the host reads the packet length back from the buffer table, so a buffer
+             overlapping the table or another buffer corrupts the data the same way it would on the chip.
+             When an endpoint is opened its buffers are also checked, and any problem is reported and counted.
+           - Double buffered endpoints alternate between their two PMA buffers on each packet.
+           - Endpoint status follows the STAT_TX/STAT_RX bits: an IN endpoint is VALID while a packet is waiting for the host, an
+             OUT endpoint while a transfer is armed, otherwise NAK. A SETUP is always accepted and sets both directions of EP0 to NAK.
+           - Multi packet transfers are split and completed as the HAL does: EP0 completes after every packet and the library asks
+             for the next, other endpoints complete on the last packet, or on a short OUT packet.
+           - A new device address takes effect after the status stage of SET_ADDRESS, and the device only answers its own address.
+
+           Not modelled: timing inside a frame (every transaction completes instantly), isochronous endpoints, data toggles,
+           and the hardware accepting a second OUT packet into the free half of a double buffer while the transfer is not armed.
+
+           How to use:
+           1. Build the USB_DEVICE and USB device library sources with Sim/Inc first on the include path, and link this file
+              instead of the HAL PCD driver.
+           2. Call MX_USB_DEVICE_Init() as the firmware does. Then drive the bus from the host side:
+              Sim_PCD_Bus_Reset(), Sim_PCD_SOF(), Sim_PCD_Suspend(), Sim_PCD_Resume() for bus events,
+              Sim_PCD_Setup(), Sim_PCD_Out() and Sim_PCD_In() for one transaction each.
+           3. Call Sim_PCD_Get_Stats() to read the transaction counts and any packet memory errors.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Sim_PCD.h"
+#include "stm32f0xx_hal.h"
+
+/**
+  * @brief  Endpoint status, as set in the STAT_TX/STAT_RX bits of the endpoint register
+  */
+typedef enum
+{
+    SIM_EP_DISABLED,        // Not open, the endpoint does not answer
+    SIM_EP_NAK,             // Open, but the firmware has nothing to send or nowhere to receive
+    SIM_EP_VALID,           // IN: a packet is waiting in the PMA. OUT: a transfer is armed
+    SIM_EP_STALL,           // Halted
+}SIM_EP_STATUS;
+
+/**
+  * @brief  Simulated state of one direction of an endpoint, beside the HAL's own PCD_EPTypeDef
+  */
+typedef struct
+{
+    SIM_EP_STATUS Status;
+    uint8_t Buf;            // Double buffered: the PMA buffer the next packet goes through, 0 or 1
+}Sim_EP_Type;
+
+USB_TypeDef Sim_USB_Regs;                                       /// Simulated USB registers, only DADDR, FNR and BTABLE are used
+uint32_t Sim_UID[3] = { 0x00300021U, 0x3335470AU, 0x20353038U };/// Simulated unique device ID, it gives the USB serial number
+uint8_t Sim_PMA[SIM_PMA_SIZE];                                  /// The packet memory
+
+static PCD_HandleTypeDef *Sim_Hpcd = NULL;                      /// Handle given to HAL_PCD_Init()
+static Sim_EP_Type Sim_In[SIM_NUM_EPS];
+static Sim_EP_Type Sim_Out[SIM_NUM_EPS];
+static bool Sim_Connected = false;                              /// D+ pull up on, the host can see the device
+static Sim_PCD_Stats_Type Sim_Stats;
+
+/**
+  * @brief  Round a buffer size up to the block size the peripheral allocates for it
+  * @param  Max_Packet: Endpoint max packet size
+  * @retval Bytes of PMA the buffer takes
+  */
+static uint16_t Pma_Buf_Size(uint32_t Max_Packet)
+{
+    if(Max_Packet > 62)
+    {
+        return (uint16_t)((Max_Packet + 31) & ~31U);    // 32 byte blocks
+    }
+    return (uint16_t)((Max_Packet + 1) & ~1U);          // 2 byte blocks
+}
+
+/**
+  * @brief  Write a half word of the buffer table
+  * @param  Addr: PMA byte address
+  * @param  Value: Value to write
+  * @retval None
+  */
+static void Pma_Write16(uint16_t Addr, uint16_t Value)
+{
+    if(Addr + 1 < SIM_PMA_SIZE)
+    {
+        Sim_PMA[Addr] = (uint8_t)Value;
+        Sim_PMA[Addr + 1] = (uint8_t)(Value >> 8);
+    }
+}
+
+/**
+  * @brief  Read a half word of the buffer table
+  * @param  Addr: PMA byte address
+  * @retval The value
+  */
+static uint16_t Pma_Read16(uint16_t Addr)
+{
+    if(Addr + 1 < SIM_PMA_SIZE)
+    {
+        return (uint16_t)(Sim_PMA[Addr] | (Sim_PMA[Addr + 1] << 8));
+    }
+    return 0;
+}
+
+/**
+  * @brief  PMA byte address of the buffer table entry an endpoint buffer uses for its address. Its count follows it
+  * @param  Ep: The endpoint
+  * @param  Buf: Double buffered: the buffer, 0 or 1
+  * @retval PMA byte address
+  */
+static uint16_t Btable_Entry(const PCD_EPTypeDef *Ep, uint8_t Buf)
+{
+    uint16_t Entry = (uint16_t)(Sim_USB_Regs.BTABLE + (Ep->num * 8U));
+
+    if(Ep->doublebuffer != 0U)
+    {
+        return (uint16_t)(Entry + (Buf * 4U));  // buffer 0 uses the TX half of the entry, buffer 1 the RX half
+    }
+    return (Ep->is_in != 0U) ? Entry : (uint16_t)(Entry + 4U);
+}
+
+/**
+  * @brief  PMA byte address of the buffer the next packet of an endpoint goes through
+  * @param  Ep: The endpoint
+  * @param  Sim: Simulated state of the endpoint
+  * @retval PMA byte address
+  */
+static uint16_t Pma_Buf_Addr(const PCD_EPTypeDef *Ep, const Sim_EP_Type *Sim)
+{
+    if(Ep->doublebuffer != 0U)
+    {
+        return (Sim->Buf != 0U) ? Ep->pmaaddr1 : Ep->pmaaddr0;
+    }
+    return Ep->pmaadress;
+}
+
+/**
+  * @brief  Get the HAL and simulated state of an endpoint
+  * @param  Ep_Addr: Endpoint address, bit 7 set for IN
+  * @param  Sim: Set to the simulated state
+  * @retval The HAL endpoint
+  */
+static PCD_EPTypeDef *Get_EP(uint8_t Ep_Addr, Sim_EP_Type **Sim)
+{
+    uint8_t Num = Ep_Addr & EP_ADDR_MSK;
+
+    if((Ep_Addr & 0x80U) != 0U)
+    {
+        *Sim = &Sim_In[Num];
+        return &Sim_Hpcd->IN_ep[Num];
+    }
+    *Sim = &Sim_Out[Num];
+    return &Sim_Hpcd->OUT_ep[Num];
+}
+
+/**
+  * @brief  Check one PMA buffer of an open endpoint against the PMA size, the buffer table and every other open buffer
+  * @param  Ep: The endpoint
+  * @param  Addr: PMA byte address of the buffer
+  * @retval None
+  */
+static void Check_Pma_Buf(const PCD_EPTypeDef *Ep, uint16_t Addr)
+{
+    uint8_t Ep_Addr = (uint8_t)(Ep->num | ((Ep->is_in != 0U) ? 0x80U : 0U));
+    uint32_t End = Addr + Pma_Buf_Size(Ep->maxpacket);
+    uint8_t Highest = 0;
+
+    for(uint8_t n = 0; n < SIM_NUM_EPS; n++)
+    {
+        if((Sim_In[n].Status != SIM_EP_DISABLED) || (Sim_Out[n].Status != SIM_EP_DISABLED))
+        {
+            Highest = n;
+        }
+    }
+    uint32_t Btable_End = Sim_USB_Regs.BTABLE + ((Highest + 1U) * 8U);
+
+    if((Addr & 1U) != 0U)
+    {
+        fprintf(stderr, "Sim PCD: EP 0x%02X buffer at 0x%03X is not half word aligned\n", Ep_Addr, Addr);
+        Sim_Stats.Pma_Errors++;
+    }
+    if(End > SIM_PMA_SIZE)
+    {
+        fprintf(stderr, "Sim PCD: EP 0x%02X buffer 0x%03X-0x%03lX runs past the end of the PMA\n", Ep_Addr, Addr, (unsigned long)End - 1);
+        Sim_Stats.Pma_Errors++;
+    }
+    if((Addr < Btable_End) && (End > Sim_USB_Regs.BTABLE))
+    {
+        fprintf(stderr, "Sim PCD: EP 0x%02X buffer at 0x%03X overlaps the buffer table, which ends at 0x%03lX\n", Ep_Addr, Addr, (unsigned long)Btable_End);
+        Sim_Stats.Pma_Errors++;
+    }
+    if(End > Sim_Stats.Pma_High_Water)
+    {
+        Sim_Stats.Pma_High_Water = (uint16_t)End;
+    }
+
+    for(uint8_t i = 0; i < (SIM_NUM_EPS * 2U); i++)
+    {
+        const PCD_EPTypeDef *Other = (i < SIM_NUM_EPS) ? &Sim_Hpcd->IN_ep[i] : &Sim_Hpcd->OUT_ep[i - SIM_NUM_EPS];
+        const Sim_EP_Type *Other_Sim = (i < SIM_NUM_EPS) ? &Sim_In[i] : &Sim_Out[i - SIM_NUM_EPS];
+
+        if((Other == Ep) || (Other_Sim->Status == SIM_EP_DISABLED))
+        {
+            continue;
+        }
+        for(uint8_t b = 0; b < ((Other->doublebuffer != 0U) ? 2U : 1U); b++)
+        {
+            uint16_t Other_Addr = (Other->doublebuffer != 0U) ? ((b != 0U) ? Other->pmaaddr1 : Other->pmaaddr0) : Other->pmaadress;
+            uint32_t Other_End = Other_Addr + Pma_Buf_Size(Other->maxpacket);
+
+            if((Addr < Other_End) && (End > Other_Addr))
+            {
+                fprintf(stderr, "Sim PCD: EP 0x%02X buffer at 0x%03X overlaps EP 0x%02X buffer at 0x%03X\n", Ep_Addr, Addr,
+                        (unsigned)(Other->num | ((Other->is_in != 0U) ? 0x80U : 0U)), Other_Addr);
+                Sim_Stats.Pma_Errors++;
+            }
+        }
+    }
+}
+
+/**
+  * @brief  Copy the next packet of the current IN transfer into the PMA and make the endpoint VALID
+  * @param  Ep: The IN endpoint
+  * @param  Sim: Simulated state of the endpoint
+  * @retval None
+  */
+static void In_Load_Packet(PCD_EPTypeDef *Ep, Sim_EP_Type *Sim)
+{
+    uint32_t Len = Ep->xfer_len - Ep->xfer_count;
+    if(Len > Ep->maxpacket)
+    {
+        Len = Ep->maxpacket;
+    }
+
+    uint16_t Addr = Pma_Buf_Addr(Ep, Sim);
+    if((Len != 0U) && ((Addr + Len) <= SIM_PMA_SIZE))
+    {
+        memcpy(&Sim_PMA[Addr], Ep->xfer_buff, Len);
+    }
+    Pma_Write16((uint16_t)(Btable_Entry(Ep, Sim->Buf) + 2U), (uint16_t)Len);
+    Sim->Status = SIM_EP_VALID;
+}
+
+/**
+  * @brief  Does the device answer this address
+  * @param  Addr: USB device address the host is using
+  * @retval true if the device is connected, enabled and at that address
+  */
+static bool Addressed(uint8_t Addr)
+{
+    return Sim_Connected && ((Sim_USB_Regs.DADDR & USB_DADDR_EF) != 0U) && ((Sim_USB_Regs.DADDR & 0x7FU) == Addr);
+}
+
+/**
+  * @brief  Count a transaction and how the endpoint answered it
+  * @param  Status: The endpoint status when the token arrived
+  * @retval The result if the endpoint can't take the transaction, or SIM_ACK if it can
+  */
+static int Token_Result(SIM_EP_STATUS Status)
+{
+    Sim_Stats.Transactions++;
+    switch(Status)
+    {
+        case SIM_EP_DISABLED:
+            return SIM_NO_RESPONSE;
+        case SIM_EP_NAK:
+            Sim_Stats.Naks++;
+            return SIM_NAK;
+        case SIM_EP_STALL:
+            Sim_Stats.Stalls++;
+            return SIM_STALL;
+        default:
+            return SIM_ACK;
+    }
+}
+
+/*******************************************************************************
+                       HAL PCD API used by usbd_conf.c
+*******************************************************************************/
+
+HAL_StatusTypeDef HAL_PCD_Init(PCD_HandleTypeDef *hpcd)
+{
+    if(hpcd == NULL)
+    {
+        return HAL_ERROR;
+    }
+
+    Sim_Hpcd = hpcd;
+    hpcd->State = HAL_PCD_STATE_BUSY;
+    HAL_PCD_MspInit(hpcd);
+
+    for(uint8_t i = 0; i < hpcd->Init.dev_endpoints; i++)
+    {
+        memset(&hpcd->IN_ep[i], 0, sizeof(hpcd->IN_ep[i]));
+        hpcd->IN_ep[i].is_in = 1U;
+        hpcd->IN_ep[i].num = i;
+        hpcd->IN_ep[i].type = EP_TYPE_CTRL;
+        memset(&hpcd->OUT_ep[i], 0, sizeof(hpcd->OUT_ep[i]));
+        hpcd->OUT_ep[i].num = i;
+        hpcd->OUT_ep[i].type = EP_TYPE_CTRL;
+    }
+    memset(Sim_In, 0, sizeof(Sim_In));
+    memset(Sim_Out, 0, sizeof(Sim_Out));
+    memset(&Sim_USB_Regs, 0, sizeof(Sim_USB_Regs));
+
+    hpcd->USB_Address = 0U;
+    hpcd->State = HAL_PCD_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_DeInit(PCD_HandleTypeDef *hpcd)
+{
+    hpcd->State = HAL_PCD_STATE_BUSY;
+    (void)HAL_PCD_Stop(hpcd);
+    HAL_PCD_MspDeInit(hpcd);
+    hpcd->State = HAL_PCD_STATE_RESET;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_Start(PCD_HandleTypeDef *hpcd)
+{
+    (void)hpcd;
+    Sim_Connected = true;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_Stop(PCD_HandleTypeDef *hpcd)
+{
+    (void)hpcd;
+    Sim_Connected = false;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_DevConnect(PCD_HandleTypeDef *hpcd)
+{
+    return HAL_PCD_Start(hpcd);
+}
+
+HAL_StatusTypeDef HAL_PCD_DevDisconnect(PCD_HandleTypeDef *hpcd)
+{
+    return HAL_PCD_Stop(hpcd);
+}
+
+HAL_StatusTypeDef HAL_PCD_SetAddress(PCD_HandleTypeDef *hpcd, uint8_t address)
+{
+    hpcd->USB_Address = address;
+    if(address == 0U)
+    {
+        Sim_USB_Regs.DADDR = USB_DADDR_EF;
+    }
+    return HAL_OK;      // a new address is applied after the status stage, see Sim_PCD_In()
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Open(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint16_t ep_mps, uint8_t ep_type)
+{
+    (void)hpcd;
+    Sim_EP_Type *Sim;
+    PCD_EPTypeDef *Ep = Get_EP(ep_addr, &Sim);
+
+    Ep->is_in = ((ep_addr & 0x80U) != 0U) ? 1U : 0U;
+    Ep->num = ep_addr & EP_ADDR_MSK;
+    Ep->maxpacket = ep_mps;
+    Ep->type = ep_type;
+    Ep->is_stall = 0U;
+    Sim->Status = SIM_EP_NAK;
+    Sim->Buf = 0U;
+
+    uint16_t Entry = (uint16_t)(Sim_USB_Regs.BTABLE + (Ep->num * 8U));
+    if(Ep->doublebuffer != 0U)
+    {
+        Pma_Write16(Entry, Ep->pmaaddr0);
+        Pma_Write16((uint16_t)(Entry + 4U), Ep->pmaaddr1);
+        Check_Pma_Buf(Ep, Ep->pmaaddr0);
+        Check_Pma_Buf(Ep, Ep->pmaaddr1);
+    }
+    else
+    {
+        Pma_Write16((Ep->is_in != 0U) ? Entry : (uint16_t)(Entry + 4U), Ep->pmaadress);
+        Check_Pma_Buf(Ep, Ep->pmaadress);
+    }
+
+    if((Ep->num == 0U) && (Ep->is_in == 0U))
+    {
+        Sim->Status = SIM_EP_VALID;     // the control OUT endpoint is opened ready to receive
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Close(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
+{
+    (void)hpcd;
+    Sim_EP_Type *Sim;
+    (void)Get_EP(ep_addr, &Sim);
+
+    Sim->Status = SIM_EP_DISABLED;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Receive(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len)
+{
+    (void)hpcd;
+    Sim_EP_Type *Sim;
+    PCD_EPTypeDef *Ep = Get_EP(ep_addr & EP_ADDR_MSK, &Sim);
+
+    Ep->xfer_buff = pBuf;
+    Ep->xfer_len = len;
+    Ep->xfer_count = 0U;
+    if(Sim->Status != SIM_EP_DISABLED)
+    {
+        Sim->Status = SIM_EP_VALID;
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Transmit(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len)
+{
+    (void)hpcd;
+    Sim_EP_Type *Sim;
+    PCD_EPTypeDef *Ep = Get_EP(ep_addr | 0x80U, &Sim);
+
+    Ep->xfer_buff = pBuf;
+    Ep->xfer_len = len;
+    Ep->xfer_count = 0U;
+    if(Sim->Status != SIM_EP_DISABLED)
+    {
+        In_Load_Packet(Ep, Sim);
+    }
+    return HAL_OK;
+}
+
+uint32_t HAL_PCD_EP_GetRxCount(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
+{
+    return hpcd->OUT_ep[ep_addr & EP_ADDR_MSK].xfer_count;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_SetStall(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
+{
+    if((uint32_t)(ep_addr & EP_ADDR_MSK) > hpcd->Init.dev_endpoints)
+    {
+        return HAL_ERROR;
+    }
+    Sim_EP_Type *Sim;
+    PCD_EPTypeDef *Ep = Get_EP(ep_addr, &Sim);
+
+    Ep->is_stall = 1U;
+    Sim->Status = SIM_EP_STALL;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_ClrStall(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
+{
+    if((uint32_t)(ep_addr & EP_ADDR_MSK) > hpcd->Init.dev_endpoints)
+    {
+        return HAL_ERROR;
+    }
+    Sim_EP_Type *Sim;
+    PCD_EPTypeDef *Ep = Get_EP(ep_addr, &Sim);
+
+    Ep->is_stall = 0U;
+    Sim->Status = (Ep->is_in != 0U) ? SIM_EP_NAK : SIM_EP_VALID;    // as the LL driver, OUT goes back to receiving
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Flush(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
+{
+    (void)hpcd;
+    (void)ep_addr;
+    return HAL_OK;      // nothing to flush on this peripheral
+}
+
+HAL_StatusTypeDef HAL_PCDEx_PMAConfig(PCD_HandleTypeDef *hpcd, uint16_t ep_addr, uint16_t ep_kind, uint32_t pmaadress)
+{
+    PCD_EPTypeDef *Ep = ((ep_addr & 0x80U) != 0U) ? &hpcd->IN_ep[ep_addr & EP_ADDR_MSK] : &hpcd->OUT_ep[ep_addr & EP_ADDR_MSK];
+
+    if(ep_kind == PCD_SNG_BUF)
+    {
+        Ep->doublebuffer = 0U;
+        Ep->pmaadress = (uint16_t)pmaadress;
+    }
+    else
+    {
+        Ep->doublebuffer = 1U;
+        Ep->pmaaddr0 = (uint16_t)(pmaadress & 0xFFFFU);
+        Ep->pmaaddr1 = (uint16_t)((pmaadress & 0xFFFF0000U) >> 16);
+    }
+    return HAL_OK;
+}
+
+/*******************************************************************************
+                       Bus events and transactions from the simulated host
+*******************************************************************************/
+
+/**
+  * @brief  USB reset from the host. Every endpoint is disabled and the address cleared, then the library reopens EP0
+  * @retval None
+  */
+void Sim_PCD_Bus_Reset(void)
+{
+    if(!Sim_Connected)
+    {
+        return;
+    }
+    for(uint8_t n = 0; n < SIM_NUM_EPS; n++)
+    {
+        Sim_In[n].Status = SIM_EP_DISABLED;
+        Sim_Out[n].Status = SIM_EP_DISABLED;
+    }
+    Sim_USB_Regs.DADDR = 0U;
+
+    HAL_PCD_ResetCallback(Sim_Hpcd);
+    (void)HAL_PCD_SetAddress(Sim_Hpcd, 0U);
+}
+
+/**
+  * @brief  Start of frame from the host
+  * @retval None
+  */
+void Sim_PCD_SOF(void)
+{
+    if(!Sim_Connected)
+    {
+        return;
+    }
+    Sim_USB_Regs.FNR = (uint16_t)((Sim_USB_Regs.FNR + 1U) & USB_FNR_FN);
+    HAL_PCD_SOFCallback(Sim_Hpcd);
+}
+
+/**
+  * @brief  The host has stopped sending frames for 3 ms
+  * @retval None
+  */
+void Sim_PCD_Suspend(void)
+{
+    if(Sim_Connected)
+    {
+        HAL_PCD_SuspendCallback(Sim_Hpcd);
+    }
+}
+
+/**
+  * @brief  The host has resumed the bus
+  * @retval None
+  */
+void Sim_PCD_Resume(void)
+{
+    if(Sim_Connected)
+    {
+        HAL_PCD_ResumeCallback(Sim_Hpcd);
+    }
+}
+
+/**
+  * @brief  SETUP transaction to EP0
+  * @param  Addr: Device address
+  * @param  Setup: The 8 byte setup packet
+  * @retval SIM_ACK, or SIM_NO_RESPONSE if no device answers at that address
+  */
+int Sim_PCD_Setup(uint8_t Addr, const uint8_t Setup[8])
+{
+    if(!Addressed(Addr))
+    {
+        return SIM_NO_RESPONSE;
+    }
+    PCD_EPTypeDef *Ep = &Sim_Hpcd->OUT_ep[0];
+    int Result = Token_Result((Sim_Out[0].Status == SIM_EP_DISABLED) ? SIM_EP_DISABLED : SIM_EP_VALID);    // SETUP is never NAKed or STALLed
+    if(Result != SIM_ACK)
+    {
+        return Result;
+    }
+
+    memcpy(&Sim_PMA[Ep->pmaadress], Setup, 8);
+    Pma_Write16((uint16_t)(Btable_Entry(Ep, 0) + 2U), 8U);
+    Sim_In[0].Status = SIM_EP_NAK;
+    Sim_Out[0].Status = SIM_EP_NAK;
+
+    Ep->xfer_count = Pma_Read16((uint16_t)(Btable_Entry(Ep, 0) + 2U));
+    memcpy(Sim_Hpcd->Setup, &Sim_PMA[Ep->pmaadress], Ep->xfer_count);
+    HAL_PCD_SetupStageCallback(Sim_Hpcd);
+    return SIM_ACK;
+}
+
+/**
+  * @brief  OUT transaction
+  * @param  Addr: Device address
+  * @param  Ep_Num: Endpoint number
+  * @param  Data: The packet
+  * @param  Len: Packet length, no more than the endpoint max packet size
+  * @retval SIM_ACK, SIM_NAK, SIM_STALL, or SIM_NO_RESPONSE if no device or endpoint answers or the packet is too long
+  */
+int Sim_PCD_Out(uint8_t Addr, uint8_t Ep_Num, const uint8_t *Data, uint16_t Len)
+{
+    if(!Addressed(Addr) || (Ep_Num >= SIM_NUM_EPS))
+    {
+        return SIM_NO_RESPONSE;
+    }
+    Sim_EP_Type *Sim = &Sim_Out[Ep_Num];
+    PCD_EPTypeDef *Ep = &Sim_Hpcd->OUT_ep[Ep_Num];
+    int Result = Token_Result(Sim->Status);
+    if(Result != SIM_ACK)
+    {
+        return Result;
+    }
+    if(Len > Ep->maxpacket)
+    {
+        return SIM_NO_RESPONSE;     // babble, the peripheral drops it
+    }
+
+    // host side: the packet lands in the PMA and its length in the buffer table
+    uint16_t Pma_Addr = Pma_Buf_Addr(Ep, Sim);
+    uint16_t Count_Addr = (uint16_t)(Btable_Entry(Ep, Sim->Buf) + 2U);
+    if(Len != 0U)
+    {
+        memcpy(&Sim_PMA[Pma_Addr], Data, Len);
+    }
+    Pma_Write16(Count_Addr, Len);
+    if(Ep->doublebuffer != 0U)
+    {
+        Sim->Buf ^= 1U;
+    }
+
+    // device side: what the HAL does in the endpoint interrupt
+    uint32_t Count = Pma_Read16(Count_Addr) & 0x3FFU;
+    uint32_t Space = (Ep->num == 0U) ? Ep->xfer_len : (Ep->xfer_len - Ep->xfer_count);
+    if((Count > Space) && (Ep->xfer_buff != NULL))
+    {
+        fprintf(stderr, "Sim PCD: EP 0x%02X received %lu bytes with %lu left in the transfer\n", Ep_Num, (unsigned long)Count, (unsigned long)Space);
+        Sim_Stats.Overruns++;
+        Count = Space;
+    }
+
+    if(Ep->num == 0U)
+    {
+        Ep->xfer_count = Count;
+        if((Count != 0U) && (Ep->xfer_buff != NULL))
+        {
+            memcpy(Ep->xfer_buff, &Sim_PMA[Pma_Addr], Count);
+            Ep->xfer_buff += Count;
+            HAL_PCD_DataOutStageCallback(Sim_Hpcd, 0U);
+        }
+        if(Sim->Status == SIM_EP_VALID || Sim->Status == SIM_EP_NAK)
+        {
+            Sim->Status = SIM_EP_VALID;     // the HAL leaves the control OUT endpoint ready for the next packet
+        }
+        return SIM_ACK;
+    }
+
+    if(Count != 0U)
+    {
+        memcpy(Ep->xfer_buff, &Sim_PMA[Pma_Addr], Count);
+    }
+    Ep->xfer_count += Count;
+    Ep->xfer_buff += Count;
+    if((Ep->xfer_count >= Ep->xfer_len) || (Count < Ep->maxpacket))
+    {
+        Sim->Status = SIM_EP_NAK;
+        HAL_PCD_DataOutStageCallback(Sim_Hpcd, Ep_Num);
+    }
+    return SIM_ACK;
+}
+
+/**
+  * @brief  IN transaction
+  * @param  Addr: Device address
+  * @param  Ep_Num: Endpoint number
+  * @param  Data: Filled with the packet
+  * @param  Max_Len: Size of Data
+  * @retval The packet length, or SIM_NAK, SIM_STALL or SIM_NO_RESPONSE
+  */
+int Sim_PCD_In(uint8_t Addr, uint8_t Ep_Num, uint8_t *Data, uint16_t Max_Len)
+{
+    if(!Addressed(Addr) || (Ep_Num >= SIM_NUM_EPS))
+    {
+        return SIM_NO_RESPONSE;
+    }
+    Sim_EP_Type *Sim = &Sim_In[Ep_Num];
+    PCD_EPTypeDef *Ep = &Sim_Hpcd->IN_ep[Ep_Num];
+    int Result = Token_Result(Sim->Status);
+    if(Result != SIM_ACK)
+    {
+        return Result;
+    }
+
+    // host side: read the packet and its length from the PMA
+    uint16_t Count = Pma_Read16((uint16_t)(Btable_Entry(Ep, Sim->Buf) + 2U)) & 0x3FFU;
+    uint16_t Pma_Addr = Pma_Buf_Addr(Ep, Sim);
+    if(Count > Max_Len)
+    {
+        Count = Max_Len;
+    }
+    if((Count != 0U) && ((Pma_Addr + Count) <= SIM_PMA_SIZE))
+    {
+        memcpy(Data, &Sim_PMA[Pma_Addr], Count);
+    }
+    if(Ep->doublebuffer != 0U)
+    {
+        Sim->Buf ^= 1U;
+    }
+
+    // device side: what the HAL does in the endpoint interrupt
+    Sim->Status = SIM_EP_NAK;
+    if(Ep_Num == 0U)
+    {
+        Ep->xfer_count = Count;
+        Ep->xfer_buff += Count;
+        HAL_PCD_DataInStageCallback(Sim_Hpcd, 0U);
+        if((Sim_Hpcd->USB_Address > 0U) && (Ep->xfer_len == 0U))
+        {
+            Sim_USB_Regs.DADDR = (uint16_t)(Sim_Hpcd->USB_Address | USB_DADDR_EF);
+            Sim_Hpcd->USB_Address = 0U;
+        }
+        return Count;
+    }
+
+    Ep->xfer_count += Count;
+    Ep->xfer_buff += Count;
+    if(Ep->xfer_count >= Ep->xfer_len)
+    {
+        HAL_PCD_DataInStageCallback(Sim_Hpcd, Ep_Num);
+    }
+    else
+    {
+        In_Load_Packet(Ep, Sim);
+    }
+    return Count;
+}
+
+/**
+  * @brief  Read the transaction counts and packet memory checks
+  * @param  Stats: Filled with the counts
+  * @retval None
+  */
+void Sim_PCD_Get_Stats(Sim_PCD_Stats_Type *Stats)
+{
+    *Stats = Sim_Stats;
+}
@@ -27,6 +27,8 @@
 #include "usbd_cdc_if.h"
 
 /* USER CODE BEGIN Includes */
+#include "Comms_Controller.h"
+#include "usbd_raw_hid.h"
 
 /* USER CODE END Includes */
 
@@ -64,6 +66,25 @@ USBD_HandleTypeDef hUsbDeviceFS;
 void MX_USB_DEVICE_Init(void)
 {
   /* USER CODE BEGIN USB_DEVICE_Init_PreTreatment */
+  /* D+ has been held low since Comms_Controller_Reset_USB(), release it just before the device is started */
+  Comms_Controller_Connect_USB();
+
+#if (USB_INTERFACE_HID == 1)
+  /* the HID interface replaces CDC, so start the library with it and skip the CDC registration below */
+  if (USBD_Init(&hUsbDeviceFS, &FS_Desc, DEVICE_FS) != USBD_OK)
+  {
+    Error_Handler();
+  }
+  if (USBD_RegisterClass(&hUsbDeviceFS, &USBD_RAW_HID) != USBD_OK)
+  {
+    Error_Handler();
+  }
+  if (USBD_Start(&hUsbDeviceFS) != USBD_OK)
+  {
+    Error_Handler();
+  }
+  return;
+#endif
 
   /* USER CODE END USB_DEVICE_Init_PreTreatment */
 
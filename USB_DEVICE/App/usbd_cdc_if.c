@@ -22,7 +22,11 @@
 #include "usbd_cdc_if.h"
 
 /* USER CODE BEGIN INCLUDE */
+#include "Buffer_Pool.h"
 #include "Comms_Controller.h"
+#include "Comms_Defs.h"
+#include "Diagnostics.h"
+#include "Trace.h"
 
 /* USER CODE END INCLUDE */
 
@@ -63,6 +67,12 @@
   */
 
 /* USER CODE BEGIN PRIVATE_DEFINES */
+#define CDC_RX_BUF_SIZE CDC_DATA_FS_OUT_XFER_SIZE           /* The receive buffer holds one full OUT transfer */
+#define CDC_RX_BUF_BLOCKS ((CDC_RX_BUF_SIZE + POOL_BLOCK_SIZE - 1) / POOL_BLOCK_SIZE)
+
+#if (CDC_RX_BUF_BLOCKS + COMMS_POOL_BLOCKS) > POOL_NUM_BLOCKS
+#error "The buffer pool must hold the CDC receive buffer, every queued command and one transmit frame, increase POOL_NUM_BLOCKS or reduce CDC_DATA_FS_OUT_XFER_SIZE"
+#endif
 /* USER CODE END PRIVATE_DEFINES */
 
 /**
@@ -86,15 +96,8 @@
   * @brief Private variables.
   * @{
   */
-/* Create buffer for reception and transmission           */
-/* It's up to user to redefine and/or remove those define */
-/** Received data over USB are stored in this buffer      */
-uint8_t UserRxBufferFS[APP_RX_DATA_SIZE];
-
-/** Data to send over USB CDC are stored in this buffer   */
-uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
-
 /* USER CODE BEGIN PRIVATE_VARIABLES */
+static uint8_t *Rx_Buf = NULL;                      /* Receive buffer, taken from the buffer pool when the host first configures the device */
 
 /* USER CODE END PRIVATE_VARIABLES */
 
@@ -126,6 +129,7 @@ static int8_t CDC_Init_FS(void);
 static int8_t CDC_DeInit_FS(void);
 static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t CDC_Receive_FS(uint8_t* pbuf, uint32_t *Len);
+static int8_t CDC_TransmitCplt_FS(uint8_t *pbuf, uint32_t *Len, uint8_t epnum);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -140,7 +144,8 @@ USBD_CDC_ItfTypeDef USBD_Interface_fops_FS =
   CDC_Init_FS,
   CDC_DeInit_FS,
   CDC_Control_FS,
-  CDC_Receive_FS
+  CDC_Receive_FS,
+  CDC_TransmitCplt_FS
 };
 
 /* Private functions ---------------------------------------------------------*/
@@ -152,8 +157,17 @@ static int8_t CDC_Init_FS(void)
 {
   /* USER CODE BEGIN 3 */
   /* Set Application Buffers */
-  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
-  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, NULL, 0);   /* each transmit passes its own pooled frame */
+  if (Rx_Buf == NULL)
+  {   /* claimed once and kept across re-enumeration, so the receive path can never be starved by the pool */
+    Rx_Buf = Buffer_Pool_Alloc(CDC_RX_BUF_SIZE);
+    if (Rx_Buf == NULL)
+    {
+      Error_Handler();
+    }
+  }
+  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, Rx_Buf);   /* the class arms the endpoint on this buffer after init */
+  Diagnostics_Boot_Milestone(BOOT_USB_CONFIGURED);
   return (USBD_OK);
   /* USER CODE END 3 */
 }
@@ -165,6 +179,14 @@ static int8_t CDC_Init_FS(void)
 static int8_t CDC_DeInit_FS(void)
 {
   /* USER CODE BEGIN 4 */
+  /* a frame still in flight will never complete, hand it back to the pool */
+  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  if ((hcdc != NULL) && (hcdc->TxState != 0))
+  {
+    Buffer_Pool_Free(hcdc->TxBuffer);
+    hcdc->TxState = 0;
+    Comms_Controller_Tx_Done();
+  }
   return (USBD_OK);
   /* USER CODE END 4 */
 }
@@ -260,10 +282,10 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
 static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
 {
   /* USER CODE BEGIN 6 */
-  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
-  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
-
+  /* the parser copies every byte out before it returns, so the endpoint is only re-armed on the buffer afterwards. It NAKs
+     the host until then, so a new transfer can never land on bytes that haven't been parsed */
   Comms_Controller_Bytes_Received(Buf, *Len);
+  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
 
   return (USBD_OK);
   /* USER CODE END 6 */
@@ -285,6 +307,9 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
   uint8_t result = USBD_OK;
   /* USER CODE BEGIN 7 */
   USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  if (hcdc == NULL){
+    return USBD_FAIL;   /* not configured */
+  }
   if (hcdc->TxState != 0){
     return USBD_BUSY;
   }
@@ -294,7 +319,42 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
   return result;
 }
 
+/**
+  * @brief  CDC_TransmitCplt_FS
+  *         Data transmitted callback
+  *
+  *         @note
+  *         This function is IN transfer complete callback used to inform user that
+  *         the submitted Data is successfully sent over USB.
+  *
+  * @param  Buf: Buffer of data that was sent
+  * @param  Len: Number of data sent (in bytes)
+  * @param  epnum: Endpoint number
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
+{
+  uint8_t result = USBD_OK;
+  /* USER CODE BEGIN 13 */
+  UNUSED(Len);
+  UNUSED(epnum);
+  Buffer_Pool_Free(Buf);    /* the frame is on the wire, its pool blocks can be reused */
+  TRACE(TRACE_TX_DONE, (*Len < 255) ? *Len : 255);
+  Comms_Controller_Tx_Done();
+  /* USER CODE END 13 */
+  return result;
+}
+
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+/**
+  * @brief  Check if a frame is still being sent
+  * @retval true while the last frame passed to CDC_Transmit_FS() is in flight, false if another can be sent
+  */
+bool CDC_Transmit_Busy_FS(void)
+{
+  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  return (hcdc != NULL) && (hcdc->TxState != 0);
+}
 
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
@@ -33,6 +33,8 @@
 
 /* USER CODE BEGIN PV */
 /* Private variables ---------------------------------------------------------*/
+/* Full unique ID serial number string, see USBD_FS_SerialStrDescriptor() */
+__ALIGN_BEGIN static uint8_t USBD_StringSerial_UID[USB_SIZ_STRING_SERIAL_UID] __ALIGN_END;
 
 /* USER CODE END PV */
 
@@ -65,8 +67,16 @@
 #define USBD_VID     1155
 #define USBD_LANGID_STRING     1033
 #define USBD_MANUFACTURER_STRING     "STMicroelectronics"
+#if (USB_INTERFACE_HID == 1)
+#define USBD_PID_FS     22352
+#else
 #define USBD_PID_FS     22336
+#endif
+#if (USB_INTERFACE_HID == 1)
+#define USBD_PRODUCT_STRING_FS     "STM32 Command HID"
+#else
 #define USBD_PRODUCT_STRING_FS     "STM32 Virtual ComPort"
+#endif
 #define USBD_CONFIGURATION_STRING_FS     "CDC Config"
 #define USBD_INTERFACE_STRING_FS     "CDC Interface"
 
@@ -150,8 +160,13 @@ __ALIGN_BEGIN uint8_t USBD_FS_DeviceDesc[USB_LEN_DEV_DESC] __ALIGN_END =
   USB_DESC_TYPE_DEVICE,       /*bDescriptorType*/
   0x00,                       /*bcdUSB */
   0x02,
+#if (USB_INTERFACE_HID == 1)
+  0x00,                       /*bDeviceClass: defined by the interface*/
+  0x00,                       /*bDeviceSubClass*/
+#else
   0x02,                       /*bDeviceClass*/
   0x02,                       /*bDeviceSubClass*/
+#endif
   0x00,                       /*bDeviceProtocol*/
   USB_MAX_EP0_SIZE,           /*bMaxPacketSize*/
   LOBYTE(USBD_VID),           /*idVendor*/
@@ -286,6 +301,14 @@ uint8_t * USBD_FS_SerialStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
    * ID */
   Get_SerialNum();
   /* USER CODE BEGIN USBD_FS_SerialStrDescriptor */
+  /* Use all 96 bits rather than the 48 bit mix above, so the host can match the port to the unit's identity without opening it */
+  USBD_StringSerial_UID[0] = USB_SIZ_STRING_SERIAL_UID;
+  USBD_StringSerial_UID[1] = USB_DESC_TYPE_STRING;
+  IntToUnicode(*(uint32_t *) DEVICE_ID1, &USBD_StringSerial_UID[2], 8);
+  IntToUnicode(*(uint32_t *) DEVICE_ID2, &USBD_StringSerial_UID[18], 8);
+  IntToUnicode(*(uint32_t *) DEVICE_ID3, &USBD_StringSerial_UID[34], 8);
+  *length = USB_SIZ_STRING_SERIAL_UID;
+  return USBD_StringSerial_UID;
 
   /* USER CODE END USBD_FS_SerialStrDescriptor */
   return (uint8_t *) USBD_StringSerial;
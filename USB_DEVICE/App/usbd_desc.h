@@ -52,6 +52,8 @@
 #define  USB_SIZ_STRING_SERIAL       0x1A
 
 /* USER CODE BEGIN EXPORTED_CONSTANTS */
+/* The serial number string holds all 96 bits of the unique ID as 24 hex chars, the same as the identity command reports */
+#define  USB_SIZ_STRING_SERIAL_UID   (2 + (24 * 2))
 
 /* USER CODE END EXPORTED_CONSTANTS */
 
@@ -0,0 +1,397 @@
+/**
+  ******************************************************************************
+  * @file    usbd_raw_hid.c
+  * @brief   Vendor defined HID interface carrying the Comms_Controller command frames.
+  * @details Alternative to the CDC interface, selected with USB_INTERFACE_HID in usbd_conf.h.
+  *          CDC goes through the host tty layer which adds latency that can't be controlled. A HID interrupt endpoint
+  *          is polled by the host every RAW_HID_BINTERVAL ms, so a command and its reply each take at most 1ms on the bus,
+  *          and hosts can use it through hidraw/hidapi without any driver.
+  *
+  *          Each report is RAW_HID_REPORT_SIZE bytes. The host sends one command frame per OUT report and each reply
+  *          is sent as one IN report, zero padded. Bytes after the EOP are ignored by the parser while it waits for the next SOP.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <string.h>
+
+#include "usbd_raw_hid.h"
+#include "usbd_ctlreq.h"
+#include "Comms_Controller.h"
+#include "Diagnostics.h"
+#include "Trace.h"
+
+#if (USB_INTERFACE_HID == 1)
+
+#define RAW_HID_CONFIG_DESC_SIZE    41U
+#define RAW_HID_DESC_OFFSET         18U     /* Offset of the HID descriptor in the configuration descriptor */
+#define RAW_HID_DESC_SIZE           9U
+#define RAW_HID_REPORT_DESC_SIZE    27U
+
+#define RAW_HID_DESC_TYPE           0x21U
+#define RAW_HID_REPORT_DESC_TYPE    0x22U
+
+#define RAW_HID_REQ_GET_IDLE        0x02U
+#define RAW_HID_REQ_GET_PROTOCOL    0x03U
+#define RAW_HID_REQ_SET_IDLE        0x0AU
+#define RAW_HID_REQ_SET_PROTOCOL    0x0BU
+
+static uint8_t Raw_HID_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t Raw_HID_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t Raw_HID_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
+static uint8_t Raw_HID_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+static uint8_t Raw_HID_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum);
+static uint8_t *Raw_HID_GetCfgDesc(uint16_t *length);
+static uint8_t *Raw_HID_GetDeviceQualifierDesc(uint16_t *length);
+
+USBD_ClassTypeDef USBD_RAW_HID =
+{
+  Raw_HID_Init,
+  Raw_HID_DeInit,
+  Raw_HID_Setup,
+  NULL,                 /* EP0_TxSent */
+  NULL,                 /* EP0_RxReady */
+  Raw_HID_DataIn,
+  Raw_HID_DataOut,
+  NULL,                 /* SOF */
+  NULL,
+  NULL,
+  Raw_HID_GetCfgDesc,
+  Raw_HID_GetCfgDesc,
+  Raw_HID_GetCfgDesc,
+  Raw_HID_GetDeviceQualifierDesc,
+};
+
+/* USB HID device configuration descriptor */
+__ALIGN_BEGIN static uint8_t Raw_HID_CfgDesc[RAW_HID_CONFIG_DESC_SIZE] __ALIGN_END =
+{
+  0x09,                             /* bLength: Configuration Descriptor size */
+  USB_DESC_TYPE_CONFIGURATION,      /* bDescriptorType: Configuration */
+  RAW_HID_CONFIG_DESC_SIZE,         /* wTotalLength */
+  0x00,
+  0x01,                             /* bNumInterfaces: 1 interface */
+  0x01,                             /* bConfigurationValue: Configuration value */
+  0x00,                             /* iConfiguration: Index of string descriptor describing the configuration */
+  0xC0,                             /* bmAttributes: self powered */
+  0x32,                             /* MaxPower 100 mA */
+
+  /* Interface Descriptor */
+  0x09,                             /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,          /* bDescriptorType: Interface */
+  0x00,                             /* bInterfaceNumber */
+  0x00,                             /* bAlternateSetting */
+  0x02,                             /* bNumEndpoints */
+  0x03,                             /* bInterfaceClass: HID */
+  0x00,                             /* bInterfaceSubClass: no boot */
+  0x00,                             /* bInterfaceProtocol: none */
+  0x00,                             /* iInterface */
+
+  /* HID Descriptor */
+  RAW_HID_DESC_SIZE,                /* bLength */
+  RAW_HID_DESC_TYPE,                /* bDescriptorType: HID */
+  0x11,                             /* bcdHID: 1.11 */
+  0x01,
+  0x00,                             /* bCountryCode */
+  0x01,                             /* bNumDescriptors */
+  RAW_HID_REPORT_DESC_TYPE,         /* bDescriptorType: Report */
+  RAW_HID_REPORT_DESC_SIZE,         /* wItemLength */
+  0x00,
+
+  /* Endpoint IN Descriptor */
+  0x07,                             /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,           /* bDescriptorType: Endpoint */
+  RAW_HID_EPIN_ADDR,                /* bEndpointAddress */
+  0x03,                             /* bmAttributes: Interrupt */
+  LOBYTE(RAW_HID_REPORT_SIZE),      /* wMaxPacketSize */
+  HIBYTE(RAW_HID_REPORT_SIZE),
+  RAW_HID_BINTERVAL,                /* bInterval */
+
+  /* Endpoint OUT Descriptor */
+  0x07,                             /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,           /* bDescriptorType: Endpoint */
+  RAW_HID_EPOUT_ADDR,               /* bEndpointAddress */
+  0x03,                             /* bmAttributes: Interrupt */
+  LOBYTE(RAW_HID_REPORT_SIZE),      /* wMaxPacketSize */
+  HIBYTE(RAW_HID_REPORT_SIZE),
+  RAW_HID_BINTERVAL,                /* bInterval */
+};
+
+/* Vendor defined report descriptor: one RAW_HID_REPORT_SIZE byte input report and one output report, no report IDs */
+__ALIGN_BEGIN static uint8_t Raw_HID_ReportDesc[RAW_HID_REPORT_DESC_SIZE] __ALIGN_END =
+{
+  0x06, 0x00, 0xFF,                 /* Usage Page (Vendor Defined 0xFF00) */
+  0x09, 0x01,                       /* Usage (0x01) */
+  0xA1, 0x01,                       /* Collection (Application) */
+  0x15, 0x00,                       /*   Logical Minimum (0) */
+  0x26, 0xFF, 0x00,                 /*   Logical Maximum (255) */
+  0x75, 0x08,                       /*   Report Size (8 bits) */
+  0x95, RAW_HID_REPORT_SIZE,        /*   Report Count */
+  0x09, 0x01,                       /*   Usage (0x01) */
+  0x81, 0x02,                       /*   Input (Data, Variable, Absolute) */
+  0x95, RAW_HID_REPORT_SIZE,        /*   Report Count */
+  0x09, 0x01,                       /*   Usage (0x01) */
+  0x91, 0x02,                       /*   Output (Data, Variable, Absolute) */
+  0xC0                              /* End Collection */
+};
+
+/* USB Standard Device Qualifier Descriptor */
+__ALIGN_BEGIN static uint8_t Raw_HID_DeviceQualifierDesc[USB_LEN_DEV_QUALIFIER_DESC] __ALIGN_END =
+{
+  USB_LEN_DEV_QUALIFIER_DESC,
+  USB_DESC_TYPE_DEVICE_QUALIFIER,
+  0x00,
+  0x02,
+  0x00,
+  0x00,
+  0x00,
+  0x40,
+  0x01,
+  0x00,
+};
+
+static uint8_t Rx_Report[RAW_HID_REPORT_SIZE];      /* Last OUT report received from the host */
+static uint8_t Tx_Report[RAW_HID_REPORT_SIZE];      /* IN report being sent to the host */
+static volatile bool Tx_Busy = false;               /* true while Tx_Report is waiting to be collected by the host */
+static uint8_t Idle_Rate = 0;
+static uint8_t Protocol = 0;
+
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+/**
+  * @brief  Open the report endpoints and start receiving
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t Raw_HID_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  USBD_LL_OpenEP(pdev, RAW_HID_EPIN_ADDR, USBD_EP_TYPE_INTR, RAW_HID_REPORT_SIZE);
+  pdev->ep_in[RAW_HID_EPIN_ADDR & 0xFU].is_used = 1U;
+
+  USBD_LL_OpenEP(pdev, RAW_HID_EPOUT_ADDR, USBD_EP_TYPE_INTR, RAW_HID_REPORT_SIZE);
+  pdev->ep_out[RAW_HID_EPOUT_ADDR & 0xFU].is_used = 1U;
+
+  Tx_Busy = false;
+  pdev->pClassData = Rx_Report;     /* non NULL marks the class as active, no dynamic allocation is needed */
+
+  USBD_LL_PrepareReceive(pdev, RAW_HID_EPOUT_ADDR, Rx_Report, RAW_HID_REPORT_SIZE);
+  Diagnostics_Boot_Milestone(BOOT_USB_CONFIGURED);
+  return USBD_OK;
+}
+
+/**
+  * @brief  Close the report endpoints
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t Raw_HID_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  USBD_LL_CloseEP(pdev, RAW_HID_EPIN_ADDR);
+  pdev->ep_in[RAW_HID_EPIN_ADDR & 0xFU].is_used = 0U;
+
+  USBD_LL_CloseEP(pdev, RAW_HID_EPOUT_ADDR);
+  pdev->ep_out[RAW_HID_EPOUT_ADDR & 0xFU].is_used = 0U;
+
+  if (Tx_Busy)
+  {   /* the report will never be collected */
+    Tx_Busy = false;
+    Comms_Controller_Tx_Done();
+  }
+  pdev->pClassData = NULL;
+  return USBD_OK;
+}
+
+/**
+  * @brief  Handle the HID class and interface specific requests
+  * @param  pdev: instance
+  * @param  req: usb requests
+  * @retval status
+  */
+static uint8_t Raw_HID_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
+{
+  uint8_t ifalt = 0U;
+  uint16_t status_info = 0U;
+  uint8_t ret = USBD_OK;
+
+  switch (req->bmRequest & USB_REQ_TYPE_MASK)
+  {
+    case USB_REQ_TYPE_CLASS :
+      switch (req->bRequest)
+      {
+        case RAW_HID_REQ_SET_PROTOCOL:
+          Protocol = (uint8_t)(req->wValue);
+          break;
+
+        case RAW_HID_REQ_GET_PROTOCOL:
+          USBD_CtlSendData(pdev, &Protocol, 1U);
+          break;
+
+        case RAW_HID_REQ_SET_IDLE:
+          Idle_Rate = (uint8_t)(req->wValue >> 8);
+          break;
+
+        case RAW_HID_REQ_GET_IDLE:
+          USBD_CtlSendData(pdev, &Idle_Rate, 1U);
+          break;
+
+        default:
+          /* GET_REPORT/SET_REPORT are not supported, frames only travel on the interrupt endpoints */
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+          break;
+      }
+      break;
+
+    case USB_REQ_TYPE_STANDARD:
+      switch (req->bRequest)
+      {
+        case USB_REQ_GET_STATUS:
+          if (pdev->dev_state == USBD_STATE_CONFIGURED)
+          {
+            USBD_CtlSendData(pdev, (uint8_t *)(void *)&status_info, 2U);
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case USB_REQ_GET_DESCRIPTOR:
+          if ((req->wValue >> 8) == RAW_HID_REPORT_DESC_TYPE)
+          {
+            USBD_CtlSendData(pdev, Raw_HID_ReportDesc, MIN(RAW_HID_REPORT_DESC_SIZE, req->wLength));
+          }
+          else if ((req->wValue >> 8) == RAW_HID_DESC_TYPE)
+          {
+            USBD_CtlSendData(pdev, &Raw_HID_CfgDesc[RAW_HID_DESC_OFFSET], MIN(RAW_HID_DESC_SIZE, req->wLength));
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case USB_REQ_GET_INTERFACE:
+          if (pdev->dev_state == USBD_STATE_CONFIGURED)
+          {
+            USBD_CtlSendData(pdev, &ifalt, 1U);
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case USB_REQ_SET_INTERFACE:
+          if (pdev->dev_state != USBD_STATE_CONFIGURED)
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        default:
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+          break;
+      }
+      break;
+
+    default:
+      USBD_CtlError(pdev, req);
+      ret = USBD_FAIL;
+      break;
+  }
+
+  return ret;
+}
+
+/**
+  * @brief  The host has collected the IN report
+  * @param  pdev: device instance
+  * @param  epnum: endpoint number
+  * @retval status
+  */
+static uint8_t Raw_HID_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  Tx_Busy = false;
+  TRACE(TRACE_TX_DONE, RAW_HID_REPORT_SIZE);
+  Comms_Controller_Tx_Done();
+  return USBD_OK;
+}
+
+/**
+  * @brief  An OUT report has been received. Pass it to the parser, then re-arm the endpoint.
+  *         The endpoint is only re-armed once the frame has been consumed, so the report can't be overwritten mid-parse.
+  * @param  pdev: device instance
+  * @param  epnum: endpoint number
+  * @retval status
+  */
+static uint8_t Raw_HID_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  Comms_Controller_Bytes_Received(Rx_Report, USBD_LL_GetRxDataSize(pdev, epnum));
+  USBD_LL_PrepareReceive(pdev, RAW_HID_EPOUT_ADDR, Rx_Report, RAW_HID_REPORT_SIZE);
+  return USBD_OK;
+}
+
+/**
+  * @brief  Return the configuration descriptor. The same descriptor is used at every speed.
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer
+  */
+static uint8_t *Raw_HID_GetCfgDesc(uint16_t *length)
+{
+  *length = sizeof(Raw_HID_CfgDesc);
+  return Raw_HID_CfgDesc;
+}
+
+/**
+  * @brief  Return the Device Qualifier descriptor
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer
+  */
+static uint8_t *Raw_HID_GetDeviceQualifierDesc(uint16_t *length)
+{
+  *length = sizeof(Raw_HID_DeviceQualifierDesc);
+  return Raw_HID_DeviceQualifierDesc;
+}
+
+/**
+  * @brief  Send a command frame to the host as one IN report, zero padded to RAW_HID_REPORT_SIZE.
+  * @param  Buf: Buffer of data to be sent
+  * @param  Len: Number of data to be sent (in bytes), up to RAW_HID_REPORT_SIZE
+  * @retval USBD_OK if the report was queued, USBD_BUSY if the last report has not been collected yet, else USBD_FAIL
+  */
+uint8_t Raw_HID_Transmit(uint8_t* Buf, uint16_t Len)
+{
+  if ((hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED) || (Len > RAW_HID_REPORT_SIZE))
+  {
+    return USBD_FAIL;
+  }
+  if (Tx_Busy)
+  {
+    return USBD_BUSY;
+  }
+
+  memcpy(Tx_Report, Buf, Len);
+  memset(&Tx_Report[Len], 0, RAW_HID_REPORT_SIZE - Len);
+  Tx_Busy = true;
+  USBD_LL_Transmit(&hUsbDeviceFS, RAW_HID_EPIN_ADDR, Tx_Report, RAW_HID_REPORT_SIZE);
+  return USBD_OK;
+}
+
+/**
+  * @brief  Check if a report is still waiting to be collected
+  * @retval true while the last report passed to Raw_HID_Transmit() is waiting, false if another can be sent
+  */
+bool Raw_HID_Transmit_Busy(void)
+{
+  return Tx_Busy;
+}
+
+#endif /* USB_INTERFACE_HID */
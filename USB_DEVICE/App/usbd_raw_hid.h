@@ -0,0 +1,38 @@
+/**
+  ******************************************************************************
+  * @file    usbd_raw_hid.h
+  * @brief   Header for usbd_raw_hid.c file.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __USBD_RAW_HID_H__
+#define __USBD_RAW_HID_H__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include "usbd_ioreq.h"
+
+#if (USB_INTERFACE_HID == 1)
+
+#define RAW_HID_EPIN_ADDR           0x81U   /* EP1 for report IN */
+#define RAW_HID_EPOUT_ADDR          0x01U   /* EP1 for report OUT */
+#define RAW_HID_REPORT_SIZE         64U     /* Fixed report length. A whole command frame (PAYLOAD_BUF_SIZE + 5) must fit */
+#define RAW_HID_BINTERVAL           1U      /* Polling interval in ms (frames) for both endpoints */
+
+extern USBD_ClassTypeDef USBD_RAW_HID;
+
+uint8_t Raw_HID_Transmit(uint8_t* Buf, uint16_t Len);
+bool Raw_HID_Transmit_Busy(void);
+
+#endif /* USB_INTERFACE_HID */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBD_RAW_HID_H__ */
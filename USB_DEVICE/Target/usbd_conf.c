@@ -24,8 +24,12 @@
 #include "usbd_def.h"
 #include "usbd_core.h"
 #include "usbd_cdc.h"
+#include "usbd_raw_hid.h"
 
 /* USER CODE BEGIN Includes */
+#include "Diagnostics.h"
+#include "MCU_7960_USB.h"
+#include "Power.h"
 
 /* USER CODE END Includes */
 
@@ -53,7 +57,7 @@ void Error_Handler(void);
 /* Private functions ---------------------------------------------------------*/
 static USBD_StatusTypeDef USBD_Get_USB_Status(HAL_StatusTypeDef hal_status);
 /* USER CODE BEGIN 1 */
-static void SystemClockConfig_Resume(void);
+
 /* USER CODE END 1 */
 extern void SystemClock_Config(void);
 
@@ -73,7 +77,7 @@ void HAL_PCD_MspInit(PCD_HandleTypeDef* pcdHandle)
     __HAL_RCC_USB_CLK_ENABLE();
 
     /* Peripheral interrupt init */
-    HAL_NVIC_SetPriority(USB_IRQn, 0, 0);
+    HAL_NVIC_SetPriority(USB_IRQn, 2, 0);
     HAL_NVIC_EnableIRQ(USB_IRQn);
   /* USER CODE BEGIN USB_MspInit 1 */
 
@@ -156,6 +160,7 @@ void HAL_PCD_SOFCallback(PCD_HandleTypeDef *hpcd)
 #endif /* USE_HAL_PCD_REGISTER_CALLBACKS */
 {
   USBD_LL_SOF((USBD_HandleTypeDef*)hpcd->pData);
+  MCU_7960_USB_SOF_Interrupt();
 }
 
 /**
@@ -180,6 +185,8 @@ void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd)
 
   /* Reset Device. */
   USBD_LL_Reset((USBD_HandleTypeDef*)hpcd->pData);
+  DIAGNOSTICS_INC(DIAG_USB_RESET);
+  Diagnostics_Boot_Milestone(BOOT_USB_RESET);
 }
 
 /**
@@ -198,11 +205,9 @@ void HAL_PCD_SuspendCallback(PCD_HandleTypeDef *hpcd)
   USBD_LL_Suspend((USBD_HandleTypeDef*)hpcd->pData);
   /* Enter in STOP mode. */
   /* USER CODE BEGIN 2 */
-  if (hpcd->Init.low_power_enable)
-  {
-    /* Set SLEEPDEEP bit and SleepOnExit of Cortex System Control Register. */
-    SCB->SCR |= (uint32_t)((uint32_t)(SCB_SCR_SLEEPDEEP_Msk | SCB_SCR_SLEEPONEXIT_Msk));
-  }
+  DIAGNOSTICS_INC(DIAG_USB_SUSPEND);
+  /* The outputs are ramped down before STOP mode is entered, so low_power_enable is left disabled and Power.c sets SLEEPDEEP itself */
+  Power_USB_Suspend();
   /* USER CODE END 2 */
 }
 
@@ -219,12 +224,9 @@ void HAL_PCD_ResumeCallback(PCD_HandleTypeDef *hpcd)
 #endif /* USE_HAL_PCD_REGISTER_CALLBACKS */
 {
   /* USER CODE BEGIN 3 */
-  if (hpcd->Init.low_power_enable)
-  {
-    /* Reset SLEEPDEEP bit of Cortex System Control Register. */
-    SCB->SCR &= (uint32_t)~((uint32_t)(SCB_SCR_SLEEPDEEP_Msk | SCB_SCR_SLEEPONEXIT_Msk));
-    SystemClockConfig_Resume();
-  }
+  DIAGNOSTICS_INC(DIAG_USB_RESUME);
+  /* restores the system clock if the MCU was in STOP mode, then the outputs */
+  Power_USB_Resume();
   /* USER CODE END 3 */
   USBD_LL_Resume((USBD_HandleTypeDef*)hpcd->pData);
 }
@@ -331,13 +333,21 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
   HAL_PCD_RegisterIsoInIncpltCallback(&hpcd_USB_FS, PCD_ISOINIncompleteCallback);
 #endif /* USE_HAL_PCD_REGISTER_CALLBACKS */
   /* USER CODE BEGIN EndPoint_Configuration */
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x00 , PCD_SNG_BUF, 0x18);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x80 , PCD_SNG_BUF, 0x58);
+  /* PMA layout: 0x00-0x1F buffer table for EP0-EP3, then 64 bytes for each buffer.
+     Double buffered endpoints take buffer 0 address in the low half word and buffer 1 address in the high half word */
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x00 , PCD_SNG_BUF, 0x20);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x80 , PCD_SNG_BUF, 0x60);
   /* USER CODE END EndPoint_Configuration */
   /* USER CODE BEGIN EndPoint_Configuration_CDC */
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x81 , PCD_SNG_BUF, 0xC0);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x01 , PCD_SNG_BUF, 0x110);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x82 , PCD_SNG_BUF, 0x100);
+#if (USB_INTERFACE_HID == 1)
+  /* interrupt endpoints can't be double buffered */
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , RAW_HID_EPIN_ADDR , PCD_SNG_BUF, 0xA0);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , RAW_HID_EPOUT_ADDR , PCD_SNG_BUF, 0xE0);
+#else
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , CDC_CMD_EP , PCD_SNG_BUF, 0xA0);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , CDC_IN_EP , PCD_DBL_BUF, 0x010000C0);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , CDC_OUT_EP , PCD_DBL_BUF, 0x01800140);
+#endif
   /* USER CODE END EndPoint_Configuration_CDC */
   return USBD_OK;
 }
@@ -606,15 +616,7 @@ void USBD_static_free(void *p)
 }
 
 /* USER CODE BEGIN 5 */
-/**
-  * @brief  Configures system clock after wake-up from USB Resume CallBack:
-  *         enable HSI, PLL and select PLL as system clock source.
-  * @retval None
-  */
-static void SystemClockConfig_Resume(void)
-{
-  SystemClock_Config();
-}
+
 /* USER CODE END 5 */
 
 /**
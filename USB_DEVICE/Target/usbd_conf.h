@@ -35,7 +35,17 @@
 #include "stm32f0xx_hal.h"
 
 /* USER CODE BEGIN INCLUDE */
+/* Set USB_INTERFACE_HID to 1 to replace the CDC interface with a vendor defined HID interface (usbd_raw_hid.c),
+   polled every 1ms, that carries the same command frames. The device enumerates with a different PID */
+#ifndef USB_INTERFACE_HID
+#define USB_INTERFACE_HID           0
+#endif
 
+/* CDC data endpoints are double buffered, which uses both PMA buffer descriptors of an endpoint number.
+   The data OUT endpoint is moved from EP1 to EP3 so that EP1 can be used for the double buffered data IN */
+#define CDC_IN_EP                   0x81U   /* EP1 for data IN, double buffered */
+#define CDC_OUT_EP                  0x03U   /* EP3 for data OUT, double buffered */
+#define CDC_DATA_FS_OUT_XFER_SIZE   128U    /* Bytes per OUT transfer. Each CDC receive buffer of this size is taken from the buffer pool */
 /* USER CODE END INCLUDE */
 
 /** @addtogroup USBD_OTG_DRIVER